@@ -0,0 +1,43 @@
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include "allocstats.h"
+
+static std::atomic<size_t> allocationCount(0);
+static std::atomic<size_t> allocationBytes(0);
+
+void* operator new(size_t size) {
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	allocationBytes.fetch_add(size, std::memory_order_relaxed);
+	void* p = malloc(size ? size : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete[](void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+	free(p);
+}
+
+size_t allocstats::allocations() {
+	return allocationCount.load(std::memory_order_relaxed);
+}
+
+size_t allocstats::bytes() {
+	return allocationBytes.load(std::memory_order_relaxed);
+}
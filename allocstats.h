@@ -0,0 +1,16 @@
+#ifndef __ALLOCSTATS_H__
+#define __ALLOCSTATS_H__
+
+#include <cstddef>
+
+/**
+ * Counters maintained by the program's replacement of the global operator new, used to check that
+ * steady-state frames do not touch the system allocator
+ */
+class allocstats {
+public:
+	static size_t allocations();
+	static size_t bytes();
+};
+
+#endif //__ALLOCSTATS_H__
@@ -0,0 +1,415 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include "animation.h"
+#include "quantized.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const char MAGIC[4] = {'V', 'A', 'N', 'M'};
+static const int VERSION = 1;
+
+/**
+ * Check that two poses have the same vertices, normals and faces
+ */
+static bool sameTopology(Model &a, Model &b) {
+	if (a.nverts() != b.nverts() || a.nnormals() != b.nnormals() || a.nfaces() != b.nfaces()) return false;
+	for (int i = 0; i < a.nfaces(); i++) {
+		const int* fa = a.face(i);
+		const int* fb = b.face(i);
+		if (fa[0] != fb[0] || fa[1] != fb[1] || fa[2] != fb[2]) return false;
+	}
+	return true;
+}
+
+/**
+ * Quantize a pose: the positions as fractions of the bounding box of the sequence, then the normals
+ * as octahedral x and y
+ *
+ * @param pose   the pose
+ * @param header the bounding box of the sequence
+ * @param values receives 3 values per vertex and 2 per normal
+ */
+static void quantizePose(Model &pose, const AnimationHeader &header, std::vector<unsigned short> &values) {
+	int k = 0;
+	for (int i = 0; i < pose.nverts(); i++) {
+		Vec3f v = pose.vert(i);
+		float p[3] = {v.x, v.y, v.z};
+		for (int a = 0; a < 3; a++) {
+			float q = header.scale[a] > 0 ? (p[a] - header.origin[a]) / header.scale[a] + .5f : 0;
+			values[k++] = (unsigned short)std::min(std::max(q, 0.f), 65535.f);
+		}
+	}
+	for (int i = 0; i < pose.nnormals(); i++) {
+		unsigned int e = QuantizedMesh::encodeNormal(pose.norm(i));
+		values[k++] = e & 0xffff;
+		values[k++] = e >> 16;
+	}
+}
+
+/**
+ * Add 8-bit differences to 16-bit values, modulo 2^16
+ */
+static void addDeltas8(unsigned short* values, const signed char* d, int n) {
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(d + i));
+
+		// Widen to 16 bits by unpacking each byte with its sign
+		__m128i sign = _mm_cmpgt_epi8(zero, v);
+		__m128i* q = (__m128i*)(values + i);
+		_mm_storeu_si128(q,     _mm_add_epi16(_mm_loadu_si128(q),     _mm_unpacklo_epi8(v, sign)));
+		_mm_storeu_si128(q + 1, _mm_add_epi16(_mm_loadu_si128(q + 1), _mm_unpackhi_epi8(v, sign)));
+	}
+#endif
+	for (; i < n; i++) {
+		values[i] = (unsigned short)(values[i] + d[i]);
+	}
+}
+
+/**
+ * Add 16-bit differences to 16-bit values, modulo 2^16
+ */
+static void addDeltas16(unsigned short* values, const unsigned short* d, int n) {
+	int i = 0;
+#ifdef __SSE2__
+	for (; i + 8 <= n; i += 8) {
+		__m128i* q = (__m128i*)(values + i);
+		_mm_storeu_si128(q, _mm_add_epi16(_mm_loadu_si128(q), _mm_loadu_si128((const __m128i*)(d + i))));
+	}
+#endif
+	for (; i < n; i++) {
+		values[i] = (unsigned short)(values[i] + d[i]);
+	}
+}
+
+/**
+ * Dequantize positions, eight at a time
+ *
+ * @param q      3 values per position
+ * @param origin the smallest x, y and z
+ * @param scale  the step of x, y and z
+ * @param out    receives x, y and z of each position
+ * @param n      the number of positions
+ */
+static void dequantize(const unsigned short* q, const float* origin, const float* scale, float* out, int n) {
+	int i = 0;
+#ifdef __SSE2__
+	// Eight positions are six vectors of four values; vector j starts at axis j % 3
+	__m128 o[3];
+	__m128 s[3];
+	for (int j = 0; j < 3; j++) {
+		o[j] = _mm_setr_ps(origin[j], origin[(j + 1) % 3], origin[(j + 2) % 3], origin[j]);
+		s[j] = _mm_setr_ps(scale[j],  scale[(j + 1) % 3],  scale[(j + 2) % 3],  scale[j]);
+	}
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 8 <= n; i += 8) {
+		for (int k = 0; k < 3; k++) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(q + i * 3 + k * 8));
+			__m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+			__m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero));
+			int a = 2 * k % 3;
+			int b = (2 * k + 1) % 3;
+			_mm_storeu_ps(out + i * 3 + k * 8,     _mm_add_ps(_mm_mul_ps(lo, s[a]), o[a]));
+			_mm_storeu_ps(out + i * 3 + k * 8 + 4, _mm_add_ps(_mm_mul_ps(hi, s[b]), o[b]));
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		for (int a = 0; a < 3; a++) {
+			out[i * 3 + a] = origin[a] + q[i * 3 + a] * scale[a];
+		}
+	}
+}
+
+/**
+ * Open a vertex animation for playback. Nothing is decoded until the first seek.
+ *
+ * @param filename the file written by encode()
+ */
+VertexAnimation::VertexAnimation(const char* filename) : in_(), header_(), frames_(), values_(), motion_(), payload_(),
+	verts_(), norms_(), current_(-1), decode_(0), decoded_(0), good_(false) {
+	in_.open(filename, std::ios::binary);
+	if (!in_.is_open()) {
+		std::cerr << "can't open file " << filename << "\n";
+		return;
+	}
+	in_.read((char *)&header_, sizeof(header_));
+	if (!in_.good() || memcmp(header_.magic, MAGIC, 4) || header_.version != VERSION || header_.nverts <= 0
+		|| header_.nnormals < 0 || header_.nframes <= 0) {
+		std::cerr << "bad vertex animation header in " << filename << "\n";
+		return;
+	}
+	frames_.resize(header_.nframes);
+	in_.read((char *)&frames_[0], frames_.size() * sizeof(AnimationFrame));
+	if (!in_.good()) {
+		std::cerr << "an error occured while reading the frame table\n";
+		return;
+	}
+	int n = header_.nverts * 3 + header_.nnormals * 2;
+	for (int f = 0; f < header_.nframes; f++) {
+		const AnimationFrame &entry = frames_[f];
+		if (entry.type > DELTA16 || (f == 0 && entry.type != KEY) || (entry.type != DELTA8 && entry.size != n * sizeof(unsigned short))
+			|| entry.size > n * sizeof(unsigned short)) {
+			std::cerr << "bad frame " << f << " in " << filename << "\n";
+			return;
+		}
+	}
+
+	values_.resize(n);
+	motion_.resize(n);
+	payload_.resize(n);
+	verts_.resize(header_.nverts);
+	norms_.resize(header_.nnormals);
+	good_ = true;
+}
+
+/**
+ * Read a frame from the file and bring the values and their motion from the frame before up to it
+ *
+ * @param frame a key frame, or the frame after the one the values hold
+ */
+bool VertexAnimation::apply(int frame) {
+	int n = (int)values_.size();
+	const AnimationFrame &entry = frames_[frame];
+	in_.seekg(entry.offset);
+	in_.read((char *)&payload_[0], entry.size);
+	if (!in_.good()) return false;
+
+	if (entry.type == KEY) {
+		std::copy(payload_.begin(), payload_.end(), values_.begin());
+		std::fill(motion_.begin(), motion_.end(), 0);
+		return true;
+	}
+	if (entry.type == DELTA8) {
+		// The patch count, the 8-bit corrections padded to a whole value, then the patches
+		const unsigned short* p = &payload_[0];
+		unsigned int patches = p[0] | (unsigned int)p[1] << 16;
+		const unsigned short* patch = p + 2 + (n + 1) / 2;
+		if (entry.size != (2 + (n + 1) / 2 + patches * 3) * sizeof(unsigned short)) return false;
+		addDeltas8(&motion_[0], (const signed char*)(p + 2), n);
+		for (unsigned int k = 0; k < patches; k++, patch += 3) {
+			unsigned int i = patch[0] | (unsigned int)patch[1] << 16;
+			if (i >= (unsigned int)n) return false;
+			motion_[i] += patch[2];
+		}
+	} else {
+		addDeltas16(&motion_[0], &payload_[0], n);
+	}
+	addDeltas16(&values_[0], &motion_[0], n);
+	return true;
+}
+
+/**
+ * Decode a frame. Stepping to the next frame reads only that frame; any other frame is decoded
+ * forward from the key frame at or before it.
+ *
+ * @param frame the index of the frame
+ *
+ * @return false if the frame is out of range or can't be read
+ */
+bool VertexAnimation::seek(int frame) {
+	if (!good_ || frame < 0 || frame >= header_.nframes) return false;
+	if (frame == current_) return true;
+	auto start = std::chrono::steady_clock::now();
+
+	int from = frame;
+	while (frames_[from].type != KEY) from--;
+	if (current_ >= from && current_ < frame) from = current_ + 1;
+	for (int f = from; f <= frame; f++) {
+		if (!apply(f)) {
+			std::cerr << "an error occured while reading frame " << f << "\n";
+			good_ = false;
+			current_ = -1;
+			return false;
+		}
+	}
+	current_ = frame;
+
+	// Vec3f is three floats, so the positions can be written as one array
+	dequantize(&values_[0], header_.origin, header_.scale, &verts_[0].x, header_.nverts);
+	const unsigned short* normals = &values_[0] + header_.nverts * 3;
+	for (int i = 0; i < header_.nnormals; i++) {
+		norms_[i] = QuantizedMesh::decodeNormal(normals[i * 2] | (unsigned int)normals[i * 2 + 1] << 16);
+	}
+
+	decode_ += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	decoded_++;
+	return true;
+}
+
+/**
+ * Move a model to the decoded frame
+ *
+ * @param model a model with the topology of the poses, such as the first pose
+ *
+ * @return false if no frame is decoded or the model does not match the poses
+ */
+bool VertexAnimation::pose(Model &model) {
+	return current_ >= 0 && model.setPose(verts_, norms_);
+}
+
+bool VertexAnimation::good() {
+	return good_;
+}
+
+int VertexAnimation::frames() {
+	return good_ ? header_.nframes : 0;
+}
+
+int VertexAnimation::fps() {
+	return header_.fps;
+}
+
+int VertexAnimation::nverts() {
+	return header_.nverts;
+}
+
+int VertexAnimation::nnormals() {
+	return header_.nnormals;
+}
+
+/**
+ * Get the mean time taken by seek() to decode a frame, in milliseconds
+ */
+double VertexAnimation::decodeTime() {
+	return decoded_ ? decode_ / decoded_ : 0;
+}
+
+/**
+ * Get the bytes held for playback
+ */
+size_t VertexAnimation::bytes() {
+	return sizeof(*this) + frames_.capacity() * sizeof(AnimationFrame) + values_.capacity() * sizeof(unsigned short)
+		+ motion_.capacity() * sizeof(unsigned short) + payload_.capacity() * sizeof(unsigned short) + verts_.capacity() * sizeof(Vec3f) + norms_.capacity() * sizeof(Vec3f);
+}
+
+/**
+ * Encode a sequence of poses of one mesh, each in its own OBJ file. The poses are read twice,
+ * first to find the bounding box of the sequence and then to encode them, so only one pose is in
+ * memory at a time.
+ *
+ * @param poses       the OBJ files of the poses, in order
+ * @param filename    the file to write
+ * @param fps         the frame rate to play the sequence at
+ * @param keyInterval the number of frames from one key frame to the next
+ *
+ * @return false if a pose can't be read or does not share the vertices, normals and faces of the
+ *         first, or the file can't be written
+ */
+bool VertexAnimation::encode(const std::vector<const char*> &poses, const char* filename, int fps, int keyInterval) {
+	if (poses.empty()) return false;
+	keyInterval = std::max(1, keyInterval);
+
+	Model first(poses[0]);
+	if (first.nverts() == 0) {
+		std::cerr << "can't read pose " << poses[0] << "\n";
+		return false;
+	}
+	Vec3f lo = first.vert(0);
+	Vec3f hi = lo;
+	for (int p = 0; p < (int)poses.size(); p++) {
+		Model pose(poses[p]);
+		if (!sameTopology(first, pose)) {
+			std::cerr << "pose " << poses[p] << " does not share the mesh of " << poses[0] << "\n";
+			return false;
+		}
+		for (int i = 0; i < pose.nverts(); i++) {
+			Vec3f v = pose.vert(i);
+			for (int a = 0; a < 3; a++) {
+				lo[a] = std::min(lo[a], v[a]);
+				hi[a] = std::max(hi[a], v[a]);
+			}
+		}
+	}
+
+	AnimationHeader header;
+	memcpy(header.magic, MAGIC, 4);
+	header.version = VERSION;
+	header.nverts = first.nverts();
+	header.nnormals = first.nnormals();
+	header.nframes = (int)poses.size();
+	header.keyInterval = keyInterval;
+	header.fps = fps;
+	for (int a = 0; a < 3; a++) {
+		header.origin[a] = lo[a];
+		header.scale[a] = (hi[a] - lo[a]) / 65535.f;
+	}
+
+	std::ofstream out(filename, std::ios::binary);
+	if (!out.is_open()) {
+		std::cerr << "can't open file " << filename << "\n";
+		return false;
+	}
+	std::vector<AnimationFrame> table(poses.size());
+	out.write((char *)&header, sizeof(header));
+	out.write((char *)&table[0], table.size() * sizeof(AnimationFrame));
+
+	int n = header.nverts * 3 + header.nnormals * 2;
+	std::vector<unsigned short> previous(n);
+	std::vector<unsigned short> values(n);
+	std::vector<unsigned short> motion(n);
+	std::vector<unsigned short> deltas(n);
+	std::vector<unsigned short> narrow(2 + (n + 1) / 2);
+	std::vector<unsigned short> patches;
+	int counts[3] = {0, 0, 0};
+	for (int p = 0; p < (int)poses.size(); p++) {
+		Model pose(poses[p]);
+		if (!sameTopology(first, pose)) {
+			std::cerr << "pose " << poses[p] << " changed while encoding\n";
+			return false;
+		}
+		quantizePose(pose, header, values);
+
+		// The differences wrap around, so any change fits in 16 bits. -128 marks a correction that
+		// is patched, by the rest of it.
+		bool key = p % keyInterval == 0;
+		signed char* bytes = (signed char*)&narrow[2];
+		patches.clear();
+		for (int i = 0; i < n; i++) {
+			unsigned short step = key ? 0 : (unsigned short)(values[i] - previous[i]);
+			deltas[i] = (unsigned short)(step - motion[i]);
+			motion[i] = step;
+			short d = (short)deltas[i];
+			bytes[i] = d > -128 && d < 128 ? (signed char)d : -128;
+			if (bytes[i] == -128) {
+				patches.push_back(i & 0xffff);
+				patches.push_back(i >> 16);
+				patches.push_back((unsigned short)(d + 128));
+			}
+		}
+		if (n & 1) bytes[n] = 0;
+		narrow[0] = patches.size() / 3 & 0xffff;
+		narrow[1] = patches.size() / 3 >> 16;
+
+		unsigned char type = key ? KEY : (narrow.size() + patches.size() < (size_t)n ? DELTA8 : DELTA16);
+		table[p].offset = out.tellp();
+		table[p].type = type;
+		if (type == KEY) {
+			out.write((char *)&values[0], n * sizeof(unsigned short));
+		} else if (type == DELTA8) {
+			out.write((char *)&narrow[0], narrow.size() * sizeof(unsigned short));
+			if (!patches.empty()) out.write((char *)&patches[0], patches.size() * sizeof(unsigned short));
+		} else {
+			out.write((char *)&deltas[0], n * sizeof(unsigned short));
+		}
+		table[p].size = (unsigned int)((size_t)out.tellp() - table[p].offset);
+		counts[type]++;
+		previous.swap(values);
+	}
+	size_t bytes = out.tellp();
+	out.seekp(sizeof(header));
+	out.write((char *)&table[0], table.size() * sizeof(AnimationFrame));
+	if (!out.good()) {
+		std::cerr << "can't write the animation\n";
+		return false;
+	}
+
+	std::cerr << "# animation " << header.nframes << " frames: " << counts[KEY] << " key, " << counts[DELTA8] << " 8-bit, "
+		<< counts[DELTA16] << " 16-bit, " << bytes / 1024 << " KB" << std::endl;
+	return true;
+}
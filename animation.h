@@ -0,0 +1,87 @@
+#ifndef __ANIMATION_H__
+#define __ANIMATION_H__
+
+#include <fstream>
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+
+#pragma pack(push,1)
+struct AnimationHeader {
+	char magic[4];
+	int version;
+	int nverts;
+	int nnormals;
+	int nframes;
+	int keyInterval;
+	int fps;
+	float origin[3];
+	float scale[3];
+};
+
+struct AnimationFrame {
+	unsigned long long offset;
+	unsigned int size;
+	unsigned char type;
+};
+#pragma pack(pop)
+
+/**
+ * A vertex animation: a sequence of poses of one mesh, played back a frame at a time from a file.
+ *
+ * Each pose is quantized to 16-bit values: positions as fractions of the bounding box of the whole
+ * sequence, and normals octahedral-encoded as in QuantizedMesh. Every keyInterval frames, starting
+ * with the first, a key frame stores the values in full. The frames in between predict that each
+ * value moves as it did into the frame before, and store how far the motion is off, modulo 2^16.
+ * The corrections take 8 bits each, with the few that don't fit, such as normals crossing the fold
+ * of the octahedron, patched afterwards at full width; when that comes out larger, they take 16
+ * bits each. Decoding is exact integer arithmetic, so playback never drifts from the quantized
+ * poses. A table of the offset, size and type of each frame follows the header, so that seeking
+ * reads from the key frame at or before the target.
+ *
+ * Playback keeps only the values of the current frame and reads one frame from the file at a time.
+ * The faces, texture coordinates and texture stay those of the model the poses are handed to.
+ */
+class VertexAnimation {
+public:
+	enum FrameType {
+		KEY, DELTA8, DELTA16
+	};
+
+	static const int KEY_INTERVAL = 32;
+
+private:
+	std::ifstream               in_;
+	AnimationHeader             header_;
+	std::vector<AnimationFrame> frames_;
+	std::vector<unsigned short> values_;
+	std::vector<unsigned short> motion_;
+	std::vector<unsigned short> payload_;
+	std::vector<Vec3f>          verts_;
+	std::vector<Vec3f>          norms_;
+	int                         current_;
+	double                      decode_;
+	int                         decoded_;
+	bool                        good_;
+
+	bool apply(int frame);
+
+	VertexAnimation(const VertexAnimation &);
+	VertexAnimation & operator =(const VertexAnimation &);
+
+public:
+	VertexAnimation(const char* filename);
+	bool good();
+	int frames();
+	int fps();
+	int nverts();
+	int nnormals();
+	bool seek(int frame);
+	bool pose(Model &model);
+	double decodeTime();
+	size_t bytes();
+
+	static bool encode(const std::vector<const char*> &poses, const char* filename, int fps, int keyInterval = KEY_INTERVAL);
+};
+
+#endif //__ANIMATION_H__
@@ -0,0 +1,88 @@
+#include <algorithm>
+#include "arena.h"
+
+Arena::Arena(size_t blockSize) : blocks_(NULL), cursor_(NULL), end_(NULL), blockSize_(blockSize), used_(0), peak_(0), mallocs_(0) {
+}
+
+Arena::~Arena() {
+	while (blocks_) {
+		Block* next = blocks_->next;
+		::operator delete(blocks_);
+		blocks_ = next;
+	}
+}
+
+/**
+ * Start a new block that can hold at least the given number of bytes
+ *
+ * @param bytes the size of the allocation that did not fit
+ */
+void Arena::grow(size_t bytes) {
+	size_t size = std::max(blockSize_, bytes + sizeof(Block));
+	Block* b = (Block*)::operator new(size);
+	mallocs_++;
+
+	b->next = blocks_;
+	b->size = size;
+	blocks_ = b;
+	cursor_ = (char*)(b + 1);
+	end_    = (char*)b + size;
+}
+
+/**
+ * Release every allocation. If the last frame needed more than one block, they are merged into a
+ * single block of the peak size so the next frame fits without growing.
+ */
+void Arena::reset() {
+	peak_ = std::max(peak_, used_);
+	used_ = 0;
+	if (!blocks_) return;
+
+	if (blocks_->next) {
+		size_t total = 0;
+		while (blocks_) {
+			Block* next = blocks_->next;
+			total += blocks_->size;
+			::operator delete(blocks_);
+			blocks_ = next;
+		}
+		blockSize_ = std::max(blockSize_, total);
+		cursor_ = end_ = NULL;
+		grow(0);
+		return;
+	}
+
+	cursor_ = (char*)(blocks_ + 1);
+}
+
+/**
+ * Get the number of bytes allocated since the last reset
+ */
+size_t Arena::used() {
+	return used_;
+}
+
+/**
+ * Get the largest number of bytes allocated in one frame
+ */
+size_t Arena::peak() {
+	return std::max(peak_, used_);
+}
+
+/**
+ * Get the number of bytes held by the arena
+ */
+size_t Arena::capacity() {
+	size_t total = 0;
+	for (Block* b = blocks_; b; b = b->next) {
+		total += b->size;
+	}
+	return total;
+}
+
+/**
+ * Get the number of blocks requested from the system allocator
+ */
+size_t Arena::mallocs() {
+	return mallocs_;
+}
@@ -0,0 +1,173 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+/**
+ * A bump allocator for data that lives for one frame. Allocation is a pointer increment and
+ * nothing is freed individually; reset() releases everything at once. If a frame outgrows the
+ * arena, the next reset() replaces the blocks with one block large enough for the whole frame,
+ * so a steady workload stops calling the system allocator after its first frames.
+ */
+class Arena {
+private:
+	struct Block {
+		Block* next;
+		size_t size;
+	};
+
+	Block* blocks_;
+	char*  cursor_;
+	char*  end_;
+	size_t blockSize_;
+	size_t used_;
+	size_t peak_;
+	size_t mallocs_;
+
+	void grow(size_t bytes);
+
+	Arena(const Arena &);
+	Arena & operator =(const Arena &);
+
+public:
+	Arena(size_t blockSize = 1 << 20);
+	~Arena();
+	void reset();
+	size_t used();
+	size_t peak();
+	size_t capacity();
+	size_t mallocs();
+
+	/**
+	 * Allocate uninitialized memory
+	 *
+	 * @param bytes the size of the allocation
+	 * @param align the alignment of the allocation; a power of 2
+	 */
+	void* allocate(size_t bytes, size_t align = alignof(std::max_align_t)) {
+		char* p = (char*)(((size_t)cursor_ + align - 1) & ~(align - 1));
+		if (p + bytes > end_) {
+			grow(bytes + align);
+			p = (char*)(((size_t)cursor_ + align - 1) & ~(align - 1));
+		}
+		cursor_ = p + bytes;
+		used_ += bytes;
+		return p;
+	}
+
+	/**
+	 * Allocate an array of default-constructed objects. Destructors are never run, so T should be trivial.
+	 *
+	 * @param n the number of objects
+	 */
+	template <class T> T* allocate(size_t n) {
+		T* p = (T*)allocate(n * sizeof(T), alignof(T));
+		for (size_t i = 0; i < n; i++) {
+			new (p + i) T();
+		}
+		return p;
+	}
+};
+
+/**
+ * An allocator for standard containers that draws from an arena. Deallocation is a no-op.
+ */
+template <class T> struct ArenaAllocator {
+	typedef T value_type;
+	Arena* arena;
+
+	ArenaAllocator(Arena &a) : arena(&a) {
+	}
+
+	template <class U> ArenaAllocator(const ArenaAllocator<U> &a) : arena(a.arena) {
+	}
+
+	T* allocate(size_t n) { return (T*)arena->allocate(n * sizeof(T), alignof(T)); }
+	void deallocate(T*, size_t) {}
+
+	template <class U> bool operator ==(const ArenaAllocator<U> &a) const { return arena == a.arena; }
+	template <class U> bool operator !=(const ArenaAllocator<U> &a) const { return arena != a.arena; }
+};
+
+/**
+ * A free-list allocator for fixed-size objects that are created and destroyed many times per frame.
+ * Memory is taken from the system in chunks of CHUNK objects and only returned when the pool dies.
+ */
+template <class T, int CHUNK = 256> class Pool {
+private:
+	union Slot {
+		Slot* next;
+		alignas(T) char storage[sizeof(T)];
+	};
+
+	std::vector<Slot*> chunks_;
+	Slot* free_;
+	int   live_;
+	int   peak_;
+
+	Pool(const Pool &);
+	Pool & operator =(const Pool &);
+
+public:
+	Pool() : chunks_(), free_(NULL), live_(0), peak_(0) {
+	}
+
+	~Pool() {
+		for (int i = 0; i < (int)chunks_.size(); i++) {
+			delete [] chunks_[i];
+		}
+	}
+
+	/**
+	 * Create an object in the pool
+	 */
+	T* acquire() {
+		if (!free_) {
+			Slot* chunk = new Slot[CHUNK];
+			for (int i = 0; i < CHUNK; i++) {
+				chunk[i].next = i + 1 < CHUNK ? &chunk[i + 1] : NULL;
+			}
+			chunks_.push_back(chunk);
+			free_ = chunk;
+		}
+		Slot* s = free_;
+		free_ = s->next;
+		if (++live_ > peak_) peak_ = live_;
+		return new (s->storage) T();
+	}
+
+	/**
+	 * Destroy an object and return its memory to the pool
+	 *
+	 * @param p an object created by acquire()
+	 */
+	void release(T* p) {
+		p->~T();
+		Slot* s = (Slot*)p;
+		s->next = free_;
+		free_ = s;
+		live_--;
+	}
+
+	int live() { return live_; }
+	int peak() { return peak_; }
+	int capacity() { return (int)chunks_.size() * CHUNK; }
+};
+
+/**
+ * The state shared by the stages of the pipeline while a frame is drawn
+ */
+struct RenderContext {
+	Arena frame;
+
+	/**
+	 * Release the transient data of the previous frame
+	 */
+	void beginFrame() {
+		frame.reset();
+	}
+};
+
+#endif //__ARENA_H__
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <cstring>
+#include "atlas.h"
+
+TextureAtlas::TextureAtlas() : image_(), regions_(), width_(0), height_(0) {
+}
+
+/**
+ * Copy one texel between images of possibly different formats, spreading grayscale over the color
+ * channels and making missing alpha opaque
+ */
+static void copyTexel(const unsigned char* from, int fromBpp, unsigned char* to, int toBpp) {
+	for (int c = 0; c < 3; c++) {
+		to[c] = from[fromBpp == 1 ? 0 : c];
+	}
+	if (toBpp == 4) {
+		to[3] = fromBpp == 4 ? from[3] : 255;
+	}
+}
+
+/**
+ * Copy a texture into its region of the atlas and fill the border around the region by repeating
+ * the texels along the texture's edges
+ *
+ * @param src     the texture
+ * @param dst     the whole atlas
+ * @param r       the region of the atlas to copy the texture to, of the same size as the texture
+ * @param padding the width of the border around the region
+ */
+static void blit(const ImageView &src, const ImageView &dst, const Rect &r, int padding) {
+	int w = src.width();
+	int h = src.height();
+	int bpp = dst.bytespp();
+	for (int y = r.y0 - padding; y < r.y1 + padding; y++) {
+		int sy = std::min(std::max(y - r.y0, 0), h - 1);
+		unsigned char* row = dst.pixel(r.x0, y);
+		if (src.bytespp() == bpp && src.stride() == bpp) {
+			memcpy(row, src.pixel(0, sy), (size_t)w * bpp);
+		} else {
+			for (int x = 0; x < w; x++) {
+				copyTexel(src.pixel(x, sy), src.bytespp(), row + x * bpp, bpp);
+			}
+		}
+		for (int x = 1; x <= padding; x++) {
+			memcpy(row - x * bpp, row, bpp);
+			memcpy(row + (w - 1 + x) * bpp, row + (w - 1) * bpp, bpp);
+		}
+	}
+}
+
+/**
+ * Pack textures into the atlas, replacing what it held before. The textures are placed on shelves,
+ * tallest first, in an atlas whose width is the smallest power of two they fit in.
+ *
+ * @param textures the textures to pack, none of them empty
+ * @param padding  the width of the border of repeated edge texels around each texture
+ * @param maxSize  the largest width and height the atlas may have
+ *
+ * @return false if the textures do not fit in an atlas of the largest size
+ */
+bool TextureAtlas::pack(const std::vector<TGAImage*> &textures, int padding, int maxSize) {
+	int n = (int)textures.size();
+	regions_.assign(n, Rect());
+	image_ = TGAImage();
+	width_ = 0;
+	height_ = 0;
+	if (n == 0) return false;
+
+	std::vector<int> order(n);
+	long area = 0;
+	int widest = 0;
+	int bytespp = 3;
+	for (int i = 0; i < n; i++) {
+		order[i] = i;
+		int w = textures[i]->get_width() + 2 * padding;
+		int h = textures[i]->get_height() + 2 * padding;
+		area += (long)w * h;
+		widest = std::max(widest, w);
+		if (textures[i]->get_bytespp() == 4) bytespp = 4;
+	}
+	std::sort(order.begin(), order.end(), [&](int a, int b) {
+		if (textures[a]->get_height() != textures[b]->get_height()) {
+			return textures[a]->get_height() > textures[b]->get_height();
+		}
+		return textures[a]->get_width() > textures[b]->get_width();
+	});
+
+	// Try widths from the smallest that could hold the area upwards, until the shelves fit in a square
+	int side = 64;
+	while ((long)side * side < area || side < widest) side *= 2;
+	int height = 0;
+	for (; side <= maxSize; side *= 2) {
+		int x = 0;
+		int y = 0;
+		int shelf = 0;
+		for (int k = 0; k < n; k++) {
+			int i = order[k];
+			int w = textures[i]->get_width() + 2 * padding;
+			int h = textures[i]->get_height() + 2 * padding;
+			if (x + w > side) {
+				y += shelf;
+				x = 0;
+				shelf = 0;
+			}
+			regions_[i] = Rect(x + padding, y + padding, x + w - padding, y + h - padding);
+			x += w;
+			shelf = std::max(shelf, h);
+		}
+		height = y + shelf;
+		if (height <= side) break;
+	}
+	if (side > maxSize) {
+		regions_.assign(n, Rect());
+		return false;
+	}
+
+	image_ = TGAImage(side, height, bytespp);
+	width_ = side;
+	height_ = height;
+	ImageView atlas = image_.view();
+	for (int i = 0; i < n; i++) {
+		blit(textures[i]->view(), atlas, regions_[i], padding);
+	}
+	return true;
+}
+
+TGAImage &TextureAtlas::image() {
+	return image_;
+}
+
+/**
+ * Get the number of textures in the atlas
+ */
+int TextureAtlas::size() const {
+	return (int)regions_.size();
+}
+
+/**
+ * Get the region of the atlas that holds a texture, without its border
+ */
+const Rect &TextureAtlas::region(int i) const {
+	return regions_[i];
+}
+
+/**
+ * Map texture coordinates of one of the packed textures to coordinates in the atlas. Coordinates
+ * outside [0, 1] are clamped, as a region cannot repeat.
+ *
+ * @param i  the index of the texture
+ * @param uv the coordinates in the texture
+ */
+Vec2f TextureAtlas::remap(int i, Vec2f uv) const {
+	const Rect &r = regions_[i];
+	float u = std::min(std::max(uv.x, 0.f), 1.f);
+	float v = std::min(std::max(uv.y, 0.f), 1.f);
+	return Vec2f(
+		(r.x0 + u * (r.x1 - r.x0)) / width_,
+		(r.y0 + v * (r.y1 - r.y0)) / height_
+	);
+}
@@ -0,0 +1,29 @@
+#ifndef __ATLAS_H__
+#define __ATLAS_H__
+
+#include <vector>
+#include "geometry.h"
+#include "tgaimage.h"
+
+/**
+ * Several textures packed into one image, so that a model whose faces sample different textures can
+ * be drawn with a single texture. Each texture sits in its own region surrounded by a border of
+ * repeated edge texels, which keeps lookups near the edge of a region from picking up a neighbour.
+ */
+class TextureAtlas {
+private:
+	TGAImage image_;
+	std::vector<Rect> regions_;
+	int width_;
+	int height_;
+
+public:
+	TextureAtlas();
+	bool pack(const std::vector<TGAImage*> &textures, int padding, int maxSize);
+	TGAImage &image();
+	int size() const;
+	const Rect &region(int i) const;
+	Vec2f remap(int i, Vec2f uv) const;
+};
+
+#endif //__ATLAS_H__
@@ -0,0 +1,90 @@
+#include <cstdio>
+#include <iostream>
+#include "banded.h"
+
+/**
+ * @param basename   the name of the output, without the .tga extension
+ * @param width      the width of the image
+ * @param height     the height of the image
+ * @param bandHeight the number of rows drawn at a time
+ * @param tileSize   the largest width and height of one output file; at most TGAStream::MAX_SIZE
+ */
+BandedRenderer::BandedRenderer(const char* basename, int width, int height, int bandHeight, int tileSize) :
+	basename_(basename), width_(width), height_(height), bandHeight_(bandHeight),
+	tileSize_(std::min(tileSize, (int)TGAStream::MAX_SIZE)),
+	filesX_((width + tileSize_ - 1) / tileSize_), filesY_((height + tileSize_ - 1) / tileSize_),
+	band_(std::min(width, tileSize_), std::min(bandHeight, height), TGAImage::RGB), row_(), stats_() {
+
+	stats_.files = filesX_ * filesY_;
+	stats_.bandBytes = (long)band_.get_width() * band_.get_height() * (TGAImage::RGB + sizeof(float));
+}
+
+BandedRenderer::~BandedRenderer() {
+	closeRow();
+}
+
+/**
+ * Get the pixels of the image that go to one output file
+ *
+ * @param row the row of the file, counting from the bottom of the image
+ * @param col the column of the file
+ */
+Rect BandedRenderer::fileRect(int row, int col) {
+	return Rect(col * tileSize_, row * tileSize_, std::min(width_, (col + 1) * tileSize_), std::min(height_, (row + 1) * tileSize_));
+}
+
+/**
+ * Open the files of one row of the grid
+ *
+ * @param row the row of files, counting from the bottom of the image
+ */
+bool BandedRenderer::openRow(int row) {
+	for (int col = 0; col < filesX_; col++) {
+		char filename[32];
+		if (filesX_ == 1 && filesY_ == 1) {
+			snprintf(filename, sizeof(filename), ".tga");
+		} else {
+			snprintf(filename, sizeof(filename), "_%d_%d.tga", filesY_ - 1 - row, col);
+		}
+
+		Rect r = fileRect(row, col);
+		TGAStream* file = new TGAStream();
+		row_.push_back(file);
+		if (!file->open((basename_ + filename).c_str(), r.x1 - r.x0, r.y1 - r.y0, TGAImage::RGB)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Finish the files of the current row of the grid
+ */
+bool BandedRenderer::closeRow() {
+	bool good = true;
+	for (size_t i = 0; i < row_.size(); i++) {
+		good = row_[i]->close() && good;
+		delete row_[i];
+	}
+	row_.clear();
+	return good;
+}
+
+/**
+ * Stream the rows drawn into the band to a file of the current row
+ *
+ * @param col   the column of the file
+ * @param nrows the number of rows drawn
+ */
+bool BandedRenderer::writeBand(int col, int nrows) {
+	stats_.bands++;
+	return row_[col]->write(band_, 0, 0, nrows);
+}
+
+TGAImage &BandedRenderer::band() {
+	return band_;
+}
+
+const BandStats &BandedRenderer::stats() {
+	return stats_;
+}
@@ -0,0 +1,142 @@
+#ifndef __BANDED_H__
+#define __BANDED_H__
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "model.h"
+#include "shader.h"
+
+/**
+ * How an out-of-core render was split up
+ */
+struct BandStats {
+	int files;
+	int bands;
+	long binned;
+	long bandBytes;
+
+	BandStats() : files(0), bands(0), binned(0), bandBytes(0) {
+	}
+};
+
+/**
+ * Renders an image of any size with a fixed memory budget. The image is drawn one band of rows at
+ * a time into a small target, and each finished band is streamed to the output before the next is
+ * drawn. Faces are binned by their screen rows, so each band only rasterizes the faces that cross it.
+ *
+ * TGA limits an image to 32767 pixels per side, so larger outputs are split into a grid of files
+ * named <basename>_<row>_<column>.tga, with row 0 at the top of the picture. An output that fits
+ * in one file is written to <basename>.tga. Peak memory depends on the band size and the width of
+ * one file, not on the size of the image.
+ */
+class BandedRenderer {
+private:
+	std::string basename_;
+	int width_;
+	int height_;
+	int bandHeight_;
+	int tileSize_;
+	int filesX_;
+	int filesY_;
+	TGAImage band_;
+	std::vector<TGAStream*> row_;
+	BandStats stats_;
+
+	Rect fileRect(int row, int col);
+	bool openRow(int row);
+	bool closeRow();
+	bool writeBand(int col, int nrows);
+
+	BandedRenderer(const BandedRenderer &);
+	BandedRenderer & operator =(const BandedRenderer &);
+
+public:
+	BandedRenderer(const char* basename, int width, int height, int bandHeight = 64, int tileSize = TGAStream::MAX_SIZE);
+	~BandedRenderer();
+	TGAImage &band();
+	const BandStats &stats();
+
+	/**
+	 * Render every face of a model into the output files
+	 *
+	 * @param model  the model to draw
+	 * @param shader the shader to run; it must be constructed against band(), and only its
+	 *               varyings are taken from its vertex stage
+	 *
+	 * @return false if an output file could not be written
+	 */
+	template <class Shader> bool render(Model &model, Shader &shader) {
+		const int N = Shader::VARYINGS;
+		int nfaces = model.nfaces();
+		std::vector<Vec3f> screen(nfaces * 3);
+		std::vector<float> varyings(nfaces * 3 * N);
+		std::vector<Vec2f> spanX(nfaces);
+		std::vector<Vec2f> spanY(nfaces);
+		std::vector<int> order(nfaces);
+		float (*varying)[N] = reinterpret_cast<float (*)[N]>(&varyings[0]);
+
+		// Run the vertex stage once, in the pixel coordinates of the whole image as toScreen computes
+		// them, so that the bands draw exactly what drawing the whole image at once would
+		for (int i = 0; i < nfaces; i++) {
+			const int* face = model.face(i);
+			for (int j = 0; j < 3; j++) {
+				Vec3f v = model.vert(face[j]);
+				shader.vertex(i, j, varying[i * 3 + j]);
+				screen[i * 3 + j] = Vec3f((v.x + 1.) * width_ / 2., (v.y + 1.) * height_ / 2., v.z);
+			}
+			const Vec3f* s = &screen[i * 3];
+			spanX[i] = Vec2f(std::min(std::min(s[0].x, s[1].x), s[2].x), std::max(std::max(s[0].x, s[1].x), s[2].x));
+			spanY[i] = Vec2f(std::min(std::min(s[0].y, s[1].y), s[2].y), std::max(std::max(s[0].y, s[1].y), s[2].y));
+			order[i] = i;
+		}
+		std::sort(order.begin(), order.end(), [&spanY](int a, int b) { return spanY[a].x < spanY[b].x; });
+
+		// Sweep the bands from the bottom of the image up, which is the order the files store their rows in
+		std::vector<int> active;
+		size_t next = 0;
+		for (int row = 0; row < filesY_; row++) {
+			if (!openRow(row)) return false;
+			Rect rows = fileRect(row, 0);
+
+			for (int y0 = rows.y0; y0 < rows.y1; y0 += bandHeight_) {
+				int nrows = std::min(bandHeight_, rows.y1 - y0);
+
+				// Re-bin: drop the faces below the band and pick up the ones that start in it
+				size_t kept = 0;
+				for (size_t k = 0; k < active.size(); k++) {
+					if (spanY[active[k]].y >= y0 - 1) active[kept++] = active[k];
+				}
+				active.resize(kept);
+				for (; next < order.size() && spanY[order[next]].x < y0 + nrows + 1; next++) {
+					if (spanY[order[next]].y >= y0 - 1) active.push_back(order[next]);
+				}
+
+				for (int col = 0; col < filesX_; col++) {
+					Rect r = fileRect(row, col);
+					band_.clear();
+					band_.setClip(Rect(0, 0, r.x1 - r.x0, nrows));
+
+					for (size_t k = 0; k < active.size(); k++) {
+						int i = active[k];
+						if (spanX[i].y < r.x0 - 1 || spanX[i].x > r.x1 + 1) continue;
+
+						Vec3f local[3];
+						for (int j = 0; j < 3; j++) {
+							local[j] = Vec3f(screen[i * 3 + j].x - r.x0, screen[i * 3 + j].y - y0, screen[i * 3 + j].z);
+						}
+						rasterize(shader, local, &varying[i * 3], band_);
+						stats_.binned++;
+					}
+					if (!writeBand(col, nrows)) return false;
+				}
+			}
+			if (!closeRow()) return false;
+		}
+		return true;
+	}
+};
+
+#endif //__BANDED_H__
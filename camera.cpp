@@ -0,0 +1,54 @@
+#include <cmath>
+#include "camera.h"
+
+/**
+ * @param eye    the position of the camera
+ * @param target the point the camera looks at
+ * @param up     the direction that is up on the screen
+ * @param fovy   the vertical field of view in radians
+ * @param aspect the width of the image over its height
+ * @param near   the distance to the near plane; positive
+ * @param far    the distance to the far plane
+ */
+Camera::Camera(Vec3f eye, Vec3f target, Vec3f up, float fovy, float aspect, float near, float far) {
+	// The view matrix: a basis with the camera looking down -z
+	Vec3f f = target - eye;
+	f.normalize();
+	Vec3f s = f ^ up;
+	s.normalize();
+	Vec3f u = s ^ f;
+	float view[4][4] = {
+		{ s.x,  s.y,  s.z, -(s * eye)},
+		{ u.x,  u.y,  u.z, -(u * eye)},
+		{-f.x, -f.y, -f.z,   f * eye },
+		{ 0,    0,    0,     1       }
+	};
+
+	// The projection takes the frustum to the cube -w <= x, y, z <= w, with w the distance along -z
+	float g = 1.f / std::tan(fovy / 2);
+	float proj[4][4] = {
+		{g / aspect, 0, 0,                            0},
+		{0,          g, 0,                            0},
+		{0,          0, (far + near) / (near - far),  2 * far * near / (near - far)},
+		{0,          0, -1,                           0}
+	};
+
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 4; j++) {
+			viewProj_[i][j] = 0;
+			for (int k = 0; k < 4; k++) viewProj_[i][j] += proj[i][k] * view[k][j];
+		}
+	}
+}
+
+/**
+ * Take a point to clip space
+ *
+ * @param v    the point in object space
+ * @param clip set to the x, y, z and w of the point
+ */
+void Camera::project(const Vec3f &v, float* clip) const {
+	for (int i = 0; i < 4; i++) {
+		clip[i] = viewProj_[i][0] * v.x + viewProj_[i][1] * v.y + viewProj_[i][2] * v.z + viewProj_[i][3];
+	}
+}
@@ -0,0 +1,203 @@
+#ifndef __CAMERA_H__
+#define __CAMERA_H__
+
+#include <cmath>
+#include <algorithm>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "model.h"
+#include "shader.h"
+
+/**
+ * A perspective camera: a view matrix looking from an eye point at a target and a projection onto
+ * a frustum between a near and a far plane. Points are taken to clip space (x, y, z, w), where the
+ * visible volume is -w <= x, y, z <= w.
+ */
+class Camera {
+private:
+	float viewProj_[4][4];
+
+public:
+	Camera(Vec3f eye, Vec3f target, Vec3f up, float fovy, float aspect, float near, float far);
+	void project(const Vec3f &v, float* clip) const;
+};
+
+/**
+ * How the faces of a model fared in the clipper
+ */
+struct ClipStats {
+	int faces;
+	int rejected;
+	int clipped;
+	int triangles;
+
+	ClipStats() : faces(0), rejected(0), clipped(0), triangles(0) {
+	}
+};
+
+/**
+ * Clips triangles in clip space against the near and far planes and a guard band around the
+ * viewport. The guard band is a few times the size of the viewport, so most triangles that cross
+ * the edges of the image are left whole and scissored by the rasterizer instead; only those that
+ * reach past the band are cut, which keeps every screen coordinate small enough to convert to an
+ * int safely. A triangle outside one plane entirely is rejected without clipping.
+ */
+template <int N> class Clipper {
+public:
+	// A vertex in clip space with its varyings
+	struct Vertex {
+		float p[4];
+		float varying[N];
+	};
+
+	// Sutherland-Hodgman adds at most one vertex per plane
+	static const int PLANES = 6;
+	static const int MAX_VERTS = 3 + PLANES;
+
+	/**
+	 * @param guard the half-size of the guard band in normalized device coordinates
+	 */
+	Clipper(float guard) : guard_(guard) {
+	}
+
+	/**
+	 * Clip a triangle
+	 *
+	 * @param in      the 3 vertices
+	 * @param out     the vertices of the clipped polygon, a fan around the first one
+	 * @param clipped set to whether the triangle had to be cut
+	 *
+	 * @return the number of vertices of the clipped polygon; less than 3 if nothing is left
+	 */
+	int clip(const Vertex* in, Vertex* out, bool &clipped) const {
+		int outside = 0;
+		int all = (1 << PLANES) - 1;
+		for (int i = 0; i < 3; i++) {
+			int codes = outcode(in[i].p);
+			outside |= codes;
+			all &= codes;
+		}
+		clipped = false;
+		if (all) return 0;
+		for (int i = 0; i < 3; i++) out[i] = in[i];
+		if (!outside) return 3;
+
+		clipped = true;
+		Vertex scratch[MAX_VERTS];
+		int n = 3;
+		for (int plane = 0; plane < PLANES && n >= 3; plane++) {
+			if (!(outside & (1 << plane))) continue;
+			for (int i = 0; i < n; i++) scratch[i] = out[i];
+			int m = 0;
+			for (int i = 0; i < n; i++) {
+				const Vertex &a = scratch[i];
+				const Vertex &b = scratch[(i + 1) % n];
+				float da = distance(plane, a.p);
+				float db = distance(plane, b.p);
+				if (da >= 0) out[m++] = a;
+				if ((da >= 0) != (db >= 0)) {
+					lerp(a, b, da / (da - db), out[m++]);
+				}
+			}
+			n = m;
+		}
+		return n;
+	}
+
+private:
+	float guard_;
+
+	/**
+	 * The signed distance of a point inside a plane: near, far, then left, right, bottom and top of
+	 * the guard band
+	 */
+	float distance(int plane, const float* p) const {
+		switch (plane) {
+		case 0:  return p[2] + p[3];
+		case 1:  return p[3] - p[2];
+		case 2:  return p[0] + guard_ * p[3];
+		case 3:  return guard_ * p[3] - p[0];
+		case 4:  return p[1] + guard_ * p[3];
+		default: return guard_ * p[3] - p[1];
+		}
+	}
+
+	int outcode(const float* p) const {
+		int codes = 0;
+		for (int plane = 0; plane < PLANES; plane++) {
+			if (distance(plane, p) < 0) codes |= 1 << plane;
+		}
+		return codes;
+	}
+
+	static void lerp(const Vertex &a, const Vertex &b, float t, Vertex &out) {
+		for (int k = 0; k < 4; k++) out.p[k] = a.p[k] + (b.p[k] - a.p[k]) * t;
+		for (int k = 0; k < N; k++) out.varying[k] = a.varying[k] + (b.varying[k] - a.varying[k]) * t;
+	}
+};
+
+/**
+ * Draw every face of a model through a camera. The shader's vertex stage supplies the varyings;
+ * the positions come from the camera, so the fragment stage sees the camera's screen coordinates
+ * and a depth that grows towards the viewer. Varyings are interpolated with perspective correction.
+ *
+ * @param model  the model to draw
+ * @param shader the shader to run
+ * @param image  the image to draw to; writes are restricted to its clipping rectangle
+ * @param camera the camera to draw through
+ *
+ * @return how many faces were rejected and clipped
+ */
+template <class Shader>
+ClipStats renderModel(Model &model, Shader &shader, TGAImage &image, const Camera &camera) {
+	const int N = Shader::VARYINGS;
+	const float GUARD_PIXELS = 4096;
+	typedef typename Clipper<N>::Vertex Vertex;
+
+	float halfWidth  = image.get_width() / 2.f;
+	float halfHeight = image.get_height() / 2.f;
+	Clipper<N> clipper(1 + GUARD_PIXELS / std::max(halfWidth, halfHeight));
+	Rect clip = image.getClip();
+	ClipStats stats;
+
+	Vertex in[3];
+	Vertex out[Clipper<N>::MAX_VERTS];
+	Vec3f screen[Clipper<N>::MAX_VERTS];
+	float invW[Clipper<N>::MAX_VERTS];
+	for (int i = 0; i < model.nfaces(); i++) {
+		for (int j = 0; j < 3; j++) {
+			shader.vertex(i, j, in[j].varying);
+			camera.project(model.vert(model.face(i)[j]), in[j].p);
+		}
+		stats.faces++;
+
+		bool clipped;
+		int n = clipper.clip(in, out, clipped);
+		if (n < 3) {
+			stats.rejected++;
+			continue;
+		}
+		if (clipped) stats.clipped++;
+
+		// Divide by w and map onto the image; the clipper keeps w positive
+		for (int k = 0; k < n; k++) {
+			invW[k] = 1.f / out[k].p[3];
+			screen[k] = Vec3f((out[k].p[0] * invW[k] + 1) * halfWidth, (out[k].p[1] * invW[k] + 1) * halfHeight, -out[k].p[2] * invW[k]);
+		}
+
+		for (int k = 1; k + 1 < n; k++) {
+			Vec3f tri[3] = {screen[0], screen[k], screen[k + 1]};
+			float varying[3][N];
+			float w[3] = {invW[0], invW[k], invW[k + 1]};
+			const Vertex* v[3] = {&out[0], &out[k], &out[k + 1]};
+			for (int c = 0; c < 3; c++) {
+				std::copy(v[c]->varying, v[c]->varying + N, varying[c]);
+			}
+			rasterizeTriangle<true>(shader, tri, varying, image, clip, w);
+			stats.triangles++;
+		}
+	}
+	return stats;
+}
+
+#endif //__CAMERA_H__
@@ -0,0 +1,108 @@
+#include <cmath>
+#include "color.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * The lookup tables between sRGB and linear light: 256 sRGB values to 16-bit linear values, and
+ * linear values in steps of 16 back to sRGB
+ */
+struct SRGBTables {
+	unsigned short toLinear[256];
+	unsigned char fromLinear[4096];
+
+	SRGBTables() {
+		for (int i = 0; i < 256; i++) {
+			float c = i / 255.f;
+			float linear = c <= .04045f ? c / 12.92f : std::pow((c + .055f) / 1.055f, 2.4f);
+			toLinear[i] = (unsigned short)(linear * 65535.f + .5f);
+		}
+		for (int i = 0; i < 4096; i++) {
+			float linear = i / 4095.f;
+			float c = linear <= .0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1 / 2.4f) - .055f;
+			fromLinear[i] = (unsigned char)(c * 255.f + .5f);
+		}
+	}
+};
+
+static const SRGBTables &tables() {
+	static const SRGBTables tables;
+	return tables;
+}
+
+/**
+ * Convert an sRGB channel to linear light, with 65535 as full intensity
+ */
+unsigned short PackedColor::toLinear(unsigned char srgb) {
+	return tables().toLinear[srgb];
+}
+
+/**
+ * Convert a channel in linear light, with 65535 as full intensity, to sRGB
+ */
+unsigned char PackedColor::fromLinear(unsigned short linear) {
+	return tables().fromLinear[linear >> 4];
+}
+
+/**
+ * Scale the color channels of one packed sRGB color in linear light, leaving alpha as it is
+ */
+unsigned int PackedColor::scaleLinear(unsigned int bgra, unsigned short k) {
+	const SRGBTables &t = tables();
+	unsigned int out = bgra & 0xff000000u;
+	for (int shift = 0; shift < 24; shift += 8) {
+		unsigned int linear = t.toLinear[(bgra >> shift) & 0xff] * (unsigned int)k / ONE;
+		out |= (unsigned int)t.fromLinear[linear >> 4] << shift;
+	}
+	return out;
+}
+
+/**
+ * Scale the color channels of a span of packed colors, each by its own intensity, leaving alpha
+ * as it is
+ *
+ * @param texels the colors to scale
+ * @param k      the fixed-point intensity of each color
+ * @param out    receives the scaled colors; may be texels
+ * @param n      the number of colors
+ */
+void PackedColor::scale(const unsigned int* texels, const unsigned short* k, unsigned int* out, int n) {
+	int i = 0;
+#ifdef __SSE2__
+	// The alpha lanes are multiplied by 0xffff, which gives back the alpha
+	const __m128i alpha = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+	for (; i + 4 <= n; i += 4) {
+		__m128i c = _mm_loadu_si128((const __m128i*)(texels + i));
+
+		// Spread the intensity of each pixel over the lanes of its four channels
+		__m128i kk = _mm_loadl_epi64((const __m128i*)(k + i));
+		kk = _mm_unpacklo_epi16(kk, kk);
+		__m128i klo = _mm_or_si128(_mm_unpacklo_epi32(kk, kk), alpha);
+		__m128i khi = _mm_or_si128(_mm_unpackhi_epi32(kk, kk), alpha);
+
+		// Unpacking a byte with itself widens x to x * 257
+		__m128i lo = _mm_srli_epi16(_mm_mulhi_epu16(_mm_unpacklo_epi8(c, c), klo), 8);
+		__m128i hi = _mm_srli_epi16(_mm_mulhi_epu16(_mm_unpackhi_epi8(c, c), khi), 8);
+		_mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; i < n; i++) {
+		out[i] = scale(texels[i], k[i]);
+	}
+}
+
+/**
+ * Scale the color channels of a span of packed sRGB colors in linear light, each by its own
+ * intensity, leaving alpha as it is
+ *
+ * @param texels the colors to scale
+ * @param k      the fixed-point intensity of each color
+ * @param out    receives the scaled colors; may be texels
+ * @param n      the number of colors
+ */
+void PackedColor::scaleLinear(const unsigned int* texels, const unsigned short* k, unsigned int* out, int n) {
+	for (int i = 0; i < n; i++) {
+		out[i] = scaleLinear(texels[i], k[i]);
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef __COLOR_H__
+#define __COLOR_H__
+
+/**
+ * Lighting on colors packed as 32-bit BGRA, the layout of TGAColor::val, with intensities in 16-bit
+ * fixed point. A span of texels is lit four pixels at a time, all channels of a pixel together, in
+ * place of scaling one TGAColor at a time by a float.
+ *
+ * ONE is the fixed-point intensity of 1. With texels widened to x * 257, (x * 257 * k) >> 24 is x
+ * times the intensity rounded down, except within a few thousandths below a whole number.
+ *
+ * The gamma-correct variants convert texels from sRGB to linear light through a lookup table, light
+ * them there and convert back through a second table.
+ */
+class PackedColor {
+public:
+	static const unsigned int ONE = 65281;
+
+	/**
+	 * Convert an intensity to fixed point, clamped to [0, 1]
+	 */
+	static unsigned short toFixed(float intensity) {
+		if (!(intensity > 0.f)) return 0;
+		if (intensity >= 1.f) return ONE;
+		return (unsigned short)(intensity * ONE + .5f);
+	}
+
+	/**
+	 * Scale the color channels of one packed color, leaving alpha as it is
+	 */
+	static unsigned int scale(unsigned int bgra, unsigned short k) {
+		unsigned int out = bgra & 0xff000000u;
+		for (int shift = 0; shift < 24; shift += 8) {
+			unsigned int x = (bgra >> shift) & 0xff;
+			out |= ((x * 257u * k) >> 24) << shift;
+		}
+		return out;
+	}
+
+	static unsigned int scaleLinear(unsigned int bgra, unsigned short k);
+	static void scale(const unsigned int* texels, const unsigned short* k, unsigned int* out, int n);
+	static void scaleLinear(const unsigned int* texels, const unsigned short* k, unsigned int* out, int n);
+	static unsigned short toLinear(unsigned char srgb);
+	static unsigned char fromLinear(unsigned short linear);
+};
+
+#endif //__COLOR_H__
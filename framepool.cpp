@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include "framepool.h"
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+FramePool::FramePool() : free_(), mutex_(), stats_() {
+}
+
+/**
+ * Unmap the free buffers. Buffers still checked out are left mapped, since their images may outlive
+ * the pool.
+ */
+FramePool::~FramePool() {
+	trim();
+}
+
+/**
+ * Get the pool shared by the whole program
+ */
+FramePool &FramePool::shared() {
+	static FramePool pool;
+	return pool;
+}
+
+/**
+ * Get the size class of a request: powers of 2 from a page up to a huge page, then each further
+ * huge page
+ */
+int FramePool::sizeClass(size_t bytes) {
+	if (bytes > HUGE_PAGE) return 8 + (int)((bytes + HUGE_PAGE - 1) / HUGE_PAGE);
+	int c = 0;
+	while ((PAGE << c) < bytes) c++;
+	return c;
+}
+
+/**
+ * Get the size of the buffers of a size class
+ */
+size_t FramePool::classSize(int c) {
+	return c <= 9 ? PAGE << c : HUGE_PAGE * (c - 8);
+}
+
+/**
+ * Map a buffer from the system, aligned to its size up to a huge page
+ *
+ * @param bytes the size of a class
+ */
+void* FramePool::map(size_t bytes) {
+	size_t align = std::min(bytes, HUGE_PAGE);
+#ifdef __linux__
+	// Map enough to find an aligned start, then give back the slack on either side
+	size_t span = bytes + align - PAGE;
+	char* p = (char*)mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) throw std::bad_alloc();
+	char* start = (char*)(((size_t)p + align - 1) & ~(align - 1));
+	char* end = start + bytes;
+	if (start > p) munmap(p, start - p);
+	if (p + span > end) munmap(end, p + span - end);
+#ifdef MADV_HUGEPAGE
+	if (bytes >= HUGE_PAGE) madvise(start, bytes, MADV_HUGEPAGE);
+#endif
+	return start;
+#else
+	void* p = aligned_alloc(align, bytes);
+	if (!p) throw std::bad_alloc();
+	return p;
+#endif
+}
+
+/**
+ * Give a buffer back to the system
+ */
+void FramePool::unmap(void* p, size_t bytes) {
+#ifdef __linux__
+	munmap(p, bytes);
+#else
+	free(p);
+#endif
+}
+
+/**
+ * Check out a buffer. Its contents are whatever the last user left in it.
+ *
+ * @param bytes the smallest size the buffer may have
+ *
+ * @return a buffer aligned to at least a page
+ */
+void* FramePool::acquire(size_t bytes) {
+	int c = sizeClass(bytes);
+	size_t size = classSize(c);
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	void* p;
+	if (c < (int)free_.size() && free_[c]) {
+		FreeBuffer* b = free_[c];
+		free_[c] = b->next;
+		p = b;
+		stats_.hits++;
+	} else {
+		// The free list of the class exists before any buffer can be released to it
+		if (c >= (int)free_.size()) free_.resize(c + 1, NULL);
+		p = map(size);
+		stats_.maps++;
+		stats_.misses++;
+		stats_.reservedBytes += size;
+		stats_.peakReserved = std::max(stats_.peakReserved, stats_.reservedBytes);
+	}
+
+	stats_.checkedOut++;
+	stats_.checkedOutBytes += size;
+	stats_.peakCheckedOut = std::max(stats_.peakCheckedOut, stats_.checkedOut);
+	stats_.peakBytes = std::max(stats_.peakBytes, stats_.checkedOutBytes);
+	return p;
+}
+
+/**
+ * Return a buffer to the pool
+ *
+ * @param p     a buffer from acquire(), or NULL
+ * @param bytes the size it was acquired with
+ */
+void FramePool::release(void* p, size_t bytes) {
+	if (!p) return;
+	int c = sizeClass(bytes);
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	FreeBuffer* b = (FreeBuffer*)p;
+	b->next = free_[c];
+	free_[c] = b;
+	stats_.checkedOut--;
+	stats_.checkedOutBytes -= classSize(c);
+}
+
+/**
+ * Give every free buffer back to the system
+ */
+void FramePool::trim() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (int c = 0; c < (int)free_.size(); c++) {
+		while (free_[c]) {
+			FreeBuffer* next = free_[c]->next;
+			unmap(free_[c], classSize(c));
+			stats_.reservedBytes -= classSize(c);
+			free_[c] = next;
+		}
+	}
+}
+
+/**
+ * Get a snapshot of the occupancy of the pool
+ */
+FramePoolStats FramePool::stats() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return stats_;
+}
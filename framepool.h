@@ -0,0 +1,74 @@
+#ifndef __FRAMEPOOL_H__
+#define __FRAMEPOOL_H__
+
+#include <cstddef>
+#include <vector>
+#include <mutex>
+
+/**
+ * Occupancy of a frame pool. Buffers are counted at the size of their class.
+ */
+struct FramePoolStats {
+	size_t checkedOut;
+	size_t checkedOutBytes;
+	size_t peakCheckedOut;
+	size_t peakBytes;
+	size_t reservedBytes;
+	size_t peakReserved;
+	size_t maps;
+	size_t hits;
+	size_t misses;
+
+	FramePoolStats() : checkedOut(0), checkedOutBytes(0), peakCheckedOut(0), peakBytes(0), reservedBytes(0),
+		peakReserved(0), maps(0), hits(0), misses(0) {}
+
+	/**
+	 * Get the fraction of the reserved bytes that are checked out
+	 */
+	double occupancy() const {
+		return reservedBytes ? (double)checkedOutBytes / reservedBytes : 0;
+	}
+};
+
+/**
+ * Recycles the color, depth and tile buffers of render targets, so that a service rendering frame
+ * after frame reaches a fixed footprint and stops calling the system allocator. Requests are
+ * rounded up to a size class: powers of 2 from a page up to a huge page, then whole huge pages.
+ * A returned buffer goes on the free list of its class, threaded through the buffers themselves,
+ * and the next request of that class takes it back. Buffers are mapped from the system aligned to
+ * their class, up to a huge page, and on Linux the ones of a huge page or more ask for transparent
+ * huge pages.
+ */
+class FramePool {
+private:
+	struct FreeBuffer {
+		FreeBuffer* next;
+	};
+
+	std::vector<FreeBuffer*> free_;
+	std::mutex               mutex_;
+	FramePoolStats           stats_;
+
+	static int sizeClass(size_t bytes);
+	static size_t classSize(int c);
+	static void* map(size_t bytes);
+	static void unmap(void* p, size_t bytes);
+
+	FramePool(const FramePool &);
+	FramePool & operator =(const FramePool &);
+
+public:
+	static const size_t PAGE = 4096;
+	static const size_t HUGE_PAGE = 2 << 20;
+
+	FramePool();
+	~FramePool();
+	void* acquire(size_t bytes);
+	void release(void* p, size_t bytes);
+	void trim();
+	FramePoolStats stats();
+
+	static FramePool &shared();
+};
+
+#endif //__FRAMEPOOL_H__
@@ -1,94 +1,133 @@
-#ifndef __GEOMETRY_H__
-#define __GEOMETRY_H__
-
-#include <cmath>
-
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-template <class t> struct Vec2 {
-	t x, y;
-	Vec2<t>() : x(t()), y(t()) {}
-	Vec2<t>(t _x, t _y) : x(_x), y(_y) {}
-	Vec2<t>(const Vec2<t> &v) : x(t()), y(t()) { *this = v; }
-	Vec2<t> & operator =(const Vec2<t> &v) {
-		if (this != &v) {
-			x = v.x;
-			y = v.y;
-		}
-		return *this;
-	}
-	Vec2<t> operator +(const Vec2<t> &V) const { return Vec2<t>(x+V.x, y+V.y); }
-	Vec2<t> operator -(const Vec2<t> &V) const { return Vec2<t>(x-V.x, y-V.y); }
-	Vec2<t> operator *(float f)          const { return Vec2<t>(x*f, y*f); }
-	t& operator[](const int i) { if (x<=0) return x; else return y; }
-	template <class > friend std::ostream& operator<<(std::ostream& s, Vec2<t>& v);
-};
-
-template <class t> struct Vec3 {
-	t x, y, z;
-	Vec3<t>() : x(t()), y(t()), z(t()) { }
-	Vec3<t>(t _x, t _y, t _z) : x(_x), y(_y), z(_z) {}
-	template <class u> Vec3<t>(const Vec3<u> &v);
-	Vec3<t>(const Vec3<t> &v) : x(t()), y(t()), z(t()) { *this = v; }
-	Vec3<t> & operator =(const Vec3<t> &v) {
-		if (this != &v) {
-			x = v.x;
-			y = v.y;
-			z = v.z;
-		}
-		return *this;
-	}
-	Vec3<t> operator ^(const Vec3<t> &v) const { return Vec3<t>(y*v.z-z*v.y, z*v.x-x*v.z, x*v.y-y*v.x); }
-	Vec3<t> operator +(const Vec3<t> &v) const { return Vec3<t>(x+v.x, y+v.y, z+v.z); }
-	Vec3<t> operator -(const Vec3<t> &v) const { return Vec3<t>(x-v.x, y-v.y, z-v.z); }
-	Vec3<t> operator *(float f)          const { return Vec3<t>(x*f, y*f, z*f); }
-	t       operator *(const Vec3<t> &v) const { return x*v.x + y*v.y + z*v.z; }
-	float norm () const { return std::sqrt(x*x+y*y+z*z); }
-	Vec3<t> & normalize(t l=1) { *this = (*this)*(l/norm()); return *this; }
-	t& operator[](const int i) { if (i<=0) return x; else if (i==1) return y; else return z; }
-	template <class > friend std::ostream& operator<<(std::ostream& s, Vec3<t>& v);
-};
-
-typedef Vec2<float> Vec2f;
-typedef Vec2<int>   Vec2i;
-typedef Vec3<float> Vec3f;
-typedef Vec3<int>   Vec3i;
-
-template <class t> std::ostream& operator<<(std::ostream& s, Vec2<t>& v) {
-	s << "(" << v.x << ", " << v.y << ")\n";
-	return s;
-}
-
-template <class t> std::ostream& operator<<(std::ostream& s, Vec3<t>& v) {
-	s << "(" << v.x << ", " << v.y << ", " << v.z << ")\n";
-	return s;
-}
-
-class geometry {
-public:
-	static inline Vec3f barycenter (const Vec2i v0, const Vec2i v1, const Vec2i v2, const Vec2i p) {
-		Vec3f u =
-			Vec3f(v2.x - v0.x, v1.x - v0.x, v0.x - p.x) ^
-			Vec3f(v2.y - v0.y, v1.y - v0.y, v0.y - p.y);
-
-		if (std::abs(u.z) < 1) {
-			return Vec3f(-1, -1, -1);
-		}
-
-		return Vec3f(1.f - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
-	}
-	
-	static inline Vec3f barycenter (const Vec3f v0, const Vec3f v1, const Vec3f v2, const Vec2i p) {
-		Vec3f u =
-			Vec3f(v2.x - v0.x, v1.x - v0.x, v0.x - p.x) ^
-			Vec3f(v2.y - v0.y, v1.y - v0.y, v0.y - p.y);
-
-		if (std::abs(u.z) < 1) {
-			return Vec3f(-1, -1, -1);
-		}
-
-		return Vec3f(1.f - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
-	}
-};
-
-#endif //__GEOMETRY_H__
+#ifndef __GEOMETRY_H__
+#define __GEOMETRY_H__
+
+#include <cmath>
+#include <ostream>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <class t> struct Vec2 {
+	t x, y;
+	Vec2<t>() : x(t()), y(t()) {}
+	Vec2<t>(t _x, t _y) : x(_x), y(_y) {}
+	Vec2<t>(const Vec2<t> &v) : x(t()), y(t()) { *this = v; }
+	Vec2<t> & operator =(const Vec2<t> &v) {
+		if (this != &v) {
+			x = v.x;
+			y = v.y;
+		}
+		return *this;
+	}
+	Vec2<t> operator +(const Vec2<t> &V) const { return Vec2<t>(x+V.x, y+V.y); }
+	Vec2<t> operator -(const Vec2<t> &V) const { return Vec2<t>(x-V.x, y-V.y); }
+	Vec2<t> operator *(float f)          const { return Vec2<t>(x*f, y*f); }
+	t& operator[](const int i) { if (x<=0) return x; else return y; }
+	template <class > friend std::ostream& operator<<(std::ostream& s, Vec2<t>& v);
+};
+
+template <class t> struct Vec3 {
+	t x, y, z;
+	Vec3<t>() : x(t()), y(t()), z(t()) { }
+	Vec3<t>(t _x, t _y, t _z) : x(_x), y(_y), z(_z) {}
+	template <class u> Vec3<t>(const Vec3<u> &v);
+	Vec3<t>(const Vec3<t> &v) : x(t()), y(t()), z(t()) { *this = v; }
+	Vec3<t> & operator =(const Vec3<t> &v) {
+		if (this != &v) {
+			x = v.x;
+			y = v.y;
+			z = v.z;
+		}
+		return *this;
+	}
+	Vec3<t> operator ^(const Vec3<t> &v) const { return Vec3<t>(y*v.z-z*v.y, z*v.x-x*v.z, x*v.y-y*v.x); }
+	Vec3<t> operator +(const Vec3<t> &v) const { return Vec3<t>(x+v.x, y+v.y, z+v.z); }
+	Vec3<t> operator -(const Vec3<t> &v) const { return Vec3<t>(x-v.x, y-v.y, z-v.z); }
+	Vec3<t> operator *(float f)          const { return Vec3<t>(x*f, y*f, z*f); }
+	t       operator *(const Vec3<t> &v) const { return x*v.x + y*v.y + z*v.z; }
+	float norm () const { return std::sqrt(x*x+y*y+z*z); }
+	Vec3<t> & normalize(t l=1) { *this = (*this)*(l/norm()); return *this; }
+	t& operator[](const int i) { if (i<=0) return x; else if (i==1) return y; else return z; }
+	template <class > friend std::ostream& operator<<(std::ostream& s, Vec3<t>& v);
+};
+
+typedef Vec2<float> Vec2f;
+typedef Vec2<int>   Vec2i;
+typedef Vec3<float> Vec3f;
+typedef Vec3<int>   Vec3i;
+
+template <class t> std::ostream& operator<<(std::ostream& s, Vec2<t>& v) {
+	s << "(" << v.x << ", " << v.y << ")\n";
+	return s;
+}
+
+template <class t> std::ostream& operator<<(std::ostream& s, Vec3<t>& v) {
+	s << "(" << v.x << ", " << v.y << ", " << v.z << ")\n";
+	return s;
+}
+
+/**
+ * An axis-aligned bounding box; empty when lo > hi
+ */
+struct AABB {
+	Vec3f lo, hi;
+
+	AABB() : lo(INFINITY, INFINITY, INFINITY), hi(-INFINITY, -INFINITY, -INFINITY) {}
+	AABB(Vec3f _lo, Vec3f _hi) : lo(_lo), hi(_hi) {}
+
+	bool empty() const { return lo.x > hi.x || lo.y > hi.y || lo.z > hi.z; }
+	void expand(const AABB &b) {
+		lo = Vec3f(std::fmin(lo.x, b.lo.x), std::fmin(lo.y, b.lo.y), std::fmin(lo.z, b.lo.z));
+		hi = Vec3f(std::fmax(hi.x, b.hi.x), std::fmax(hi.y, b.hi.y), std::fmax(hi.z, b.hi.z));
+	}
+	Vec3f center() const { return (lo + hi) * .5f; }
+	bool operator ==(const AABB &b) const {
+		return lo.x == b.lo.x && lo.y == b.lo.y && lo.z == b.lo.z && hi.x == b.hi.x && hi.y == b.hi.y && hi.z == b.hi.z;
+	}
+};
+
+/**
+ * An integer pixel rectangle covering [x0, x1) x [y0, y1)
+ */
+struct Rect {
+	int x0, y0, x1, y1;
+
+	Rect() : x0(0), y0(0), x1(0), y1(0) {}
+	Rect(int _x0, int _y0, int _x1, int _y1) : x0(_x0), y0(_y0), x1(_x1), y1(_y1) {}
+
+	bool empty() const { return x0 >= x1 || y0 >= y1; }
+	int area() const { return empty() ? 0 : (x1 - x0) * (y1 - y0); }
+	Rect intersect(const Rect &r) const {
+		return Rect(x0 > r.x0 ? x0 : r.x0, y0 > r.y0 ? y0 : r.y0, x1 < r.x1 ? x1 : r.x1, y1 < r.y1 ? y1 : r.y1);
+	}
+	bool operator ==(const Rect &r) const { return x0 == r.x0 && y0 == r.y0 && x1 == r.x1 && y1 == r.y1; }
+	bool operator !=(const Rect &r) const { return !(*this == r); }
+};
+
+class geometry {
+public:
+	static inline Vec3f barycenter (const Vec2i v0, const Vec2i v1, const Vec2i v2, const Vec2i p) {
+		Vec3f u =
+			Vec3f(v2.x - v0.x, v1.x - v0.x, v0.x - p.x) ^
+			Vec3f(v2.y - v0.y, v1.y - v0.y, v0.y - p.y);
+
+		if (std::abs(u.z) < 1) {
+			return Vec3f(-1, -1, -1);
+		}
+
+		return Vec3f(1.f - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
+	}
+	
+	static inline Vec3f barycenter (const Vec3f v0, const Vec3f v1, const Vec3f v2, const Vec2i p) {
+		Vec3f u =
+			Vec3f(v2.x - v0.x, v1.x - v0.x, v0.x - p.x) ^
+			Vec3f(v2.y - v0.y, v1.y - v0.y, v0.y - p.y);
+
+		if (std::abs(u.z) < 1) {
+			return Vec3f(-1, -1, -1);
+		}
+
+		return Vec3f(1.f - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
+	}
+};
+
+#endif //__GEOMETRY_H__
@@ -0,0 +1,141 @@
+#include <cmath>
+#include "incremental.h"
+
+IncrementalRenderer::IncrementalRenderer(Scene &scene, int width, int height, int tileSize) :
+	scene_(scene), context_(), image_(width, height, TGAImage::RGB), view_(), tileSize_(tileSize),
+	tilesX_((width + tileSize - 1) / tileSize), tilesY_((height + tileSize - 1) / tileSize), valid_(false),
+	damaged_(tilesX_ * tilesY_, 0), prevInstances_(), prevBounds_(), stats_() {
+}
+
+/**
+ * Change the region of the xy-plane that is drawn. This damages the whole frame.
+ *
+ * @param view the new view
+ */
+void IncrementalRenderer::setView(const ViewWindow &view) {
+	view_ = view;
+	invalidate();
+}
+
+/**
+ * Force the next frame to be drawn from scratch
+ */
+void IncrementalRenderer::invalidate() {
+	valid_ = false;
+}
+
+/**
+ * Get the pixels that an object may cover, padded by a pixel on each side for rounding
+ *
+ * @param id the id of the object
+ */
+Rect IncrementalRenderer::screenBounds(int id) {
+	AABB b = scene_.objectBounds(id);
+	float sx = image_.get_width()  / (view_.hi.x - view_.lo.x);
+	float sy = image_.get_height() / (view_.hi.y - view_.lo.y);
+
+	Rect r(
+		(int)std::floor((b.lo.x - view_.lo.x) * sx) - 1,
+		(int)std::floor((b.lo.y - view_.lo.y) * sy) - 1,
+		(int)std::ceil ((b.hi.x - view_.lo.x) * sx) + 2,
+		(int)std::ceil ((b.hi.y - view_.lo.y) * sy) + 2
+	);
+	return r.intersect(Rect(0, 0, image_.get_width(), image_.get_height()));
+}
+
+/**
+ * Mark every tile touched by a rectangle as damaged
+ *
+ * @param r the rectangle in pixels
+ */
+void IncrementalRenderer::damage(const Rect &r) {
+	if (r.empty()) return;
+	for (int ty = r.y0 / tileSize_; ty <= (r.y1 - 1) / tileSize_; ty++) {
+		for (int tx = r.x0 / tileSize_; tx <= (r.x1 - 1) / tileSize_; tx++) {
+			damaged_[tx + ty * tilesX_] = 1;
+		}
+	}
+}
+
+/**
+ * Get the part of the view that is mapped onto a rectangle of pixels, padded by a pixel on each
+ * side since the rasterizer may round a triangle's edge onto the next pixel
+ *
+ * @param r the rectangle in pixels
+ */
+ViewWindow IncrementalRenderer::window(const Rect &r) {
+	float sx = (view_.hi.x - view_.lo.x) / image_.get_width();
+	float sy = (view_.hi.y - view_.lo.y) / image_.get_height();
+	return ViewWindow(
+		Vec2f(view_.lo.x + (r.x0 - 1) * sx, view_.lo.y + (r.y0 - 1) * sy),
+		Vec2f(view_.lo.x + (r.x1 + 1) * sx, view_.lo.y + (r.y1 + 1) * sy)
+	);
+}
+
+/**
+ * Bring the image up to date with the scene, redrawing only the damaged tiles
+ *
+ * @return how much of the frame was redrawn
+ */
+const FrameStats &IncrementalRenderer::render() {
+	int n = scene_.nobjects();
+	Rect full(0, 0, image_.get_width(), image_.get_height());
+
+	context_.beginFrame();
+	stats_ = FrameStats();
+	stats_.tiles = tilesX_ * tilesY_;
+
+	// Find the tiles covered by objects that were added or changed, before and after the change
+	if (!valid_) {
+		damage(full);
+	}
+	int known = valid_ ? (int)prevInstances_.size() : 0;
+	prevInstances_.resize(n);
+	prevBounds_.resize(n);
+	for (int id = 0; id < n; id++) {
+		const Instance &instance = scene_.instance(id);
+		bool added = id >= known;
+		if (!added && instance == prevInstances_[id]) continue;
+
+		Rect bounds = screenBounds(id);
+		if (!added) {
+			damage(prevBounds_[id]);
+		}
+		damage(bounds);
+		prevInstances_[id] = instance;
+		prevBounds_[id]    = bounds;
+	}
+
+	// Redraw each horizontal run of damaged tiles as one rectangle
+	for (int ty = 0; ty < tilesY_; ty++) {
+		for (int tx = 0; tx < tilesX_; tx++) {
+			if (!damaged_[tx + ty * tilesX_]) continue;
+
+			int end = tx;
+			while (end < tilesX_ && damaged_[end + ty * tilesX_]) {
+				damaged_[end + ty * tilesX_] = 0;
+				end++;
+			}
+			stats_.damagedTiles += end - tx;
+			stats_.rects++;
+
+			Rect r = Rect(tx * tileSize_, ty * tileSize_, end * tileSize_, (ty + 1) * tileSize_).intersect(full);
+			image_.clearRect(r);
+			image_.setClip(r);
+			stats_.objectsDrawn += scene_.render(image_, context_, view_, window(r));
+			tx = end;
+		}
+	}
+	image_.resetClip();
+
+	valid_ = true;
+	return stats_;
+}
+
+const FrameStats &IncrementalRenderer::stats() {
+	return stats_;
+}
+
+TGAImage &IncrementalRenderer::image() {
+	return image_;
+}
@@ -0,0 +1,63 @@
+#ifndef __INCREMENTAL_H__
+#define __INCREMENTAL_H__
+
+#include <vector>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "instance.h"
+#include "scene.h"
+#include "arena.h"
+
+/**
+ * How much of a frame had to be redrawn
+ */
+struct FrameStats {
+	int tiles;
+	int damagedTiles;
+	int rects;
+	int objectsDrawn;
+
+	FrameStats() : tiles(0), damagedTiles(0), rects(0), objectsDrawn(0) {
+	}
+
+	float reused() const {
+		return tiles ? 1.f - damagedTiles / (float)tiles : 0.f;
+	}
+};
+
+/**
+ * Draws a scene into a color and depth buffer that persist between frames. Only the tiles
+ * covered by objects that changed since the previous frame are cleared and redrawn.
+ */
+class IncrementalRenderer {
+private:
+	Scene &scene_;
+	RenderContext context_;
+	TGAImage image_;
+	ViewWindow view_;
+	int tileSize_;
+	int tilesX_;
+	int tilesY_;
+	bool valid_;
+	std::vector<unsigned char> damaged_;
+	std::vector<Instance> prevInstances_;
+	std::vector<Rect> prevBounds_;
+	FrameStats stats_;
+
+	Rect screenBounds(int id);
+	void damage(const Rect &r);
+	ViewWindow window(const Rect &r);
+
+	IncrementalRenderer(const IncrementalRenderer &);
+	IncrementalRenderer & operator =(const IncrementalRenderer &);
+
+public:
+	IncrementalRenderer(Scene &scene, int width, int height, int tileSize = 32);
+	void setView(const ViewWindow &view);
+	void invalidate();
+	const FrameStats &render();
+	const FrameStats &stats();
+	TGAImage &image();
+};
+
+#endif //__INCREMENTAL_H__
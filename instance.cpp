@@ -0,0 +1,182 @@
+#include <cmath>
+#include "instance.h"
+
+TriangleBatch::TriangleBatch() : texture_(NULL), size_(0) {
+}
+
+/**
+ * Queue a triangle for rasterization, flushing the batch first if it is full or uses another texture
+ *
+ * @param screen    the screen coordinates of the 3 vertices
+ * @param uv        the texture coordinates of the 3 vertices
+ * @param intensity the lighting intensity of the triangle
+ * @param tint      the color to multiply the texture by
+ * @param image     the image to draw to
+ * @param texture   the texture to sample
+ */
+void TriangleBatch::push(const Vec3f* screen, const Vec2i* uv, float intensity, TGAColor tint, TGAImage &image, TGAImage &texture) {
+	if (size_ == CAPACITY || (size_ > 0 && texture_ != &texture)) {
+		flush(image);
+	}
+	texture_ = &texture;
+
+	for (int j = 0; j < 3; j++) {
+		screen_[size_][j] = screen[j];
+		uv_    [size_][j] = uv[j];
+	}
+	intensity_[size_] = intensity;
+	tint_     [size_] = tint;
+	size_++;
+}
+
+/**
+ * Rasterize all of the queued triangles
+ *
+ * @param image the image to draw to
+ */
+void TriangleBatch::flush(TGAImage &image) {
+	for (int i = 0; i < size_; i++) {
+		image.triFill(screen_[i], uv_[i], *texture_, intensity_[i], tint_[i]);
+	}
+	size_ = 0;
+}
+
+InstanceSet::InstanceSet(Model &model) : model_(model), instances_(), uv_() {
+	// The texture coordinates do not depend on the instance, so look them up once
+	uv_.resize(model_.nfaces() * 3);
+	for (int i = 0; i < model_.nfaces(); i++) {
+		for (int j = 0; j < 3; j++) {
+			uv_[i * 3 + j] = model_.uv(i, j);
+		}
+	}
+}
+
+/**
+ * Add an instance of the model
+ *
+ * @param instance the transform and tint of the new instance
+ *
+ * @return the index of the new instance
+ */
+int InstanceSet::add(const Instance &instance) {
+	instances_.push_back(instance);
+	return (int)instances_.size() - 1;
+}
+
+Instance &InstanceSet::instance(int i) {
+	return instances_[i];
+}
+
+int InstanceSet::ninstances() {
+	return (int)instances_.size();
+}
+
+void InstanceSet::clear() {
+	instances_.clear();
+}
+
+/**
+ * Check whether an instance's bounding box overlaps the view
+ *
+ * @param instance the instance to test
+ * @param view     the region of the xy-plane that is drawn
+ *
+ * @return false if the instance cannot cover any pixel; true otherwise
+ */
+bool InstanceSet::visible(const Instance &instance, const ViewWindow &view) {
+	if (instance.scale <= 0) return false;
+	return view.overlaps(instanceBounds(model_, instance));
+}
+
+/**
+ * Draw every visible instance to an image
+ *
+ * @param image   the image to draw to
+ * @param context the frame whose arena holds the transformed vertices and the triangle batch
+ * @param view    the region of the xy-plane that is drawn
+ *
+ * @return the number of instances that survived culling
+ */
+int InstanceSet::render(TGAImage &image, RenderContext &context, const ViewWindow &view) {
+	TriangleBatch* batch = new (context.frame.allocate(sizeof(TriangleBatch), alignof(TriangleBatch))) TriangleBatch();
+	Vec3f* transformed = context.frame.allocate<Vec3f>(model_.nverts());
+	int drawn = 0;
+
+	for (int k = 0; k < ninstances(); k++) {
+		const Instance &instance = instances_[k];
+		if (!visible(instance, view)) continue;
+		drawn++;
+
+		renderInstance(model_, instance, &uv_[0], transformed, view, image, *batch);
+	}
+
+	batch->flush(image);
+	return drawn;
+}
+
+/**
+ * Get the world-space bounding box of an instance of a model
+ *
+ * @param model    the model being instanced
+ * @param instance the transform of the instance
+ */
+AABB instanceBounds(Model &model, const Instance &instance) {
+	Vec3f c = instance.apply(model.center(), std::cos(instance.yaw), std::sin(instance.yaw));
+	float r = model.radius() * instance.scale;
+	return AABB(c - Vec3f(r, r, r), c + Vec3f(r, r, r));
+}
+
+/**
+ * Queue the triangles of one instance of a model for rasterization
+ *
+ * @param model    the model being instanced
+ * @param instance the transform and tint of the instance
+ * @param uv       the texture coordinates of every face corner, or NULL to look them up in the model
+ * @param scratch  storage for the model's transformed vertices
+ * @param view     the region of the xy-plane that is drawn
+ * @param image    the image to draw to
+ * @param batch    the batch to queue the triangles in
+ */
+void renderInstance(Model &model, const Instance &instance, const Vec2i* uv, Vec3f* scratch,
+	const ViewWindow &view, TGAImage &image, TriangleBatch &batch) {
+	TGAImage &texture = model.texture();
+	Vec3f lightDir(0, 0, -1);
+
+	// Transform the shared vertices into this instance's world space
+	float c = std::cos(instance.yaw);
+	float s = std::sin(instance.yaw);
+	for (int i = 0; i < model.nverts(); i++) {
+		scratch[i] = instance.apply(model.vert(i), c, s);
+	}
+
+	float sx = image.get_width()  / (view.hi.x - view.lo.x);
+	float sy = image.get_height() / (view.hi.y - view.lo.y);
+
+	for (int i = 0; i < model.nfaces(); i++) {
+		const int* face = model.face(i);
+
+		Vec3f screenCoords[3];
+		Vec3f worldCoords[3];
+		Vec2i textureCoords[3];
+
+		for (int j = 0; j < 3; j++) {
+			Vec3f v = scratch[face[j]];
+			worldCoords [j] = v;
+			screenCoords[j] = Vec3f(
+				(v.x - view.lo.x) * sx,
+				(v.y - view.lo.y) * sy,
+				(v.z)
+			);
+			textureCoords[j] = uv ? uv[i * 3 + j] : model.uv(i, j);
+		}
+
+		// Calculate the intensity of the lighting based on the normal
+		Vec3f n = (worldCoords[2] - worldCoords[0]) ^ (worldCoords[1] - worldCoords[0]);
+		n.normalize();
+		float intensity = n * lightDir;
+
+		if (intensity > 0) {
+			batch.push(screenCoords, textureCoords, intensity, instance.tint, image, texture);
+		}
+	}
+}
@@ -0,0 +1,110 @@
+#ifndef __INSTANCE_H__
+#define __INSTANCE_H__
+
+#include <vector>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "model.h"
+#include "arena.h"
+
+/**
+ * The per-instance state for drawing a shared model: a uniform scale, a rotation about the y-axis,
+ * a translation and a color that the texture is multiplied by
+ */
+struct Instance {
+	Vec3f position;
+	float scale;
+	float yaw;
+	TGAColor tint;
+
+	Instance() : position(), scale(1), yaw(0), tint(255, 255, 255, 255) {
+	}
+
+	Instance(Vec3f p, float s, float y, TGAColor t) : position(p), scale(s), yaw(y), tint(t) {
+	}
+
+	bool operator ==(const Instance &i) const {
+		return position.x == i.position.x && position.y == i.position.y && position.z == i.position.z &&
+			scale == i.scale && yaw == i.yaw && tint.val == i.tint.val;
+	}
+
+	bool operator !=(const Instance &i) const {
+		return !(*this == i);
+	}
+
+	Vec3f apply(const Vec3f &v, float c, float s) const {
+		Vec3f w = v * scale;
+		return Vec3f(c * w.x + s * w.z, w.y, c * w.z - s * w.x) + position;
+	}
+};
+
+/**
+ * The region of the xy-plane that is mapped onto the whole image
+ */
+struct ViewWindow {
+	Vec2f lo, hi;
+
+	ViewWindow() : lo(-1, -1), hi(1, 1) {
+	}
+
+	ViewWindow(Vec2f l, Vec2f h) : lo(l), hi(h) {
+	}
+
+	bool overlaps(const AABB &b) const {
+		return b.hi.x >= lo.x && b.lo.x <= hi.x && b.hi.y >= lo.y && b.lo.y <= hi.y;
+	}
+
+	bool contains(const AABB &b) const {
+		return b.lo.x >= lo.x && b.hi.x <= hi.x && b.lo.y >= lo.y && b.hi.y <= hi.y;
+	}
+};
+
+/**
+ * A fixed-size queue of screen-space triangles sharing one texture, waiting to be rasterized
+ */
+class TriangleBatch {
+public:
+	static const int CAPACITY = 1024;
+
+private:
+	Vec3f    screen_[CAPACITY][3];
+	Vec2i    uv_[CAPACITY][3];
+	float    intensity_[CAPACITY];
+	TGAColor tint_[CAPACITY];
+	TGAImage* texture_;
+	int      size_;
+
+public:
+	TriangleBatch();
+	void push(const Vec3f* screen, const Vec2i* uv, float intensity, TGAColor tint, TGAImage &image, TGAImage &texture);
+	void flush(TGAImage &image);
+};
+
+AABB instanceBounds(Model &model, const Instance &instance);
+void renderInstance(Model &model, const Instance &instance, const Vec2i* uv, Vec3f* scratch,
+	const ViewWindow &view, TGAImage &image, TriangleBatch &batch);
+
+/**
+ * Many copies of one model, each with its own transform and tint. The mesh and the texture are
+ * shared by every instance, so the memory cost of an instance is only the size of an Instance.
+ */
+class InstanceSet {
+private:
+	Model &model_;
+	std::vector<Instance> instances_;
+	std::vector<Vec2i> uv_;
+
+	InstanceSet(const InstanceSet &);
+	InstanceSet & operator =(const InstanceSet &);
+
+public:
+	InstanceSet(Model &model);
+	int add(const Instance &instance);
+	Instance &instance(int i);
+	int ninstances();
+	void clear();
+	bool visible(const Instance &instance, const ViewWindow &view = ViewWindow());
+	int render(TGAImage &image, RenderContext &context, const ViewWindow &view = ViewWindow());
+};
+
+#endif //__INSTANCE_H__
@@ -1,8 +1,34 @@
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <chrono>
+#include <limits>
+#include <csignal>
 #include "tgaimage.h"
 #include "model.h"
+#include "instance.h"
+#include "scene.h"
+#include "incremental.h"
+#include "shadow.h"
+#include "shader.h"
+#include "arena.h"
+#include "allocstats.h"
+#include "pipeline.h"
+#include "threadpool.h"
+#include "banded.h"
+#include "msaa.h"
+#include "vrs.h"
+#include "order.h"
+#include "wireframe.h"
+#include "resample.h"
+#include "camera.h"
+#include "video.h"
+#include "verify.h"
+#include "framepool.h"
+#include "animation.h"
 #include "geometry.h"
 
 const TGAColor white = TGAColor(255, 255, 255, 255);
@@ -15,28 +41,948 @@ const int HEIGHT = 1000;
 
 Model* model = nullptr;
 
+/**
+ * Scatter copies of the model over a square grid covering the image
+ *
+ * @param instances the set to add the copies to
+ * @param count     the number of copies to add
+ */
+void scatter(InstanceSet &instances, int count) {
+	int side = std::ceil(std::sqrt((float)count));
+	float cell = 2.f / side;
+
+	for (int i = 0; i < count; i++) {
+		int gx = i % side;
+		int gy = i / side;
+		Vec3f position(-1 + cell * (gx + .5f), -1 + cell * (gy + .5f), 0);
+		TGAColor tint(128 + 127 * gx / side, 128 + 127 * gy / side, 255, 255);
+		instances.add(Instance(position, cell * .5f, i * .7f, tint));
+	}
+}
+
+/**
+ * Scatter copies of the model over a square world much larger than the view
+ *
+ * @param scene the scene to add the copies to
+ * @param count the number of copies to add
+ */
+void scatter(Scene &scene, int count) {
+	const float worldSize = 32;
+	int side = std::ceil(std::sqrt((float)count));
+	float cell = worldSize / side;
+
+	for (int i = 0; i < count; i++) {
+		int gx = i % side;
+		int gy = i / side;
+		Vec3f position(-worldSize / 2 + cell * (gx + .5f), -worldSize / 2 + cell * (gy + .5f), 0);
+		scene.add(*model, Instance(position, std::min(cell * .5f, .25f), i * .7f, white));
+	}
+}
+
+/**
+ * Time drawing the model with the full textured rasterizer against the depth-only rasterizer
+ *
+ * @param iterations the number of times to draw the model with each rasterizer
+ */
+void benchmarkDepth(int iterations) {
+	TGAImage image(WIDTH, HEIGHT, TGAImage::RGB);
+	DepthMap depth(WIDTH, HEIGHT);
+
+	auto start = std::chrono::steady_clock::now();
+	for (int k = 0; k < iterations; k++) {
+		image.clearRect(Rect(0, 0, WIDTH, HEIGHT));
+		model->render(image);
+	}
+	auto middle = std::chrono::steady_clock::now();
+	for (int k = 0; k < iterations; k++) {
+		depth.clear();
+		for (int i = 0; i < model->nfaces(); i++) {
+			const int* face = model->face(i);
+			Vec3f screenCoords[3];
+			for (int j = 0; j < 3; j++) {
+				Vec3f v = model->vert(face[j]);
+				screenCoords[j] = Vec3f((v.x + 1.) * WIDTH / 2., (v.y + 1.) * HEIGHT / 2., v.z);
+			}
+			depth.rasterize(screenCoords[0], screenCoords[1], screenCoords[2]);
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	double full = std::chrono::duration<double, std::milli>(middle - start).count() / iterations;
+	double fast = std::chrono::duration<double, std::milli>(end - middle).count() / iterations;
+	std::cerr << "# triFill " << full << " ms/frame, depth-only " << fast << " ms/frame, speedup " << full / fast << "x" << std::endl;
+}
+
+/**
+ * Time clearing a large frame that is mostly background, against writing out every pixel of it,
+ * and time encoding it with the model drawn small in one corner
+ *
+ * @param size the width and height of the frame
+ */
+void benchmarkClear(int size) {
+	TGAImage image(size, size, TGAImage::RGB);
+
+	auto start = std::chrono::steady_clock::now();
+	image.clear(TGAColor(40, 40, 60, 255));
+	auto cleared = std::chrono::steady_clock::now();
+	image.materialize();
+	auto materialized = std::chrono::steady_clock::now();
+
+	image.clear(TGAColor(40, 40, 60, 255));
+	InstanceSet instances(*model);
+	instances.add(Instance());
+	RenderContext context;
+	instances.render(image, context, ViewWindow(Vec2f(-1, -1), Vec2f(15, 15)));
+	int clearedTiles = image.getClearedTiles();
+	auto drawn = std::chrono::steady_clock::now();
+	image.write_tga_file("output.tga");
+	auto end = std::chrono::steady_clock::now();
+
+	std::cerr << "# " << size << "x" << size << " clear " << std::chrono::duration<double, std::micro>(cleared - start).count()
+		<< " us, full write " << std::chrono::duration<double, std::micro>(materialized - cleared).count()
+		<< " us, encode with " << clearedTiles << " cleared tiles " << std::chrono::duration<double, std::milli>(end - drawn).count()
+		<< " ms" << std::endl;
+}
+
+/**
+ * Compress the model's texture, reporting the saving and the error
+ */
+void compressTexture() {
+	TGAImage &texture = model->texture();
+	size_t before = (size_t)texture.get_width() * texture.get_height() * texture.get_bytespp();
+
+	auto start = std::chrono::steady_clock::now();
+	BlockTexture compressed(texture);
+	double encode = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	float error = compressed.rmse(texture);
+	model->compressTexture();
+
+	std::cerr << "# texture " << before / 1024 << " KB -> " << model->blockTexture().bytes() / 1024 << " KB, rmse "
+		<< error << ", encode " << encode << " ms" << std::endl;
+}
+
+/**
+ * Time drawing the model with the uncompressed texture against the block-compressed one
+ *
+ * @param iterations the number of times to draw the model with each texture
+ */
+void benchmarkTexture(int iterations) {
+	TGAImage image(WIDTH, HEIGHT, TGAImage::RGB);
+	Vec3f lightDir(1, -1, -1);
+
+	GouraudShader plain(*model, image, lightDir);
+	auto start = std::chrono::steady_clock::now();
+	for (int k = 0; k < iterations; k++) {
+		image.clear();
+		renderModel(*model, plain, image);
+	}
+	double full = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+	compressTexture();
+	BlockTexturedShader block(*model, image, lightDir);
+	start = std::chrono::steady_clock::now();
+	for (int k = 0; k < iterations; k++) {
+		image.clear();
+		renderModel(*model, block, image);
+	}
+	double fast = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+	std::cerr << "# uncompressed " << full << " ms/frame, block-compressed " << fast << " ms/frame" << std::endl;
+}
+
+/**
+ * Time lighting texels one TGAColor at a time in floats against PackedColor spans in fixed point,
+ * on their own and as the last step of drawing the model with the Phong shader
+ *
+ * @param iterations the number of times to light the texels and to draw the model each way
+ */
+void benchmarkColor(int iterations) {
+	// Texels from the model's texture and intensities spread over [0, 1]
+	TGAImage &texture = model->texture();
+	const int n = 1 << 20;
+	std::vector<unsigned int> texels(n);
+	std::vector<float> intensity(n);
+	std::vector<unsigned short> fixed(n);
+	std::vector<unsigned int> lit(n);
+	for (int i = 0; i < n; i++) {
+		texels[i] = texture.get(i % std::max(1, texture.get_width()), (i / 1024) % std::max(1, texture.get_height())).val;
+		intensity[i] = (i * 7919u % 1000) / 999.f;
+		fixed[i] = PackedColor::toFixed(intensity[i]);
+	}
+
+	double times[3] = {0, 0, 0};
+	for (int k = 0; k < iterations; k++) {
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < n; i++) {
+			TGAColor c(texels[i], 4);
+			c * intensity[i];
+			lit[i] = c.val;
+		}
+		auto mid = std::chrono::steady_clock::now();
+		PackedColor::scale(&texels[0], &fixed[0], &lit[0], n);
+		auto end = std::chrono::steady_clock::now();
+		PackedColor::scaleLinear(&texels[0], &fixed[0], &lit[0], n);
+		times[0] += std::chrono::duration<double, std::milli>(mid - start).count();
+		times[1] += std::chrono::duration<double, std::milli>(end - mid).count();
+		times[2] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - end).count();
+	}
+	std::cerr << "# light 1M texels: float " << times[0] / iterations << " ms, packed " << times[1] / iterations
+		<< " ms, packed in linear light " << times[2] / iterations << " ms" << std::endl;
+
+	TGAImage image(WIDTH, HEIGHT, TGAImage::RGB);
+	PhongShader shader(*model, image, Vec3f(1, -1, -1));
+	Packed<PhongShader> packed(shader);
+	double frames[2] = {0, 0};
+	for (int k = 0; k < iterations; k++) {
+		auto start = std::chrono::steady_clock::now();
+		image.clear();
+		renderModel(*model, shader, image);
+		auto mid = std::chrono::steady_clock::now();
+		image.clear();
+		renderModel(*model, packed, image);
+		frames[0] += std::chrono::duration<double, std::milli>(mid - start).count();
+		frames[1] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mid).count();
+	}
+	std::cerr << "# phong " << frames[0] / iterations << " ms/frame, packed " << frames[1] / iterations << " ms/frame" << std::endl;
+}
+
+/**
+ * Draw the model with a shader on the shared pool
+ *
+ * @param shader the shader to run
+ * @param image  the image to draw to
+ * @param packed true to light the fragments in spans with PackedColor
+ * @param gamma  true to light them in linear light; only read when packed is set
+ */
+template <class Shader> void renderShaded(Shader &shader, TGAImage &image, bool packed, bool gamma) {
+	if (packed) {
+		Packed<Shader> spans(shader, gamma);
+		renderModel(*model, spans, image, ThreadPool::shared());
+	} else {
+		renderModel(*model, shader, image, ThreadPool::shared());
+	}
+}
+
+/**
+ * Time the parallel stages (OBJ parsing, tile rasterization and TGA encoding) on pools of 1, 2, 4, ...
+ * threads, and report the speedup of each over a single thread
+ *
+ * @param objectFile the OBJ file to parse
+ * @param maxThreads the largest pool to time
+ */
+void benchmarkThreads(const char* objectFile, int maxThreads) {
+	TGAImage image(WIDTH, HEIGHT, TGAImage::RGB);
+	double base[3] = {0, 0, 0};
+
+	for (int n = 1; n <= maxThreads; n *= 2) {
+		ThreadPool pool(n);
+
+		auto start = std::chrono::steady_clock::now();
+		Model parsed(objectFile, pool);
+		auto parsedAt = std::chrono::steady_clock::now();
+		image.clearRect(Rect(0, 0, WIDTH, HEIGHT));
+		PhongShader shader(*model, image, Vec3f(1, -1, -1));
+		renderModel(*model, shader, image, pool);
+		auto renderedAt = std::chrono::steady_clock::now();
+		image.write_tga_file("output.tga", true, pool);
+		auto end = std::chrono::steady_clock::now();
+
+		double times[3] = {
+			std::chrono::duration<double, std::milli>(parsedAt - start).count(),
+			std::chrono::duration<double, std::milli>(renderedAt - parsedAt).count(),
+			std::chrono::duration<double, std::milli>(end - renderedAt).count()
+		};
+		if (n == 1) {
+			std::copy(times, times + 3, base);
+		}
+		std::cerr << "# threads " << n << " parse " << times[0] << " ms (" << base[0] / times[0] << "x), raster "
+			<< times[1] << " ms (" << base[1] / times[1] << "x), encode " << times[2] << " ms (" << base[2] / times[2] << "x)" << std::endl;
+	}
+}
+
+/**
+ * Render the model at print resolution one band at a time, streaming the rows to print.tga, or to a
+ * grid of print_<row>_<column>.tga files if the image is larger than a TGA file can hold
+ *
+ * @param width      the width of the image
+ * @param height     the height of the image
+ * @param bandHeight the number of rows drawn at a time
+ * @param tileSize   the largest width and height of one output file
+ */
+bool renderPrint(int width, int height, int bandHeight, int tileSize) {
+	auto start = std::chrono::steady_clock::now();
+	BandedRenderer renderer("print", width, height, bandHeight, tileSize);
+	GouraudShader shader(*model, renderer.band(), Vec3f(1, -1, -1));
+	bool written = renderer.render(*model, shader);
+
+	const BandStats &stats = renderer.stats();
+	std::cerr << "# print " << width << "x" << height << " files " << stats.files << " bands " << stats.bands
+		<< " faces binned " << stats.binned << " band buffer " << stats.bandBytes / 1024 << " KB "
+		<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+	return written;
+}
+
+/**
+ * Render the model with multisample antialiasing, and compare the cost with supersampling at a
+ * similar sample count
+ *
+ * @param samples the samples per pixel; 4 or 8
+ * @param image   the image to resolve into
+ */
+void renderMultisampled(int samples, TGAImage &image) {
+	Vec3f lightDir(1, -1, -1);
+	MultisampleTarget target(WIDTH, HEIGHT, samples);
+	GouraudShader shader(*model, image, lightDir);
+
+	auto start = std::chrono::steady_clock::now();
+	renderModel(*model, shader, target);
+	target.resolve(image);
+	double msaa = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	// Supersampling shades and stores every sample: a 2x2 grid for 4x, 3x3 for 8x
+	int factor = samples == 8 ? 3 : 2;
+	TGAImage big(WIDTH * factor, HEIGHT * factor, TGAImage::RGB);
+	GouraudShader bigShader(*model, big, lightDir);
+	start = std::chrono::steady_clock::now();
+	renderModel(*model, bigShader, big);
+	big.materialize();
+	double ssaa = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	std::cerr << "# msaa " << target.get_samples() << "x " << msaa << " ms, " << target.bytes() / 1024 << " KB, "
+		<< target.get_split_pixels() << " split pixels; supersampling " << factor << "x" << factor << " " << ssaa << " ms, "
+		<< (size_t)big.get_width() * big.get_height() * (TGAImage::RGB + sizeof(float)) / 1024 << " KB" << std::endl;
+}
+
+/**
+ * Render the model with variable-rate shading, and compare the shading work, time and result
+ * with shading every pixel. The rate image keeps full rate around the center of the screen, as
+ * a viewer's point of focus would.
+ *
+ * @param image the image to draw to
+ */
+void renderVariableRate(TGAImage &image) {
+	Vec3f lightDir(1, -1, -1);
+	TGAImage full(WIDTH, HEIGHT, TGAImage::RGB);
+	PhongShader fullShader(*model, full, lightDir);
+	auto start = std::chrono::steady_clock::now();
+	ShadingStats fullStats = renderModel(*model, fullShader, full, 0, -1.f, NULL, NULL);
+	double fullTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	RateImage rates(WIDTH, HEIGHT);
+	for (int ty = 0; ty * RateImage::TILE < HEIGHT; ty++) {
+		for (int tx = 0; tx * RateImage::TILE < WIDTH; tx++) {
+			float dx = (tx + .5f) * RateImage::TILE / WIDTH - .5f;
+			float dy = (ty + .5f) * RateImage::TILE / HEIGHT - .5f;
+			float d = std::sqrt(dx * dx + dy * dy);
+			rates.set(tx, ty, d < .1f ? 1 : d < .2f ? 2 : 4);
+		}
+	}
+	TextureDetail detail(model->texture());
+	PhongShader shader(*model, image, lightDir);
+	start = std::chrono::steady_clock::now();
+	ShadingStats stats = renderModel(*model, shader, image, 0, .1f, &rates, &detail);
+	double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	double error = 0;
+	for (int y = 0; y < HEIGHT; y++) {
+		for (int x = 0; x < WIDTH; x++) {
+			TGAColor a = full.get(x, y);
+			TGAColor b = image.get(x, y);
+			for (int k = 0; k < 3; k++) error += (a.raw[k] - b.raw[k]) * (a.raw[k] - b.raw[k]);
+		}
+	}
+	std::cerr << "# vrs faces at 1x1/2x2/4x4 " << stats.faces[1] << "/" << stats.faces[2] << "/" << stats.faces[4]
+		<< ", shaded " << stats.shades << " of " << fullStats.shades << " (" << 100. * stats.shades / fullStats.shades << "%), "
+		<< time << " ms against " << fullTime << " ms, rmse " << std::sqrt(error / (3. * WIDTH * HEIGHT)) << std::endl;
+}
+
+/**
+ * Count the pixels of an image that some face has been drawn to
+ *
+ * @param image the image to count
+ *
+ * @return the number of pixels with a depth
+ */
+static long visiblePixels(TGAImage &image) {
+	image.materialize();
+	long visible = 0;
+	for (int y = 0; y < image.get_height(); y++) {
+		for (int x = 0; x < image.get_width(); x++) {
+			if (image.depth(x, y) > -std::numeric_limits<float>::max()) visible++;
+		}
+	}
+	return visible;
+}
+
+/**
+ * Render the model with the Phong shader in file order, in front to back face order and in front to
+ * back cluster order, and report the fragments shaded per visible pixel for each
+ *
+ * @param image the image to draw the face ordered render to
+ */
+void renderOrdered(TGAImage &image) {
+	const int CLUSTER = 64;
+	Vec3f lightDir(1, -1, -1);
+	std::vector<int> fileOrder(model->nfaces());
+	for (int i = 0; i < model->nfaces(); i++) fileOrder[i] = i;
+	DepthOrder order;
+
+	const char* names[3] = {"file", "faces", "clusters"};
+	for (int pass = 0; pass < 3; pass++) {
+		TGAImage target(WIDTH, HEIGHT, TGAImage::RGB);
+		TGAImage &out = pass == 1 ? image : target;
+		PhongShader phong(*model, out, lightDir);
+		CountingShader<PhongShader> shader(phong);
+
+		auto start = std::chrono::steady_clock::now();
+		const int* faces = pass == 0 ? &fileOrder[0] : pass == 1 ? order.sortFaces(*model) : order.sortClusters(*model, CLUSTER);
+		double sortTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		renderModel(*model, shader, out, faces, model->nfaces());
+		double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		long visible = visiblePixels(out);
+		std::cerr << "# order " << names[pass] << ": " << shader.fragments << " fragments for " << visible << " pixels, "
+			<< (double)shader.fragments / visible << " per pixel, " << time << " ms (sort " << sortTime << " ms)" << std::endl;
+	}
+}
+
+/**
+ * Draw the edges of the model and compare against drawing the outline of every face with
+ * TGAImage::line
+ *
+ * @param image  the image to draw to
+ * @param hidden true to leave out the hidden parts of the edges
+ */
+void renderWireframe(TGAImage &image, bool hidden) {
+	TGAColor white(255, 255, 255, 255);
+	TGAImage outlines(WIDTH, HEIGHT, TGAImage::RGB);
+	outlines.materialize();
+	image.materialize();
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < model->nfaces(); i++) {
+		const int* face = model->face(i);
+		for (int j = 0; j < 3; j++) {
+			Vec3f v0 = model->vert(face[j]);
+			Vec3f v1 = model->vert(face[(j + 1) % 3]);
+			outlines.line((v0.x + 1.) * WIDTH / 2., (v0.y + 1.) * HEIGHT / 2., (v1.x + 1.) * WIDTH / 2., (v1.y + 1.) * HEIGHT / 2., white);
+		}
+	}
+	double lineTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	Wireframe wireframe(*model);
+	double buildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	start = std::chrono::steady_clock::now();
+	int drawn = wireframe.render(*model, image, white, ThreadPool::shared(), hidden);
+	double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	std::cerr << "# wireframe " << wireframe.nedges() << " edges of " << 3 * model->nfaces() << " face edges, " << drawn << " drawn"
+		<< (hidden ? " with hidden lines removed" : "") << ", " << time << " ms (edge list " << buildTime << " ms) against "
+		<< lineTime << " ms for TGAImage::line" << std::endl;
+}
+
+/**
+ * Write thumbnails of a render at half, a quarter and an eighth of its size from one pass over it,
+ * and compare against a pass per size and against TGAImage::scale
+ *
+ * @param image  the render
+ * @param filter the filter to resample with
+ */
+void writeThumbnails(TGAImage &image, Resampler::Filter filter) {
+	const int SIZES = 3;
+	std::vector<TGAImage> thumbs;
+	std::vector<ImageView> views;
+	for (int i = 0; i < SIZES; i++) {
+		thumbs.push_back(TGAImage(WIDTH >> (i + 1), HEIGHT >> (i + 1), image.get_bytespp()));
+	}
+	for (int i = 0; i < SIZES; i++) {
+		views.push_back(thumbs[i].view());
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	Resampler::resample(image.view(), views, filter, ThreadPool::shared());
+	double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < SIZES; i++) {
+		Resampler::resample(image.view(), views[i], filter, ThreadPool::shared());
+	}
+	double separateTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < SIZES; i++) {
+		TGAImage copy(image);
+		copy.scale(WIDTH >> (i + 1), HEIGHT >> (i + 1));
+	}
+	double scaleTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	char filename[32];
+	for (int i = 0; i < SIZES; i++) {
+		snprintf(filename, sizeof(filename), "thumb%d.tga", thumbs[i].get_width());
+		thumbs[i].view().flipVertically().write_tga_file(filename);
+	}
+	std::cerr << "# thumbnails " << time << " ms in one pass, " << separateTime << " ms in a pass per size, "
+		<< scaleTime << " ms with TGAImage::scale" << std::endl;
+}
+
+/**
+ * Render the model at a multiple of the output size and filter it down
+ *
+ * @param factor the multiple of the output size to render at
+ * @param filter the filter to resample with
+ * @param image  the image to write the result to
+ */
+void renderSupersampled(int factor, Resampler::Filter filter, TGAImage &image) {
+	TGAImage large(WIDTH * factor, HEIGHT * factor, TGAImage::RGB);
+	model->render(large);
+	auto start = std::chrono::steady_clock::now();
+	Resampler::resample(large.view(), image.view(), filter, ThreadPool::shared());
+	double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cerr << "# supersampled " << factor << "x, resampled in " << time << " ms" << std::endl;
+}
+
+/**
+ * Render the model with the Phong shader through a perspective camera
+ *
+ * @param distance the distance from the camera to the center of the model, in model radii
+ * @param image    the image to draw to
+ */
+void renderCamera(float distance, TGAImage &image) {
+	Vec3f center = model->center();
+	float d = distance * model->radius();
+	Vec3f eye = center + Vec3f(std::sin(.4f) * d, .2f * d, std::cos(.4f) * d);
+	Camera camera(eye, center, Vec3f(0, 1, 0), 50 * M_PI / 180, (float)WIDTH / HEIGHT, .05f * model->radius(), 10 * d);
+
+	PhongShader shader(*model, image, Vec3f(1, -1, -1));
+	auto start = std::chrono::steady_clock::now();
+	ClipStats stats = renderModel(*model, shader, image, camera);
+	double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cerr << "# camera " << stats.faces << " faces, " << stats.rejected << " rejected, " << stats.clipped << " clipped, "
+		<< stats.triangles << " triangles drawn in " << time << " ms" << std::endl;
+}
+
+/**
+ * Render a turntable sequence of the model, writing each frame on a background thread while the
+ * next one is rendered, either to its own TGA file or to a video stream. With an animation, the
+ * model holds still and plays its poses instead, one per frame, looping as needed.
+ *
+ * @param frames    the number of frames in a full turn, or to play
+ * @param stream    the file, FIFO or - for standard output to stream the frames to; NULL for TGA files
+ * @param format    the format of the stream
+ * @param animation the poses to play; NULL to turn the model
+ * @param stats     the timings of the load, to be completed with the timings of the sequence
+ *
+ * @return false if the stream failed or a pose can't be decoded
+ */
+bool renderTurntable(int frames, const char *stream, VideoWriter::Format format, VertexAnimation *animation, PipelineStats &stats) {
+	auto start = std::chrono::steady_clock::now();
+	int fps = animation && animation->fps() > 0 ? animation->fps() : 30;
+	FrameWriter* files = stream ? NULL : new FrameWriter(WIDTH, HEIGHT, TGAImage::RGB, 2);
+	VideoWriter* video = stream ? new VideoWriter(stream, format, WIDTH, HEIGHT, fps, 3) : NULL;
+	InstanceSet instances(*model);
+	instances.add(Instance());
+	RenderContext context;
+	bool posed = true;
+
+	// Stop early once the stream fails, such as when the reader of a pipe goes away
+	int f = 0;
+	for (; f < frames && (!video || video->good()); f++) {
+		if (animation) {
+			posed = animation->seek(f % animation->frames()) && animation->pose(*model);
+			if (!posed) break;
+		}
+		TGAImage* image = video ? video->acquire() : files->acquire();
+
+		auto begin = std::chrono::steady_clock::now();
+		context.beginFrame();
+		if (!animation) instances.instance(0).yaw = 2 * M_PI * f / frames;
+		instances.render(*image, context);
+		stats.render += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+		if (video) {
+			video->submit(image);
+		} else {
+			char filename[32];
+			snprintf(filename, sizeof(filename), "output%04d.tga", f);
+			files->submit(image, filename);
+		}
+	}
+	bool good = true;
+	int written = f;
+	if (video) {
+		good = video->finish(stats);
+		written = video->frames();
+	} else {
+		files->finish(stats);
+	}
+	delete files;
+	delete video;
+
+	double wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cerr << "# frames " << written << " render " << stats.render << " ms, " << (video ? "convert and write " : "encode ")
+		<< stats.encode << " ms, render stalled " << stats.stalled << " ms, wall " << wall << " ms" << std::endl;
+	if (animation) {
+		std::cerr << "# poses decoded in " << animation->decodeTime() << " ms/frame, " << animation->bytes() / 1024
+			<< " KB held for playback" << std::endl;
+	}
+	return good && posed;
+}
+
+/**
+ * Get the resident set size of the process in bytes, or 0 where it can't be read
+ */
+static size_t residentBytes() {
+	long pages = 0;
+	FILE* f = fopen("/proc/self/statm", "r");
+	if (f) {
+		if (fscanf(f, "%*s %ld", &pages) != 1) pages = 0;
+		fclose(f);
+	}
+	return pages * 4096;
+}
+
+/**
+ * Render frames back to back as a long-running service would, each into an image that lives for
+ * one request. The images are checked out of the shared frame pool and returned to it when the
+ * request is done, unless pooled is false. The resident set, the calls to operator new made while
+ * rendering and the occupancy of the pool are reported after 1, 2, 4, ... requests and the last.
+ *
+ * @param requests the number of frames to render
+ * @param pooled   true to take the images from the frame pool; false to allocate each one
+ */
+void serveFrames(int requests, bool pooled) {
+	FramePool &pool = FramePool::shared();
+	InstanceSet instances(*model);
+	instances.add(Instance());
+	RenderContext context;
+	size_t allocations = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	auto render = [&](TGAImage &frame, int r) {
+		context.beginFrame();
+		instances.instance(0).yaw = 2 * M_PI * r / requests;
+		instances.render(frame, context);
+	};
+
+	for (int r = 0; r < requests; r++) {
+		size_t before = allocstats::allocations();
+		if (pooled) {
+			TGAImage frame(WIDTH, HEIGHT, TGAImage::RGB, pool);
+			render(frame, r);
+		} else {
+			TGAImage frame(WIDTH, HEIGHT, TGAImage::RGB);
+			render(frame, r);
+		}
+		size_t made = allocstats::allocations() - before;
+		allocations += made;
+
+		if (!((r + 1) & r) || r + 1 == requests) {
+			FramePoolStats ps = pool.stats();
+			std::cerr << "# request " << r + 1 << " rss " << residentBytes() / 1024 << " KB, allocations " << made
+				<< " (" << allocations << " in all), pool " << ps.checkedOut << " out, " << ps.reservedBytes / 1024
+				<< " KB reserved, peak " << ps.peakBytes / 1024 << " KB out, " << ps.maps << " maps, "
+				<< ps.hits << " reused" << std::endl;
+		}
+	}
+	double wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cerr << "# served " << requests << " frames in " << wall / requests << " ms/frame" << std::endl;
+}
+
 int main(int argc, char** argv) {
 	// Validate commandline arguments
-	if (3 != argc) {
-		std::cout << "Proper usage: ./main <objectFile> [textureFile]" << std::endl;
+	if (argc < 3) {
+		std::cout << "Proper usage: ./main <objectFile> <textureFile> [--frames F [--stream PATH|- [--raw]] | --play ANIMATION [--frames F] [--stream PATH|- [--raw]] | --encode-animation ANIMATION POSE... | --serve N [--no-pool] | --instances N [--frames F] | --scene N [--frames F] | --shadow RES | --shader unlit|gouraud|phong|block [--packed [--gamma]] | --bench-color N | --bench-depth N | --bench-threads N | --bench-clear SIZE | --bench-texture N | --print W H [--band ROWS] [--tile SIZE] | --msaa 4|8 | --vrs | --order | --wireframe [--hidden] | --supersample N | --camera DIST] [--thumbnails] [--quantize] [--verify [--tolerance COLOR DEPTH FRACTION]] [--filter box|bilinear|lanczos]" << std::endl;
 		return 1;
 	}
 
-	TGAImage texture;
-	texture.read_tga_file(argv[2]);
-	texture.flip_vertically();
+	int instanceCount = 0;
+	int sceneCount = 0;
+	int frameCount = 0;
+	int serveCount = 0;
+	bool pooled = true;
+	int shadowResolution = 0;
+	int benchDepth = 0;
+	int benchThreads = 0;
+	int benchClear = 0;
+	int benchTexture = 0;
+	int benchColor = 0;
+	bool packed = false;
+	bool gamma = false;
+	int msaaSamples = 0;
+	bool variableRate = false;
+	bool ordered = false;
+	bool wireframe = false;
+	bool hiddenLines = false;
+	bool thumbnails = false;
+	bool quantize = false;
+	float cameraDistance = 0;
+	int supersample = 0;
+	Resampler::Filter filter = Resampler::LANCZOS;
+	int printWidth = 0;
+	int printHeight = 0;
+	int bandHeight = 64;
+	int tileSize = TGAStream::MAX_SIZE;
+	const char* shaderName = NULL;
+	const char* streamPath = NULL;
+	const char* animationPath = NULL;
+	const char* encodePath = NULL;
+	std::vector<const char*> poses(1, argv[1]);
+	bool verify = false;
+	bool toleranceSet = false;
+	Tolerance tolerance;
+	VideoWriter::Format streamFormat = VideoWriter::Y4M;
+	for (int i = 3; i < argc; i++) {
+		if (!strcmp(argv[i], "--instances") && i + 1 < argc) {
+			instanceCount = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--scene") && i + 1 < argc) {
+			sceneCount = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+			frameCount = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--serve") && i + 1 < argc) {
+			serveCount = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--no-pool")) {
+			pooled = false;
+		} else if (!strcmp(argv[i], "--play") && i + 1 < argc) {
+			animationPath = argv[++i];
+		} else if (!strcmp(argv[i], "--encode-animation") && i + 1 < argc) {
+			// The object file is the first pose; the poses after it run up to the next option
+			encodePath = argv[++i];
+			while (i + 1 < argc && strncmp(argv[i + 1], "--", 2)) {
+				poses.push_back(argv[++i]);
+			}
+		} else if (!strcmp(argv[i], "--stream") && i + 1 < argc) {
+			streamPath = argv[++i];
+		} else if (!strcmp(argv[i], "--raw")) {
+			streamFormat = VideoWriter::RGB;
+		} else if (!strcmp(argv[i], "--shadow") && i + 1 < argc) {
+			shadowResolution = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--bench-depth") && i + 1 < argc) {
+			benchDepth = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--bench-threads") && i + 1 < argc) {
+			benchThreads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--bench-clear") && i + 1 < argc) {
+			benchClear = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--bench-texture") && i + 1 < argc) {
+			benchTexture = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--bench-color") && i + 1 < argc) {
+			benchColor = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--packed")) {
+			packed = true;
+		} else if (!strcmp(argv[i], "--gamma")) {
+			gamma = true;
+		} else if (!strcmp(argv[i], "--msaa") && i + 1 < argc) {
+			msaaSamples = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--vrs")) {
+			variableRate = true;
+		} else if (!strcmp(argv[i], "--order")) {
+			ordered = true;
+		} else if (!strcmp(argv[i], "--wireframe")) {
+			wireframe = true;
+		} else if (!strcmp(argv[i], "--hidden")) {
+			hiddenLines = true;
+		} else if (!strcmp(argv[i], "--camera") && i + 1 < argc) {
+			cameraDistance = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "--verify")) {
+			verify = true;
+		} else if (!strcmp(argv[i], "--tolerance") && i + 3 < argc) {
+			tolerance = Tolerance(atoi(argv[i + 1]), atof(argv[i + 2]), atof(argv[i + 3]));
+			toleranceSet = true;
+			i += 3;
+		} else if (!strcmp(argv[i], "--quantize")) {
+			quantize = true;
+		} else if (!strcmp(argv[i], "--thumbnails")) {
+			thumbnails = true;
+		} else if (!strcmp(argv[i], "--supersample") && i + 1 < argc) {
+			supersample = std::max(1, atoi(argv[++i]));
+		} else if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+			if (!Resampler::parseFilter(argv[++i], filter)) {
+				std::cout << "Unknown filter " << argv[i] << std::endl;
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "--print") && i + 2 < argc) {
+			printWidth = atoi(argv[++i]);
+			printHeight = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--band") && i + 1 < argc) {
+			bandHeight = std::max(1, atoi(argv[++i]));
+		} else if (!strcmp(argv[i], "--tile") && i + 1 < argc) {
+			tileSize = std::max(1, atoi(argv[++i]));
+		} else if (!strcmp(argv[i], "--shader") && i + 1 < argc) {
+			shaderName = argv[++i];
+		} else {
+			std::cout << "Unknown option " << argv[i] << std::endl;
+			return 1;
+		}
+	}
+
+	if (encodePath) {
+		return VertexAnimation::encode(poses, encodePath, 30) ? 0 : 1;
+	}
 
-	// Load the model
-	model = new Model(argv[1], texture);
+	// Load the model, decoding the texture at the same time
+	PipelineStats stats;
+	model = loadModel(argv[1], argv[2], stats);
+	std::cerr << "# load " << stats.load << " ms (texture " << stats.decode << " ms, model " << stats.parse << " ms)" << std::endl;
+	if (model->faceMaterial(0) >= 0) {
+		std::cerr << "# atlas " << model->texture().get_width() << "x" << model->texture().get_height() << " for " << model->nmaterials() << " materials" << std::endl;
+	}
+	if (quantize) {
+		size_t bytes = model->meshBytes();
+		if (model->quantize()) {
+			std::cerr << "# mesh " << bytes / 1024 << " KB, quantized " << model->meshBytes() / 1024 << " KB" << std::endl;
+		}
+	}
+
+	if (verify) {
+		Verifier verifier(argv[1]);
+		if (toleranceSet) verifier.setTolerance(tolerance);
+		bool passed = verifier.run(*model, argv[1], WIDTH, HEIGHT);
+		std::cerr << "# verify " << verifier.checks() << " checks, " << verifier.failures() << " failed" << std::endl;
+		delete model;
+		return passed ? 0 : 1;
+	}
+	if (benchDepth > 0) {
+		benchmarkDepth(benchDepth);
+		delete model;
+		return 0;
+	}
+	if (serveCount > 0) {
+		serveFrames(serveCount, pooled);
+		delete model;
+		return 0;
+	}
+	if (benchColor > 0) {
+		benchmarkColor(benchColor);
+		delete model;
+		return 0;
+	}
+	if (benchThreads > 0) {
+		benchmarkThreads(argv[1], benchThreads);
+		delete model;
+		return 0;
+	}
+	if (benchClear > 0) {
+		benchmarkClear(benchClear);
+		delete model;
+		return 0;
+	}
+	if (benchTexture > 0) {
+		benchmarkTexture(benchTexture);
+		delete model;
+		return 0;
+	}
+	if (printWidth > 0 && printHeight > 0) {
+		bool written = renderPrint(printWidth, printHeight, bandHeight, tileSize);
+		delete model;
+		return written ? 0 : 1;
+	}
 
 	// Render the model
 	TGAImage image(WIDTH, HEIGHT, TGAImage::RGB);
+	RenderContext context;
 
-	model->render(image);
-	image.flip_vertically();
+	if (animationPath) {
+		VertexAnimation animation(animationPath);
+		if (!animation.good() || animation.nverts() != model->nverts() || animation.nnormals() != model->nnormals()) {
+			std::cerr << "the animation " << animationPath << " does not fit the model" << std::endl;
+			delete model;
+			return 1;
+		}
+		if (streamPath) signal(SIGPIPE, SIG_IGN);
+		bool played = renderTurntable(frameCount > 0 ? frameCount : animation.frames(), streamPath, streamFormat, &animation, stats);
+		delete model;
+		return played ? 0 : 1;
+	}
+	if (frameCount > 0 && instanceCount == 0 && sceneCount == 0) {
+		// A closed pipe should fail the write rather than kill the process
+		if (streamPath) signal(SIGPIPE, SIG_IGN);
+		bool streamed = renderTurntable(frameCount, streamPath, streamFormat, NULL, stats);
+		delete model;
+		return streamed ? 0 : 1;
+	}
 
-	// Output the image
-	image.write_tga_file("output.tga");
+	if (instanceCount > 0) {
+		InstanceSet instances(*model);
+		scatter(instances, instanceCount);
+
+		// Redraw the same frame to show that steady-state frames do not allocate
+		for (int f = 0; f < std::max(frameCount, 1); f++) {
+			size_t allocations = allocstats::allocations();
+			context.beginFrame();
+			image.clearRect(Rect(0, 0, WIDTH, HEIGHT));
+			int drawn = instances.render(image, context);
+			std::cerr << "# frame " << f << " instances " << instanceCount << " drawn " << drawn
+				<< " allocations " << allocstats::allocations() - allocations << std::endl;
+		}
+	} else if (sceneCount > 0 && frameCount > 0) {
+		Scene scene;
+		scatter(scene, sceneCount);
+		IncrementalRenderer renderer(scene, WIDTH, HEIGHT);
+
+		// Spin one visible object while the rest of the scene stays still
+		std::vector<int> visible;
+		scene.collect(ViewWindow(), visible);
+		for (int f = 0; f < frameCount; f++) {
+			if (f > 0 && !visible.empty()) {
+				Instance spun = scene.instance(visible[0]);
+				spun.yaw += .1f;
+				scene.move(visible[0], spun);
+			}
+			size_t allocations = allocstats::allocations();
+			const FrameStats &stats = renderer.render();
+			std::cerr << "# frame " << f << " tiles redrawn " << stats.damagedTiles << "/" << stats.tiles
+				<< " reused " << stats.reused() * 100 << "%"
+				<< " allocations " << allocstats::allocations() - allocations << std::endl;
+		}
+		image = renderer.image();
+	} else if (sceneCount > 0) {
+		Scene scene;
+		scatter(scene, sceneCount);
+		int drawn = scene.render(image, context);
+		std::cerr << "# objects " << sceneCount << " drawn " << drawn << " nodes visited " << scene.nodesVisited() << std::endl;
+	} else if (shadowResolution > 0) {
+		ShadowMap shadow(Vec3f(1, -1, -1), shadowResolution);
+		shadow.fit(model->center(), model->radius());
+		shadow.render(*model);
+		model->render(image, shadow, .15f);
+	} else if (variableRate) {
+		renderVariableRate(image);
+	} else if (ordered) {
+		renderOrdered(image);
+	} else if (wireframe) {
+		renderWireframe(image, hiddenLines);
+	} else if (cameraDistance > 0) {
+		renderCamera(cameraDistance, image);
+	} else if (supersample > 0) {
+		renderSupersampled(supersample, filter, image);
+	} else if (msaaSamples > 0) {
+		renderMultisampled(msaaSamples, image);
+	} else if (shaderName) {
+		Vec3f lightDir(1, -1, -1);
+		if (!strcmp(shaderName, "unlit")) {
+			UnlitTexturedShader shader(*model, image);
+			renderShaded(shader, image, packed, gamma);
+		} else if (!strcmp(shaderName, "gouraud")) {
+			GouraudShader shader(*model, image, lightDir);
+			renderShaded(shader, image, packed, gamma);
+		} else if (!strcmp(shaderName, "phong")) {
+			PhongShader shader(*model, image, lightDir);
+			renderShaded(shader, image, packed, gamma);
+		} else if (!strcmp(shaderName, "block")) {
+			compressTexture();
+			BlockTexturedShader shader(*model, image, lightDir);
+			renderModel(*model, shader, image, ThreadPool::shared());
+		} else {
+			std::cout << "Unknown shader " << shaderName << std::endl;
+			delete model;
+			return 1;
+		}
+	} else {
+		model->render(image);
+	}
+	if (thumbnails) writeThumbnails(image, filter);
+
+	// Output the image; its first row is the bottom one
+	image.view().flipVertically().write_tga_file("output.tga");
 
 	// Clean up
 	delete model;
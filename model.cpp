@@ -1,129 +1,595 @@
-#include <iostream>
-#include <string>
-#include <fstream>
-#include <sstream>
-#include <vector>
-#include "model.h"
-
-Model::Model(const char *filename, TGAImage &textureMap) : verts_(), faces_(), norms_(), uv_() {
-    std::ifstream in;
-    in.open (filename, std::ifstream::in);
-    if (in.fail()) return;
-    std::string line;
-    while (!in.eof()) {
-        std::getline(in, line);
-        std::istringstream iss(line.c_str());
-        char trash;
-        if (!line.compare(0, 2, "v ")) {
-            iss >> trash;
-            Vec3f v;
-            for (int i=0;i<3;i++) iss >> v[i];
-            verts_.push_back(v);
-        } else if (!line.compare(0, 3, "vn ")) {
-            iss >> trash >> trash;
-            Vec3f n;
-            for (int i=0;i<3;i++) iss >> n[i];
-            norms_.push_back(n);
-        } else if (!line.compare(0, 3, "vt ")) {
-            iss >> trash >> trash;
-            Vec2f uv;
-            for (int i=0;i<2;i++) iss >> uv[i];
-            uv_.push_back(uv);
-        }  else if (!line.compare(0, 2, "f ")) {
-            std::vector<Vec3i> f;
-            Vec3i tmp;
-            iss >> trash;
-            while (iss >> tmp[0] >> trash >> tmp[1] >> trash >> tmp[2]) {
-                for (int i=0; i<3; i++) tmp[i]--; // in wavefront obj all indices start at 1, not zero
-                f.push_back(tmp);
-            }
-
-            faces_.push_back(f);
-        }
-    }
-
-    std::cerr << "# v# " << verts_.size() << " f# "  << faces_.size() << " vt# " << uv_.size() << " vn# " << norms_.size() << std::endl;
-    this->textureMap = textureMap;
-}
-
-Model::~Model() {
-}
-
-int Model::nverts() {
-    return (int)verts_.size();
-}
-
-int Model::nfaces() {
-    return (int)faces_.size();
-}
-
-std::vector<int> Model::face(int idx) {
-    std::vector<int> face;
-    for (int i=0; i<(int)faces_[idx].size(); i++) face.push_back(faces_[idx][i][0]);
-    return face;
-}
-
-Vec3f Model::vert(int i) {
-    return verts_[i];
-}
-
-TGAColor Model::diffuse(Vec2f uv) {
-    return textureMap.get(uv.x, uv.y);
-}
-
-Vec2i Model::uv(int iface, int nvert) {
-    int idx = faces_[iface][nvert].y;
-    return Vec2i(
-        uv_[idx].x * textureMap.get_width(),
-        uv_[idx].y * textureMap.get_height()
-    );
-}
-
-/**
- * Draw the model to an image
- *
- * @param image the image to draw to
- */
-void Model::render (TGAImage &image) {
-    // Iterate through each face
-    for (int i = 0; i < nfaces(); i++) {
-        std::vector<int> face = this->face(i);
-
-        Vec3f screenCoords[3];
-        Vec3f worldCoords[3];
-        Vec2i textureCoords[3];
-
-        // Get the 3D coordinates as well as the 2D mapping for each vertex
-        for (int j = 0; j < 3; j++) {
-            Vec3f v = vert(face[j]);
-            worldCoords [j] = v;
-            screenCoords[j] = Vec3f(
-                (v.x + 1.) * image.get_width()  / 2.,
-                (v.y + 1.) * image.get_height() / 2.,
-                (v.z)
-            );
-        }
-
-        // Get the normal to the face
-        Vec3f n = (worldCoords[2] - worldCoords[0]) ^ (worldCoords[1] - worldCoords[0]);
-        n.normalize();
-
-        // Get texture coords
-        for (int j = 0; j < 3; j++) {
-            textureCoords[j] = uv(i, j);
-        }
-
-        // Calculate the intensity of the lighting based on the normal
-        Vec3f lightDir(0, 0, -1);
-        float intensity = n * lightDir;
-
-        if (intensity > 0) {
-            image.triFill(
-                screenCoords,
-                textureCoords,
-                textureMap,
-                intensity
-            );
-        }
-    }
-}
\ No newline at end of file
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "model.h"
+#include "atlas.h"
+#include "shader.h"
+
+/**
+ * The elements parsed from one chunk of an OBJ file
+ */
+struct ObjChunk {
+    std::vector<Vec3f> verts;
+    std::vector<std::vector<Vec3i>> faces;
+    std::vector<Vec3f> norms;
+    std::vector<Vec2f> uv;
+    std::vector<std::string> libraries;
+    // Each usemtl statement, with the number of faces of the chunk that came before it
+    std::vector<std::pair<int, std::string>> switches;
+};
+
+/**
+ * Strip leading and trailing whitespace, including the carriage return of CRLF line endings
+ */
+static std::string trim(const std::string &s) {
+    size_t begin = s.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) return std::string();
+    size_t end = s.find_last_not_of(" \t\r\n");
+    return s.substr(begin, end + 1 - begin);
+}
+
+/**
+ * Resolve a path named in a file against the directory of that file
+ *
+ * @param file the path of the file that names the other path
+ * @param path the path as named in the file
+ */
+static std::string resolvePath(const std::string &file, const std::string &path) {
+    if (!path.empty() && path[0] == '/') return path;
+    size_t slash = file.find_last_of("/\\");
+    return slash == std::string::npos ? path : file.substr(0, slash + 1) + path;
+}
+
+/**
+ * Parse one line of an OBJ file
+ *
+ * @param line  the line to parse
+ * @param chunk the elements to add the line's element to
+ */
+static void parseLine(const std::string &line, ObjChunk &chunk) {
+    std::istringstream iss(line.c_str());
+    char trash;
+    if (!line.compare(0, 2, "v ")) {
+        iss >> trash;
+        Vec3f v;
+        for (int i=0;i<3;i++) iss >> v[i];
+        chunk.verts.push_back(v);
+    } else if (!line.compare(0, 3, "vn ")) {
+        iss >> trash >> trash;
+        Vec3f n;
+        for (int i=0;i<3;i++) iss >> n[i];
+        chunk.norms.push_back(n);
+    } else if (!line.compare(0, 3, "vt ")) {
+        iss >> trash >> trash;
+        Vec2f uv;
+        for (int i=0;i<2;i++) iss >> uv[i];
+        chunk.uv.push_back(uv);
+    }  else if (!line.compare(0, 2, "f ")) {
+        std::vector<Vec3i> f;
+        Vec3i tmp;
+        iss >> trash;
+        while (iss >> tmp[0] >> trash >> tmp[1] >> trash >> tmp[2]) {
+            for (int i=0; i<3; i++) tmp[i]--; // in wavefront obj all indices start at 1, not zero
+            f.push_back(tmp);
+        }
+
+        chunk.faces.push_back(f);
+    } else if (!line.compare(0, 7, "mtllib ")) {
+        chunk.libraries.push_back(trim(line.substr(7)));
+    } else if (!line.compare(0, 7, "usemtl ")) {
+        chunk.switches.push_back(std::make_pair((int)chunk.faces.size(), trim(line.substr(7))));
+    }
+}
+
+/**
+ * Parse the materials of an MTL file. Only the diffuse color and diffuse texture are read; the
+ * textures are not loaded.
+ *
+ * @param filename  the path of the MTL file
+ * @param materials the list to add the materials to
+ */
+static void parseMaterials(const std::string &filename, std::vector<Material> &materials) {
+    std::ifstream in;
+    in.open(filename.c_str(), std::ifstream::in);
+    if (in.fail()) {
+        std::cerr << "can't open material library " << filename << std::endl;
+        return;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        line = trim(line);
+        std::istringstream iss(line);
+        std::string key;
+        iss >> key;
+        if (key == "newmtl") {
+            materials.push_back(Material(trim(line.substr(6))));
+        } else if (materials.empty()) {
+            continue;
+        } else if (key == "Kd") {
+            float rgb[3];
+            if (iss >> rgb[0] >> rgb[1] >> rgb[2]) {
+                unsigned char c[3];
+                for (int i = 0; i < 3; i++) {
+                    c[i] = (unsigned char)(std::min(std::max(rgb[i], 0.f), 1.f) * 255.f + .5f);
+                }
+                materials.back().color = TGAColor(c[0], c[1], c[2], 255);
+            }
+        } else if (key == "map_Kd") {
+            // Options such as -s come before the file name, so the name is the last word
+            std::string file;
+            while (iss >> file) {}
+            materials.back().textureFile = resolvePath(filename, file);
+        }
+    }
+}
+
+/**
+ * Find a material by name, adding a plain white one if there is none by that name
+ *
+ * @return the index of the material
+ */
+static int findMaterial(std::vector<Material> &materials, const std::string &name) {
+    for (int i = 0; i < (int)materials.size(); i++) {
+        if (materials[i].name == name) return i;
+    }
+    materials.push_back(Material(name));
+    return (int)materials.size() - 1;
+}
+
+template <class T> static void append(std::vector<T> &to, const std::vector<T> &from) {
+    to.insert(to.end(), from.begin(), from.end());
+}
+
+/**
+ * Load a model from a Wavefront OBJ file, without a texture
+ *
+ * @param filename the path of the file
+ */
+Model::Model(const char *filename) : Model(filename, ThreadPool::shared()) {
+}
+
+/**
+ * Load a model from a Wavefront OBJ file, parsing chunks of the file in parallel
+ *
+ * @param filename the path of the file
+ * @param pool     the pool to parse the chunks on
+ */
+Model::Model(const char *filename, ThreadPool &pool) : verts_(), faces_(), faceVerts_(), faceStart_(), norms_(), uv_(), materials_(), faceMaterials_(), mesh_(), quantized_(false), center_(), radius_(0) {
+    std::ifstream in;
+    in.open (filename, std::ifstream::in);
+    if (in.fail()) return;
+    std::stringstream contents;
+    contents << in.rdbuf();
+    std::string text = contents.str();
+
+    // Split the file into chunks of whole lines. Indices in an OBJ file are global, so the chunks
+    // can be parsed independently and concatenated in order.
+    const size_t chunkSize = 64 * 1024;
+    std::vector<size_t> starts(1, 0);
+    while (starts.back() + chunkSize < text.size()) {
+        size_t end = text.find('\n', starts.back() + chunkSize);
+        if (end == std::string::npos) break;
+        starts.push_back(end + 1);
+    }
+    starts.push_back(text.size() + 1);
+
+    std::vector<ObjChunk> chunks(starts.size() - 1);
+    pool.parallelFor(0, (int)chunks.size(), 1, [&](int lo, int hi) {
+        for (int c = lo; c < hi; c++) {
+            std::istringstream lines(text.substr(starts[c], starts[c + 1] - 1 - starts[c]));
+            std::string line;
+            while (!lines.eof()) {
+                std::getline(lines, line);
+                parseLine(line, chunks[c]);
+            }
+        }
+    });
+
+    for (int c = 0; c < (int)chunks.size(); c++) {
+        append(verts_, chunks[c].verts);
+        append(faces_, chunks[c].faces);
+        append(norms_, chunks[c].norms);
+        append(uv_,    chunks[c].uv);
+    }
+
+    // Read the material libraries and load their textures, then give each face the material named
+    // last before it. Faces before the first usemtl get a plain white material.
+    for (int c = 0; c < (int)chunks.size(); c++) {
+        for (int i = 0; i < (int)chunks[c].libraries.size(); i++) {
+            parseMaterials(resolvePath(filename, chunks[c].libraries[i]), materials_);
+        }
+    }
+    pool.parallelFor(0, (int)materials_.size(), 1, [&](int lo, int hi) {
+        for (int m = lo; m < hi; m++) {
+            Material &material = materials_[m];
+            if (!material.textureFile.empty() && !material.texture.read_tga_file(material.textureFile.c_str(), true)) {
+                material.texture = TGAImage();
+            }
+        }
+    });
+    bool named = false;
+    for (int c = 0; c < (int)chunks.size(); c++) {
+        named = named || !chunks[c].switches.empty();
+    }
+    int current = -1;
+    for (int c = 0; named && c < (int)chunks.size(); c++) {
+        const std::vector<std::pair<int, std::string>> &switches = chunks[c].switches;
+        size_t k = 0;
+        for (int f = 0; f <= (int)chunks[c].faces.size(); f++) {
+            while (k < switches.size() && switches[k].first == f) {
+                current = findMaterial(materials_, switches[k++].second);
+            }
+            if (f == (int)chunks[c].faces.size()) break;
+            if (current < 0) current = findMaterial(materials_, "");
+            faceMaterials_.push_back(current);
+        }
+    }
+
+    // Flatten the vertex indices of the faces so face() can hand them out without copying
+    for (int i = 0; i < (int)faces_.size(); i++) {
+        faceStart_.push_back((int)faceVerts_.size());
+        for (int j = 0; j < (int)faces_[i].size(); j++) {
+            faceVerts_.push_back(faces_[i][j][0]);
+        }
+    }
+    faceStart_.push_back((int)faceVerts_.size());
+
+    computeBounds();
+
+    std::cerr << "# v# " << verts_.size() << " f# "  << faces_.size() << " vt# " << uv_.size() << " vn# " << norms_.size();
+    if (!materials_.empty()) std::cerr << " mtl# " << materials_.size();
+    std::cerr << std::endl;
+}
+
+/**
+ * Load a model from a Wavefront OBJ file
+ *
+ * @param filename   the path of the file
+ * @param textureMap the diffuse texture of the model; copied
+ */
+Model::Model(const char *filename, TGAImage &textureMap) : Model(filename) {
+    this->textureMap = textureMap;
+}
+
+Model::~Model() {
+}
+
+/**
+ * Compute a bounding sphere around the axis-aligned bounding box of the vertices
+ */
+void Model::computeBounds() {
+    center_ = Vec3f();
+    radius_ = 0;
+    if (verts_.empty()) return;
+    Vec3f lo = verts_[0];
+    Vec3f hi = verts_[0];
+    for (int i = 1; i < (int)verts_.size(); i++) {
+        for (int j = 0; j < 3; j++) {
+            lo[j] = std::min(lo[j], verts_[i][j]);
+            hi[j] = std::max(hi[j], verts_[i][j]);
+        }
+    }
+    center_ = (lo + hi) * 0.5f;
+    for (int i = 0; i < (int)verts_.size(); i++) {
+        radius_ = std::max(radius_, (verts_[i] - center_).norm());
+    }
+}
+
+int Model::nverts() {
+    return quantized_ ? mesh_.nverts() : (int)verts_.size();
+}
+
+int Model::nfaces() {
+    return quantized_ ? mesh_.nfaces() : (int)faces_.size();
+}
+
+/**
+ * Get the vertex indices of a face
+ *
+ * @param idx the index of the face
+ *
+ * @return a pointer to the face's vertex indices, valid for the lifetime of the model; once the
+ *         model is quantized, only valid until the calling thread next calls face()
+ */
+const int* Model::face(int idx) {
+    if (quantized_) {
+        static thread_local int corners[3];
+        for (int j = 0; j < 3; j++) {
+            corners[j] = mesh_.corner(idx, j).x;
+        }
+        return corners;
+    }
+    return &faceVerts_[faceStart_[idx]];
+}
+
+Vec3f Model::vert(int i) {
+    return quantized_ ? mesh_.vert(i) : verts_[i];
+}
+
+/**
+ * Get the number of vn entries of the file; 0 once the model is quantized
+ */
+int Model::nnormals() {
+    return quantized_ ? 0 : (int)norms_.size();
+}
+
+/**
+ * Get a vn entry of the file as it was given, which may not be of unit length
+ *
+ * @param i the index of the entry
+ */
+Vec3f Model::norm(int i) {
+    return norms_[i];
+}
+
+/**
+ * Move the vertices and normals to another pose of the same mesh, keeping the faces, the texture
+ * coordinates and the texture, and refit the bounding sphere
+ *
+ * @param verts a position for each vertex
+ * @param norms a normal for each vn entry
+ *
+ * @return false if the model is quantized or the pose has a different number of either
+ */
+bool Model::setPose(const std::vector<Vec3f> &verts, const std::vector<Vec3f> &norms) {
+    if (quantized_ || verts.size() != verts_.size() || norms.size() != norms_.size()) return false;
+    verts_ = verts;
+    norms_ = norms;
+    computeBounds();
+    return true;
+}
+
+TGAColor Model::diffuse(Vec2f uv) {
+    return textureMap.get(uv.x, uv.y);
+}
+
+Vec2i Model::uv(int iface, int nvert) {
+    Vec2f uv = uvf(iface, nvert);
+    return Vec2i(
+        uv.x * textureMap.get_width(),
+        uv.y * textureMap.get_height()
+    );
+}
+
+/**
+ * Get the texture coordinates of a face's vertex, in [0, 1]
+ *
+ * @param iface the index of the face
+ * @param nvert the index of the vertex within the face
+ */
+Vec2f Model::uvf(int iface, int nvert) {
+    if (quantized_) return mesh_.uv(mesh_.corner(iface, nvert).y);
+    return uv_[faces_[iface][nvert].y];
+}
+
+/**
+ * Get the normal of a face's vertex, as given by the vn entries of the file
+ *
+ * @param iface the index of the face
+ * @param nvert the index of the vertex within the face
+ */
+Vec3f Model::normal(int iface, int nvert) {
+    if (quantized_) return mesh_.normal(mesh_.corner(iface, nvert).z);
+    Vec3f n = norms_[faces_[iface][nvert].z];
+    return n.normalize();
+}
+
+TGAImage &Model::texture() {
+    return textureMap;
+}
+
+/**
+ * Replace the diffuse texture of the model
+ *
+ * @param texture the new texture; copied
+ */
+void Model::setTexture(const TGAImage &texture) {
+    textureMap = texture;
+}
+
+/**
+ * Replace the diffuse texture with its block-compressed form, releasing the uncompressed pixels.
+ * Afterwards only shaders that sample blockTexture() draw the model textured.
+ */
+void Model::compressTexture() {
+    blockMap = BlockTexture(textureMap);
+    textureMap = TGAImage();
+}
+
+/**
+ * Get the block-compressed diffuse texture; empty until compressTexture() is called
+ */
+BlockTexture &Model::blockTexture() {
+    return blockMap;
+}
+
+int Model::nmaterials() {
+    return (int)materials_.size();
+}
+
+Material &Model::material(int i) {
+    return materials_[i];
+}
+
+/**
+ * Get the material of a face
+ *
+ * @param iface the index of the face
+ *
+ * @return the index of the face's material, or -1 if the file names no materials
+ */
+int Model::faceMaterial(int iface) {
+    return faceMaterials_.empty() ? -1 : faceMaterials_[iface];
+}
+
+/**
+ * Pack the textures of the materials into one atlas that replaces the diffuse texture, and move the
+ * texture coordinates of each face into its material's region of the atlas, so that the whole model
+ * draws with one texture. A material without a texture gets a small tile of its diffuse color.
+ * Texture coordinates shared by faces of different materials are duplicated, one per material.
+ *
+ * @param padding the width of the border of repeated edge texels around each texture
+ * @param maxSize the largest width and height of the atlas
+ *
+ * @return false if no face names a material, the model is quantized, or the textures do not fit
+ */
+bool Model::packMaterials(int padding, int maxSize) {
+    if (faceMaterials_.empty() || quantized_) return false;
+
+    std::vector<TGAImage> tiles(materials_.size());
+    std::vector<TGAImage*> textures;
+    for (int m = 0; m < (int)materials_.size(); m++) {
+        if (materials_[m].texture.get_width() > 0) {
+            textures.push_back(&materials_[m].texture);
+        } else {
+            tiles[m] = TGAImage(4, 4, TGAImage::RGB);
+            tiles[m].clear(materials_[m].color);
+            textures.push_back(&tiles[m]);
+        }
+    }
+    TextureAtlas atlas;
+    if (!atlas.pack(textures, padding, maxSize)) return false;
+
+    std::vector<Vec2f> uv;
+    std::unordered_map<long long, int> remapped;
+    for (int i = 0; i < (int)faces_.size(); i++) {
+        int m = faceMaterials_[i];
+        for (int j = 0; j < (int)faces_[i].size(); j++) {
+            int &t = faces_[i][j].y;
+            if (t < 0 || t >= (int)uv_.size()) continue;
+            long long key = (long long)t * materials_.size() + m;
+            std::unordered_map<long long, int>::iterator it = remapped.find(key);
+            if (it == remapped.end()) {
+                it = remapped.insert(std::make_pair(key, (int)uv.size())).first;
+                uv.push_back(atlas.remap(m, uv_[t]));
+            }
+            t = it->second;
+        }
+    }
+    uv_.swap(uv);
+
+    textureMap = atlas.image();
+    for (int m = 0; m < (int)materials_.size(); m++) {
+        materials_[m].texture = TGAImage();
+    }
+    return true;
+}
+
+/**
+ * Replace the vertices and faces with a QuantizedMesh and release the full-precision ones.
+ * Afterwards the accessors dequantize on the fly.
+ *
+ * @return false if the model is already quantized or has a face that is not a triangle
+ */
+bool Model::quantize() {
+    if (quantized_) return false;
+    for (int i = 0; i < nfaces(); i++) {
+        if (faces_[i].size() != 3) return false;
+    }
+    mesh_ = QuantizedMesh(verts_, norms_, uv_, faces_);
+    quantized_ = true;
+    std::vector<Vec3f>().swap(verts_);
+    std::vector<std::vector<Vec3i>>().swap(faces_);
+    std::vector<int>().swap(faceVerts_);
+    std::vector<int>().swap(faceStart_);
+    std::vector<Vec3f>().swap(norms_);
+    std::vector<Vec2f>().swap(uv_);
+    return true;
+}
+
+bool Model::quantized() {
+    return quantized_;
+}
+
+/**
+ * Get the bytes held by the vertices and faces, counting the heap block of each face's corners
+ * without the allocator's own overhead
+ */
+size_t Model::meshBytes() {
+    if (quantized_) return mesh_.bytes();
+    size_t bytes = verts_.capacity() * sizeof(Vec3f) + norms_.capacity() * sizeof(Vec3f) + uv_.capacity() * sizeof(Vec2f)
+        + faceVerts_.capacity() * sizeof(int) + faceStart_.capacity() * sizeof(int) + faces_.capacity() * sizeof(faces_[0]);
+    for (int i = 0; i < (int)faces_.size(); i++) {
+        bytes += faces_[i].capacity() * sizeof(Vec3i);
+    }
+    return bytes;
+}
+
+/**
+ * Get the center of the model's bounding sphere in object space
+ */
+Vec3f Model::center() {
+    return center_;
+}
+
+/**
+ * Get the radius of the model's bounding sphere in object space
+ */
+float Model::radius() {
+    return radius_;
+}
+
+/**
+ * Draw the model to an image
+ *
+ * @param image the image to draw to
+ */
+void Model::render (TGAImage &image) {
+    // Iterate through each face
+    for (int i = 0; i < nfaces(); i++) {
+        const int* face = this->face(i);
+
+        Vec3f screenCoords[3];
+        Vec3f worldCoords[3];
+        Vec2i textureCoords[3];
+
+        // Get the 3D coordinates as well as the 2D mapping for each vertex
+        for (int j = 0; j < 3; j++) {
+            Vec3f v = vert(face[j]);
+            worldCoords [j] = v;
+            screenCoords[j] = Vec3f(
+                (v.x + 1.) * image.get_width()  / 2.,
+                (v.y + 1.) * image.get_height() / 2.,
+                (v.z)
+            );
+        }
+
+        // Get the normal to the face
+        Vec3f n = (worldCoords[2] - worldCoords[0]) ^ (worldCoords[1] - worldCoords[0]);
+        n.normalize();
+
+        // Get texture coords
+        for (int j = 0; j < 3; j++) {
+            textureCoords[j] = uv(i, j);
+        }
+
+        // Calculate the intensity of the lighting based on the normal
+        Vec3f lightDir(0, 0, -1);
+        float intensity = n * lightDir;
+
+        if (intensity > 0) {
+            image.triFill(
+                screenCoords,
+                textureCoords,
+                textureMap,
+                intensity
+            );
+        }
+    }
+}
+
+/**
+ * Draw the model to an image, lit by the light of a shadow map
+ *
+ * @param image   the image to draw to
+ * @param shadow  the shadow map for the light, already rendered
+ * @param ambient the lighting intensity of surfaces the light does not reach
+ */
+void Model::render(TGAImage &image, ShadowMap &shadow, float ambient) {
+    ShadowShader shader(*this, image, shadow, ambient);
+    renderModel(*this, shader, image);
+}
@@ -1,27 +1,76 @@
-#ifndef __MODEL_H__
-#define __MODEL_H__
-
-#include <vector>
-#include "geometry.h"
-#include "tgaimage.h"
-
-class Model {
-private:
-	std::vector<Vec3f> verts_;
-	std::vector<std::vector<Vec3i>> faces_;
-	std::vector<Vec3f> norms_;
-	std::vector<Vec2f> uv_;
-	TGAImage textureMap;
-public:
-	Model(const char *filename, TGAImage &textureMap);
-	~Model();
-	int nverts();
-	int nfaces();
-	Vec3f vert(int i);
-	std::vector<int> face(int idx);
-	TGAColor diffuse(Vec2f uvf);
-	Vec2i uv(int iface, int nvert);
-    void render(TGAImage &image);
-};
-
+#ifndef __MODEL_H__
+#define __MODEL_H__
+
+#include <vector>
+#include <string>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "shadow.h"
+#include "threadpool.h"
+#include "texture.h"
+#include "quantized.h"
+
+/**
+ * A material of an MTL file: its diffuse color, and its diffuse texture if it names one
+ */
+struct Material {
+	std::string name;
+	TGAColor color;
+	std::string textureFile;
+	TGAImage texture;
+
+	Material(const std::string &n) : name(n), color(255, 255, 255, 255), textureFile(), texture() {}
+};
+
+class Model {
+private:
+	std::vector<Vec3f> verts_;
+	std::vector<std::vector<Vec3i>> faces_;
+	std::vector<int> faceVerts_;
+	std::vector<int> faceStart_;
+	std::vector<Vec3f> norms_;
+	std::vector<Vec2f> uv_;
+	std::vector<Material> materials_;
+	std::vector<int> faceMaterials_;
+	TGAImage textureMap;
+	BlockTexture blockMap;
+	QuantizedMesh mesh_;
+	bool quantized_;
+	Vec3f center_;
+	float radius_;
+
+	void computeBounds();
+public:
+	Model(const char *filename);
+	Model(const char *filename, ThreadPool &pool);
+	Model(const char *filename, TGAImage &textureMap);
+	~Model();
+	int nverts();
+	int nfaces();
+	Vec3f vert(int i);
+	int nnormals();
+	Vec3f norm(int i);
+	bool setPose(const std::vector<Vec3f> &verts, const std::vector<Vec3f> &norms);
+	const int* face(int idx);
+	TGAColor diffuse(Vec2f uvf);
+	Vec2i uv(int iface, int nvert);
+	Vec2f uvf(int iface, int nvert);
+	Vec3f normal(int iface, int nvert);
+	TGAImage &texture();
+	void setTexture(const TGAImage &texture);
+	void compressTexture();
+	BlockTexture &blockTexture();
+	int nmaterials();
+	Material &material(int i);
+	int faceMaterial(int iface);
+	bool packMaterials(int padding=4, int maxSize=8192);
+	bool quantize();
+	bool quantized();
+	size_t meshBytes();
+	Vec3f center();
+	float radius();
+    void render(TGAImage &image);
+	void render(TGAImage &image, ShadowMap &shadow, float ambient);
+};
+
 #endif //__MODEL_H__
\ No newline at end of file
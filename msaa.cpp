@@ -0,0 +1,142 @@
+#include <cstring>
+#include "msaa.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Sample positions within a pixel: the rotated grid for 4x and the standard D3D pattern for 8x
+static const float PATTERN_4X[4][2] = {
+	{.375f, .125f}, {.875f, .375f}, {.125f, .625f}, {.625f, .875f}
+};
+static const float PATTERN_8X[8][2] = {
+	{.5625f, .3125f}, {.4375f, .6875f}, {.8125f, .5625f}, {.3125f, .1875f},
+	{.1875f, .8125f}, {.0625f, .4375f}, {.6875f, .9375f}, {.9375f, .0625f}
+};
+
+/**
+ * @param w       the width of the target
+ * @param h       the height of the target
+ * @param samples the samples per pixel; 4 or 8
+ */
+MultisampleTarget::MultisampleTarget(int w, int h, int samples) :
+	width(w), height(h), samples(samples == 8 ? 8 : 4), fullMask((1u << this->samples) - 1),
+	color(w * h), depth(w * h), slot(w * h), sampleColor(), sampleDepth(), freeSlots(), nslots(0), splitPixels(0) {
+	clear();
+}
+
+/**
+ * Reset every pixel to black at the far depth, merging all split pixels
+ */
+void MultisampleTarget::clear() {
+	std::fill(color.begin(), color.end(), 0u);
+	std::fill(depth.begin(), depth.end(), -1.0 / 0.0);
+	std::fill(slot.begin(), slot.end(), -1);
+	freeSlots.clear();
+	nslots = 0;
+	splitPixels = 0;
+}
+
+/**
+ * Give a whole pixel a color and depth per sample, copied from its single ones
+ *
+ * @param p the index of the pixel
+ *
+ * @return the slot holding the pixel's samples
+ */
+int MultisampleTarget::split(int p) {
+	int s;
+	if (!freeSlots.empty()) {
+		s = freeSlots.back();
+		freeSlots.pop_back();
+	} else {
+		s = nslots++;
+		if ((size_t)nslots * samples > sampleColor.size()) {
+			sampleColor.resize(std::max((size_t)nslots * samples, sampleColor.size() * 2));
+			sampleDepth.resize(sampleColor.size());
+		}
+	}
+	std::fill(&sampleColor[s * samples], &sampleColor[s * samples] + samples, color[p]);
+	std::fill(&sampleDepth[s * samples], &sampleDepth[s * samples] + samples, depth[p]);
+	slot[p] = s;
+	splitPixels++;
+	return s;
+}
+
+/**
+ * Average the samples of every pixel into an image
+ *
+ * @param image the image to write to; the same size as the target
+ */
+void MultisampleTarget::resolve(TGAImage &image) {
+	image.materialize();
+	int shift = samples == 8 ? 3 : 2;
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			int p = x + y * width;
+			if (slot[p] < 0) {
+				image.put(x, y, TGAColor(color[p], 4));
+				continue;
+			}
+
+			const unsigned int* sc = &sampleColor[slot[p] * samples];
+			unsigned int resolved;
+#ifdef __SSE2__
+			// Widen the channels of 4 samples at a time to 16 bits and sum them in parallel
+			__m128i zero = _mm_setzero_si128();
+			__m128i sum  = _mm_setzero_si128();
+			for (int s = 0; s < samples; s += 4) {
+				__m128i c = _mm_loadu_si128((const __m128i*)(sc + s));
+				sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(c, zero));
+				sum = _mm_add_epi16(sum, _mm_unpackhi_epi8(c, zero));
+			}
+			sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+			sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(1 << (shift - 1))), shift);
+			resolved = _mm_cvtsi128_si32(_mm_packus_epi16(sum, zero));
+#else
+			unsigned int sum[4] = {0, 0, 0, 0};
+			for (int s = 0; s < samples; s++) {
+				for (int k = 0; k < 4; k++) sum[k] += (sc[s] >> (8 * k)) & 0xff;
+			}
+			resolved = 0;
+			for (int k = 0; k < 4; k++) {
+				resolved |= ((sum[k] + (1 << (shift - 1))) >> shift) << (8 * k);
+			}
+#endif
+			image.put(x, y, TGAColor(resolved, 4));
+		}
+	}
+}
+
+int MultisampleTarget::get_width() {
+	return width;
+}
+
+int MultisampleTarget::get_height() {
+	return height;
+}
+
+int MultisampleTarget::get_samples() {
+	return samples;
+}
+
+/**
+ * Get the number of pixels currently stored with a color and depth per sample
+ */
+int MultisampleTarget::get_split_pixels() {
+	return splitPixels;
+}
+
+/**
+ * Get the memory held by the target's buffers
+ */
+size_t MultisampleTarget::bytes() {
+	return color.capacity() * sizeof(unsigned int) + depth.capacity() * sizeof(float) + slot.capacity() * sizeof(int)
+		+ sampleColor.capacity() * sizeof(unsigned int) + sampleDepth.capacity() * sizeof(float);
+}
+
+/**
+ * Get the position of each sample within a pixel, in [0, 1]
+ */
+const float (*MultisampleTarget::pattern())[2] {
+	return samples == 8 ? PATTERN_8X : PATTERN_4X;
+}
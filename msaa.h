@@ -0,0 +1,249 @@
+#ifndef __MSAA_H__
+#define __MSAA_H__
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "model.h"
+#include "shader.h"
+
+/**
+ * A multisampled color and depth target that stores samples only where they differ. A pixel that
+ * one triangle covers completely keeps a single color and depth; it is only split into a color
+ * and a depth per sample when a triangle covers part of it, and merged back when a later triangle
+ * covers all of it. The split pixels live in a pool of slots, so memory follows the number of edge
+ * pixels rather than the sample count.
+ *
+ * A whole pixel keeps its center depth for all of its samples, so where two triangles intersect
+ * inside a whole pixel the depth test is resolved at the pixel center.
+ */
+class MultisampleTarget {
+private:
+	int width;
+	int height;
+	int samples;
+	unsigned int fullMask;
+	std::vector<unsigned int> color;
+	std::vector<float> depth;
+	std::vector<int> slot;
+	std::vector<unsigned int> sampleColor;
+	std::vector<float> sampleDepth;
+	std::vector<int> freeSlots;
+	int nslots;
+	int splitPixels;
+
+	int split(int p);
+
+	MultisampleTarget(const MultisampleTarget &);
+	MultisampleTarget & operator =(const MultisampleTarget &);
+
+public:
+	MultisampleTarget(int w, int h, int samples);
+	void clear();
+	void resolve(TGAImage &image);
+	int get_width();
+	int get_height();
+	int get_samples();
+	int get_split_pixels();
+	size_t bytes();
+	const float (*pattern())[2];
+
+	/**
+	 * Depth test the samples of a pixel
+	 *
+	 * @param x    the column of the pixel
+	 * @param y    the row of the pixel
+	 * @param mask the samples covered by the fragment
+	 * @param z    the fragment's depth at each sample
+	 *
+	 * @return the covered samples that are nearer than the stored depth
+	 */
+	unsigned int test(int x, int y, unsigned int mask, const float* z) const {
+		int p = x + y * width;
+		unsigned int pass = 0;
+		if (slot[p] < 0) {
+			for (int s = 0; s < samples; s++) {
+				if (z[s] > depth[p]) pass |= 1u << s;
+			}
+		} else {
+			const float* d = &sampleDepth[slot[p] * samples];
+			for (int s = 0; s < samples; s++) {
+				if (z[s] > d[s]) pass |= 1u << s;
+			}
+		}
+		return pass & mask;
+	}
+
+	/**
+	 * Write a fragment's color and depth to some of the samples of a pixel
+	 *
+	 * @param x    the column of the pixel
+	 * @param y    the row of the pixel
+	 * @param mask the samples to write
+	 * @param z    the fragment's depth at each sample
+	 * @param c    the fragment's color
+	 */
+	void write(int x, int y, unsigned int mask, const float* z, const TGAColor &c) {
+		int p = x + y * width;
+		if (mask == fullMask) {
+			// The fragment covers the pixel; store it whole, releasing the pixel's samples
+			if (slot[p] >= 0) {
+				freeSlots.push_back(slot[p]);
+				slot[p] = -1;
+				splitPixels--;
+			}
+			float sum = 0;
+			for (int s = 0; s < samples; s++) sum += z[s];
+			color[p] = c.val;
+			depth[p] = sum / samples;
+			return;
+		}
+
+		int first = slot[p] < 0 ? split(p) : slot[p];
+		unsigned int* sc = &sampleColor[first * samples];
+		float* sd = &sampleDepth[first * samples];
+		for (int s = 0; s < samples; s++) {
+			if (mask & (1u << s)) {
+				sc[s] = c.val;
+				sd[s] = z[s];
+			}
+		}
+	}
+};
+
+/**
+ * Fill a triangle into a multisampled target. Coverage and depth are evaluated at every sample,
+ * but the fragment stage runs once per pixel, at the centroid of the samples that pass.
+ *
+ * @param shader  the shader to run
+ * @param screen  the screen coordinates and depth of the 3 vertices
+ * @param varying the varyings of the 3 vertices
+ * @param target  the target to draw to
+ */
+template <class Shader>
+void rasterize(Shader &shader, const Vec3f* screen, const float (*varying)[Shader::VARYINGS], MultisampleTarget &target) {
+	const int N = Shader::VARYINGS;
+	const int S = target.get_samples();
+	const float (*pattern)[2] = target.pattern();
+	const Vec3f &v0 = screen[0];
+	const Vec3f &v1 = screen[1];
+	const Vec3f &v2 = screen[2];
+
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+	if (area <= 0) return;
+
+	// Find the bounding box for the triangle
+	int x0 = std::max((int)std::floor(std::min(std::min(v0.x, v1.x), v2.x)), 0);
+	int y0 = std::max((int)std::floor(std::min(std::min(v0.y, v1.y), v2.y)), 0);
+	int x1 = std::min((int)std::ceil (std::max(std::max(v0.x, v1.x), v2.x)), target.get_width()  - 1);
+	int y1 = std::min((int)std::ceil (std::max(std::max(v0.y, v1.y), v2.y)), target.get_height() - 1);
+	if (x0 > x1 || y0 > y1) return;
+
+	// Edge steps, and the offset of each sample's barycentric coordinates from the pixel center's
+	float inv = 1.f / area;
+	float px = x0 + .5f;
+	const Vec3f* from[3] = {&v1, &v2, &v0};
+	const Vec3f* to[3]   = {&v2, &v0, &v1};
+	float dx[3], dy[3], l[3], reach[3];
+	float offset[3][16];
+	for (int k = 0; k < 3; k++) {
+		dx[k] = -(to[k]->y - from[k]->y) * inv;
+		dy[k] =  (to[k]->x - from[k]->x) * inv;
+		reach[k] = -1e30f;
+		for (int s = 0; s < S; s++) {
+			offset[k][s] = dx[k] * (pattern[s][0] - .5f) + dy[k] * (pattern[s][1] - .5f);
+			reach[k] = std::max(reach[k], offset[k][s]);
+		}
+	}
+
+	for (int y = y0; y <= y1; y++) {
+		float py = y + .5f;
+		for (int k = 0; k < 3; k++) {
+			l[k] = dy[k] * (py - from[k]->y) + dx[k] * (px - from[k]->x);
+		}
+
+		// Solve for the span of pixels with at least one sample inside each edge
+		int left  = x0;
+		int right = x1;
+		for (int k = 0; k < 3; k++) {
+			float e = l[k] + reach[k];
+			if (dx[k] > 0) {
+				left  = std::max(left,  x0 + (int)std::ceil(-e / dx[k]));
+			} else if (dx[k] < 0) {
+				right = std::min(right, x0 + (int)std::floor(e / -dx[k]));
+			} else if (e < 0) {
+				right = left - 1;
+			}
+		}
+
+		for (int x = left; x <= right; x++) {
+			float b[3];
+			for (int k = 0; k < 3; k++) b[k] = l[k] + dx[k] * (x - x0);
+
+			// Coverage and depth at each sample
+			unsigned int mask = 0;
+			float z[16];
+			for (int s = 0; s < S; s++) {
+				float s0 = b[0] + offset[0][s];
+				float s1 = b[1] + offset[1][s];
+				float s2 = b[2] + offset[2][s];
+				z[s] = s0 * v0.z + s1 * v1.z + s2 * v2.z;
+				if (s0 >= 0 && s1 >= 0 && s2 >= 0) mask |= 1u << s;
+			}
+			if (!mask) continue;
+			mask = target.test(x, y, mask, z);
+			if (!mask) continue;
+
+			// Shade at the centroid of the visible samples, which stays inside the triangle
+			float c[3] = {b[0], b[1], b[2]};
+			float fx = .5f, fy = .5f;
+			if (mask != (1u << S) - 1) {
+				int n = 0;
+				c[0] = c[1] = c[2] = fx = fy = 0;
+				for (int s = 0; s < S; s++) {
+					if (!(mask & (1u << s))) continue;
+					for (int k = 0; k < 3; k++) c[k] += b[k] + offset[k][s];
+					fx += pattern[s][0];
+					fy += pattern[s][1];
+					n++;
+				}
+				for (int k = 0; k < 3; k++) c[k] /= n;
+				fx /= n;
+				fy /= n;
+			}
+
+			float interpolated[N];
+			for (int k = 0; k < N; k++) {
+				interpolated[k] = c[0] * varying[0][k] + c[1] * varying[1][k] + c[2] * varying[2][k];
+			}
+
+			TGAColor color;
+			float zc = c[0] * v0.z + c[1] * v1.z + c[2] * v2.z;
+			if (!shader.fragment(Vec3f(x + fx, y + fy, zc), interpolated, color)) continue;
+			target.write(x, y, mask, z, color);
+		}
+	}
+}
+
+/**
+ * Draw every face of a model with a shader into a multisampled target
+ *
+ * @param model  the model to draw
+ * @param shader the shader to run; its vertex stage should map to an image the size of the target
+ * @param target the target to draw to
+ */
+template <class Shader>
+void renderModel(Model &model, Shader &shader, MultisampleTarget &target) {
+	Vec3f screen[3];
+	float varying[3][Shader::VARYINGS];
+	for (int i = 0; i < model.nfaces(); i++) {
+		for (int j = 0; j < 3; j++) {
+			screen[j] = shader.vertex(i, j, varying[j]);
+		}
+		rasterize(shader, screen, varying, target);
+	}
+}
+
+#endif //__MSAA_H__
@@ -0,0 +1,95 @@
+#include <algorithm>
+#include "order.h"
+#include "model.h"
+
+DepthOrder::DepthOrder() : keys_(), keysTmp_(), order_(), orderTmp_(), depth_(), faces_() {
+}
+
+/**
+ * Sort items by depth, nearest (largest depth) first
+ *
+ * @param depth the depth of each item
+ * @param n     the number of items
+ *
+ * @return the indices of the items in order, valid until the next sort
+ */
+const int* DepthOrder::sort(const float* depth, int n) {
+	keys_.resize(n);
+	keysTmp_.resize(n);
+	order_.resize(n);
+	orderTmp_.resize(n);
+	if (n == 0) return NULL;
+
+	// Quantize so that the nearest item gets the smallest key
+	float lo = *std::min_element(depth, depth + n);
+	float hi = *std::max_element(depth, depth + n);
+	float scale = hi > lo ? 65535.f / (hi - lo) : 0.f;
+	for (int i = 0; i < n; i++) {
+		keys_[i] = (unsigned short)((hi - depth[i]) * scale);
+		order_[i] = i;
+	}
+
+	// Sort by the low byte and then the high byte; each pass is stable
+	for (int shift = 0; shift < 16; shift += 8) {
+		int count[257] = {0};
+		for (int i = 0; i < n; i++) {
+			count[((keys_[i] >> shift) & 0xff) + 1]++;
+		}
+		for (int b = 0; b < 256; b++) {
+			count[b + 1] += count[b];
+		}
+		for (int i = 0; i < n; i++) {
+			int to = count[(keys_[i] >> shift) & 0xff]++;
+			keysTmp_[to] = keys_[i];
+			orderTmp_[to] = order_[i];
+		}
+		keys_.swap(keysTmp_);
+		order_.swap(orderTmp_);
+	}
+	return &order_[0];
+}
+
+/**
+ * Sort the faces of a model by the depth of their nearest vertex
+ *
+ * @return the indices of the faces in order, valid until the next sort
+ */
+const int* DepthOrder::sortFaces(Model &model) {
+	int n = model.nfaces();
+	depth_.resize(n);
+	for (int i = 0; i < n; i++) {
+		const int* face = model.face(i);
+		depth_[i] = std::max(std::max(model.vert(face[0]).z, model.vert(face[1]).z), model.vert(face[2]).z);
+	}
+	return sort(depth_.empty() ? NULL : &depth_[0], n);
+}
+
+/**
+ * Sort runs of consecutive faces by the depth of their nearest vertex, keeping the faces within a
+ * run in file order. Faces that are neighbors in the file are usually neighbors on the mesh, so a
+ * run is a cheap stand-in for a cluster and sorting runs costs a fraction of sorting faces.
+ *
+ * @param clusterSize the number of faces in a run
+ *
+ * @return the indices of the faces in order, valid until the next sort
+ */
+const int* DepthOrder::sortClusters(Model &model, int clusterSize) {
+	int n = model.nfaces();
+	int nclusters = (n + clusterSize - 1) / clusterSize;
+	depth_.assign(nclusters, -1.0 / 0.0);
+	for (int i = 0; i < n; i++) {
+		const int* face = model.face(i);
+		float z = std::max(std::max(model.vert(face[0]).z, model.vert(face[1]).z), model.vert(face[2]).z);
+		depth_[i / clusterSize] = std::max(depth_[i / clusterSize], z);
+	}
+
+	const int* clusters = sort(depth_.empty() ? NULL : &depth_[0], nclusters);
+	faces_.resize(n);
+	int k = 0;
+	for (int c = 0; c < nclusters; c++) {
+		for (int i = clusters[c] * clusterSize; i < std::min(n, (clusters[c] + 1) * clusterSize); i++) {
+			faces_[k++] = i;
+		}
+	}
+	return faces_.empty() ? NULL : &faces_[0];
+}
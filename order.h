@@ -0,0 +1,54 @@
+#ifndef __ORDER_H__
+#define __ORDER_H__
+
+#include <vector>
+#include "geometry.h"
+#include "tgaimage.h"
+
+class Model;
+
+/**
+ * Sorts items front to back by their view depth, so near geometry fills the z-buffer first and the
+ * fragments behind it fail the depth test before they are shaded. Depths are quantized to 16 bits
+ * and sorted with two passes of an 8-bit radix sort, which is linear in the number of items; the
+ * buffers are kept between frames.
+ */
+class DepthOrder {
+private:
+	std::vector<unsigned short> keys_;
+	std::vector<unsigned short> keysTmp_;
+	std::vector<int> order_;
+	std::vector<int> orderTmp_;
+	std::vector<float> depth_;
+	std::vector<int> faces_;
+
+public:
+	DepthOrder();
+	const int* sort(const float* depth, int n);
+	const int* sortFaces(Model &model);
+	const int* sortClusters(Model &model, int clusterSize);
+};
+
+/**
+ * Wraps a shader to count the fragments it shades
+ */
+template <class Shader> struct CountingShader {
+	static const int VARYINGS = Shader::VARYINGS;
+
+	Shader &shader;
+	long fragments;
+
+	CountingShader(Shader &s) : shader(s), fragments(0) {
+	}
+
+	Vec3f vertex(int iface, int nvert, float* varying) {
+		return shader.vertex(iface, nvert, varying);
+	}
+
+	bool fragment(const Vec3f &frag, const float* varying, TGAColor &color) {
+		fragments++;
+		return shader.fragment(frag, varying, color);
+	}
+};
+
+#endif //__ORDER_H__
@@ -0,0 +1,109 @@
+#include <chrono>
+#include "pipeline.h"
+
+static double elapsed(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+Model* loadModel(const char *objectFile, const char *textureFile, PipelineStats &stats) {
+	auto start = std::chrono::steady_clock::now();
+
+	TGAImage texture;
+	std::thread decoder([&] {
+		auto begin = std::chrono::steady_clock::now();
+		texture.read_tga_file(textureFile, true);
+		stats.decode = elapsed(begin);
+	});
+
+	auto begin = std::chrono::steady_clock::now();
+	Model* model = new Model(objectFile);
+	stats.parse = elapsed(begin);
+
+	decoder.join();
+	// A model whose faces name materials draws from an atlas of their textures instead
+	if (!model->packMaterials()) {
+		model->setTexture(texture);
+	}
+	stats.load = elapsed(start);
+	return model;
+}
+
+/**
+ * Start the writer thread
+ *
+ * @param width  the width of the frames
+ * @param height the height of the frames
+ * @param bpp    the bytes per pixel of the frames
+ * @param depth  the number of frames that may be in flight at once
+ */
+FrameWriter::FrameWriter(int width, int height, int bpp, int depth) :
+	images_(), free_(depth), pending_(depth), worker_(), encode_(0), stalled_(0), finished_(false) {
+	for (int i = 0; i < depth; i++) {
+		images_.push_back(new TGAImage(width, height, bpp));
+		free_.push(images_.back());
+	}
+	worker_ = std::thread(&FrameWriter::run, this);
+}
+
+FrameWriter::~FrameWriter() {
+	PipelineStats stats;
+	finish(stats);
+	for (int i = 0; i < (int)images_.size(); i++) {
+		delete images_[i];
+	}
+}
+
+/**
+ * Get a cleared image to render the next frame into, waiting for the writer if every image is in flight
+ */
+TGAImage* FrameWriter::acquire() {
+	auto start = std::chrono::steady_clock::now();
+	TGAImage* image = NULL;
+	free_.pop(image);
+	stalled_ += elapsed(start);
+
+	image->clearRect(Rect(0, 0, image->get_width(), image->get_height()));
+	return image;
+}
+
+/**
+ * Queue a rendered frame to be written
+ *
+ * @param image    an image returned by acquire()
+ * @param filename the path to write the frame to
+ */
+void FrameWriter::submit(TGAImage* image, const std::string &filename) {
+	Job job;
+	job.image    = image;
+	job.filename = filename;
+	pending_.push(job);
+}
+
+/**
+ * Write every queued frame and stop the writer thread
+ *
+ * @param stats receives the time spent encoding and the time the renderer spent waiting
+ */
+void FrameWriter::finish(PipelineStats &stats) {
+	if (!finished_) {
+		pending_.close();
+		worker_.join();
+		finished_ = true;
+	}
+	stats.encode  = encode_;
+	stats.stalled = stalled_;
+}
+
+/**
+ * The writer thread: encode and write frames until the queue is closed, handing each image
+ * back to the renderer once it is on disk
+ */
+void FrameWriter::run() {
+	Job job;
+	while (pending_.pop(job)) {
+		auto start = std::chrono::steady_clock::now();
+		job.image->view().flipVertically().write_tga_file(job.filename.c_str());
+		encode_ += elapsed(start);
+		free_.push(job.image);
+	}
+}
@@ -0,0 +1,132 @@
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "tgaimage.h"
+#include "model.h"
+
+/**
+ * A first-in first-out queue shared between threads. push() blocks while the queue is full, which
+ * holds back a producer that runs ahead of its consumer.
+ */
+template <class T> class BoundedQueue {
+private:
+	std::deque<T> items_;
+	size_t capacity_;
+	bool closed_;
+	std::mutex mutex_;
+	std::condition_variable notEmpty_;
+	std::condition_variable notFull_;
+
+public:
+	BoundedQueue(size_t capacity) : items_(), capacity_(capacity), closed_(false) {
+	}
+
+	/**
+	 * Add an item, waiting for room if the queue is full
+	 *
+	 * @return false if the queue was closed
+	 */
+	bool push(const T &item) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		notFull_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+		if (closed_) return false;
+		items_.push_back(item);
+		notEmpty_.notify_one();
+		return true;
+	}
+
+	/**
+	 * Remove the oldest item, waiting for one if the queue is empty
+	 *
+	 * @return false if the queue was closed and drained
+	 */
+	bool pop(T &item) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		notEmpty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+		if (items_.empty()) return false;
+		item = items_.front();
+		items_.pop_front();
+		notFull_.notify_one();
+		return true;
+	}
+
+	/**
+	 * Refuse new items and wake every waiting thread; items already queued can still be popped
+	 */
+	void close() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		closed_ = true;
+		notEmpty_.notify_all();
+		notFull_.notify_all();
+	}
+};
+
+/**
+ * Time spent in each stage of a pipelined run, in milliseconds
+ */
+struct PipelineStats {
+	double decode;
+	double parse;
+	double load;
+	double render;
+	double encode;
+	double stalled;
+
+	PipelineStats() : decode(0), parse(0), load(0), render(0), encode(0), stalled(0) {
+	}
+};
+
+/**
+ * Load a model and its texture at the same time: the TGA file is decoded on a second thread
+ * while the OBJ file is parsed on this one
+ *
+ * @param objectFile  the path of the OBJ file
+ * @param textureFile the path of the TGA file; replaced by an atlas of the materials' textures when
+ *                    the faces of the model name materials
+ * @param stats       receives the time taken by each half and by the whole load
+ *
+ * @return the loaded model, owned by the caller
+ */
+Model* loadModel(const char *objectFile, const char *textureFile, PipelineStats &stats);
+
+/**
+ * Writes finished frames to TGA files on a background thread, so the next frame can be rendered
+ * while the last one is RLE-encoded and written. A fixed set of images circulates between
+ * the renderer and the writer, which caps the memory in flight and makes the renderer wait when
+ * the writer falls behind.
+ */
+class FrameWriter {
+private:
+	struct Job {
+		TGAImage*   image;
+		std::string filename;
+	};
+
+	std::vector<TGAImage*>  images_;
+	BoundedQueue<TGAImage*> free_;
+	BoundedQueue<Job>       pending_;
+	std::thread             worker_;
+	double                  encode_;
+	double                  stalled_;
+	bool                    finished_;
+
+	void run();
+
+	FrameWriter(const FrameWriter &);
+	FrameWriter & operator =(const FrameWriter &);
+
+public:
+	FrameWriter(int width, int height, int bpp, int depth);
+	~FrameWriter();
+	TGAImage* acquire();
+	void submit(TGAImage* image, const std::string &filename);
+	void finish(PipelineStats &stats);
+};
+
+#endif //__PIPELINE_H__
@@ -0,0 +1,179 @@
+#include <cmath>
+#include <algorithm>
+#include "quantized.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+QuantizedMesh::QuantizedMesh() : nverts_(0), nfaces_(0), origin_(), scale_(), uvOrigin_(), uvScale_(),
+	positions_(), normals_(), uv_(), meshlets_(), narrow_(), wide_() {
+}
+
+/**
+ * Quantize a triangle mesh
+ *
+ * @param verts the positions
+ * @param norms the normals
+ * @param uv    the texture coordinates
+ * @param faces the position, texture coordinate and normal indices of each corner of each face;
+ *              every face must be a triangle
+ */
+QuantizedMesh::QuantizedMesh(const std::vector<Vec3f> &verts, const std::vector<Vec3f> &norms, const std::vector<Vec2f> &uv,
+	const std::vector<std::vector<Vec3i> > &faces) : QuantizedMesh() {
+	nverts_ = verts.size();
+	nfaces_ = faces.size();
+
+	// Positions, as fractions of the bounding box. A spare value at the end lets vert() load four
+	// values at once for the last vertex.
+	Vec3f lo = verts.empty() ? Vec3f() : verts[0];
+	Vec3f hi = lo;
+	for (size_t i = 0; i < verts.size(); i++) {
+		Vec3f v = verts[i];
+		for (int j = 0; j < 3; j++) {
+			lo[j] = std::min(lo[j], v[j]);
+			hi[j] = std::max(hi[j], v[j]);
+		}
+	}
+	origin_ = lo;
+	scale_  = Vec3f((hi.x - lo.x) / 65535.f, (hi.y - lo.y) / 65535.f, (hi.z - lo.z) / 65535.f);
+	positions_.reserve(verts.size() * 3 + 1);
+	for (size_t i = 0; i < verts.size(); i++) {
+		const Vec3f &v = verts[i];
+		positions_.push_back(scale_.x > 0 ? (unsigned short)((v.x - lo.x) / scale_.x + .5f) : 0);
+		positions_.push_back(scale_.y > 0 ? (unsigned short)((v.y - lo.y) / scale_.y + .5f) : 0);
+		positions_.push_back(scale_.z > 0 ? (unsigned short)((v.z - lo.z) / scale_.z + .5f) : 0);
+	}
+	positions_.push_back(0);
+
+	normals_.reserve(norms.size());
+	for (size_t i = 0; i < norms.size(); i++) {
+		normals_.push_back(encodeNormal(norms[i]));
+	}
+
+	// Texture coordinates, as fractions of their bounding box
+	Vec2f uvLo = uv.empty() ? Vec2f() : uv[0];
+	Vec2f uvHi = uvLo;
+	for (size_t i = 0; i < uv.size(); i++) {
+		uvLo = Vec2f(std::min(uvLo.x, uv[i].x), std::min(uvLo.y, uv[i].y));
+		uvHi = Vec2f(std::max(uvHi.x, uv[i].x), std::max(uvHi.y, uv[i].y));
+	}
+	uvOrigin_ = uvLo;
+	uvScale_  = Vec2f((uvHi.x - uvLo.x) / 65535.f, (uvHi.y - uvLo.y) / 65535.f);
+	uv_.reserve(uv.size() * 2);
+	for (size_t i = 0; i < uv.size(); i++) {
+		uv_.push_back(uvScale_.x > 0 ? (unsigned short)((uv[i].x - uvLo.x) / uvScale_.x + .5f) : 0);
+		uv_.push_back(uvScale_.y > 0 ? (unsigned short)((uv[i].y - uvLo.y) / uvScale_.y + .5f) : 0);
+	}
+
+	// Corners, a meshlet at a time
+	for (int first = 0; first < nfaces_; first += MESHLET) {
+		int last = std::min(nfaces_, first + MESHLET);
+		Meshlet m;
+		Vec3i c0 = faces[first][0];
+		int top[3] = {c0.x, c0.y, c0.z};
+		for (int a = 0; a < 3; a++) {
+			m.base[a] = top[a];
+		}
+		for (int i = first; i < last; i++) {
+			for (int j = 0; j < 3; j++) {
+				Vec3i c = faces[i][j];
+				for (int a = 0; a < 3; a++) {
+					int idx = a == 0 ? c.x : a == 1 ? c.y : c.z;
+					m.base[a] = std::min(m.base[a], idx);
+					top[a]    = std::max(top[a], idx);
+				}
+			}
+		}
+		m.wide   = top[0] - m.base[0] > 65535 || top[1] - m.base[1] > 65535 || top[2] - m.base[2] > 65535;
+		m.offset = m.wide ? wide_.size() : narrow_.size();
+		for (int i = first; i < last; i++) {
+			for (int j = 0; j < 3; j++) {
+				Vec3i c = faces[i][j];
+				unsigned int d[3] = {(unsigned int)(c.x - m.base[0]), (unsigned int)(c.y - m.base[1]), (unsigned int)(c.z - m.base[2])};
+				for (int a = 0; a < 3; a++) {
+					if (m.wide) wide_.push_back(d[a]);
+					else        narrow_.push_back(d[a]);
+				}
+			}
+		}
+		meshlets_.push_back(m);
+	}
+}
+
+int QuantizedMesh::nverts() const {
+	return nverts_;
+}
+
+int QuantizedMesh::nfaces() const {
+	return nfaces_;
+}
+
+/**
+ * Get a position, dequantized four values at a time
+ */
+Vec3f QuantizedMesh::vert(int i) const {
+#ifdef __SSE2__
+	__m128i q = _mm_loadl_epi64((const __m128i*)&positions_[i * 3]);
+	__m128 v = _mm_cvtepi32_ps(_mm_unpacklo_epi16(q, _mm_setzero_si128()));
+	v = _mm_add_ps(_mm_mul_ps(v, _mm_setr_ps(scale_.x, scale_.y, scale_.z, 0)), _mm_setr_ps(origin_.x, origin_.y, origin_.z, 0));
+	float out[4];
+	_mm_storeu_ps(out, v);
+	return Vec3f(out[0], out[1], out[2]);
+#else
+	const unsigned short* q = &positions_[i * 3];
+	return Vec3f(origin_.x + q[0] * scale_.x, origin_.y + q[1] * scale_.y, origin_.z + q[2] * scale_.z);
+#endif
+}
+
+/**
+ * Get a normal, of unit length
+ */
+Vec3f QuantizedMesh::normal(int i) const {
+	return decodeNormal(normals_[i]);
+}
+
+Vec2f QuantizedMesh::uv(int i) const {
+	return Vec2f(uvOrigin_.x + uv_[i * 2] * uvScale_.x, uvOrigin_.y + uv_[i * 2 + 1] * uvScale_.y);
+}
+
+/**
+ * @return the bytes held by the mesh
+ */
+size_t QuantizedMesh::bytes() const {
+	return sizeof(*this) + positions_.capacity() * sizeof(unsigned short) + normals_.capacity() * sizeof(unsigned int)
+		+ uv_.capacity() * sizeof(unsigned short) + meshlets_.capacity() * sizeof(Meshlet)
+		+ narrow_.capacity() * sizeof(unsigned short) + wide_.capacity() * sizeof(unsigned int);
+}
+
+/**
+ * Encode a normal by projecting it onto an octahedron and unfolding the lower half over the upper
+ * one, which maps the sphere onto a square with little distortion
+ *
+ * @return the x and y of the square as signed 16-bit values in the low and high halves
+ */
+unsigned int QuantizedMesh::encodeNormal(Vec3f n) {
+	float l = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (l == 0) return 0;
+	float x = n.x / l;
+	float y = n.y / l;
+	if (n.z < 0) {
+		float fx = (1 - std::abs(y)) * (x >= 0 ? 1 : -1);
+		float fy = (1 - std::abs(x)) * (y >= 0 ? 1 : -1);
+		x = fx;
+		y = fy;
+	}
+	short qx = (short)std::floor(x * 32767.f + .5f);
+	short qy = (short)std::floor(y * 32767.f + .5f);
+	return (unsigned short)qx | (unsigned int)(unsigned short)qy << 16;
+}
+
+Vec3f QuantizedMesh::decodeNormal(unsigned int e) {
+	float x = (short)(e & 0xffff) / 32767.f;
+	float y = (short)(e >> 16) / 32767.f;
+	float z = 1 - std::abs(x) - std::abs(y);
+	float t = std::max(-z, 0.f);
+	x += x >= 0 ? -t : t;
+	y += y >= 0 ? -t : t;
+	Vec3f n(x, y, z);
+	return n.normalize();
+}
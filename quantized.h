@@ -0,0 +1,68 @@
+#ifndef __QUANTIZED_H__
+#define __QUANTIZED_H__
+
+#include <vector>
+#include "geometry.h"
+
+/**
+ * A triangle mesh in compact form:
+ * - positions are 16-bit fractions of the mesh's bounding box;
+ * - normals are octahedral-encoded into two 16-bit values;
+ * - texture coordinates are 16-bit fractions of their bounding box.
+ *
+ * The corners of the faces are stored in meshlets of MESHLET faces. Each meshlet keeps the smallest
+ * position, texture coordinate and normal index of its corners, and stores the corners as 16-bit
+ * offsets from those. A meshlet whose offsets do not fit in 16 bits stores 32-bit offsets instead.
+ */
+class QuantizedMesh {
+private:
+	struct Meshlet {
+		int base[3];
+		int offset;
+		bool wide;
+	};
+
+	int nverts_;
+	int nfaces_;
+	Vec3f origin_;
+	Vec3f scale_;
+	Vec2f uvOrigin_;
+	Vec2f uvScale_;
+	std::vector<unsigned short> positions_;
+	std::vector<unsigned int> normals_;
+	std::vector<unsigned short> uv_;
+	std::vector<Meshlet> meshlets_;
+	std::vector<unsigned short> narrow_;
+	std::vector<unsigned int> wide_;
+
+public:
+	static const int MESHLET = 64;
+
+	QuantizedMesh();
+	QuantizedMesh(const std::vector<Vec3f> &verts, const std::vector<Vec3f> &norms, const std::vector<Vec2f> &uv,
+		const std::vector<std::vector<Vec3i> > &faces);
+	int nverts() const;
+	int nfaces() const;
+	Vec3f vert(int i) const;
+	Vec3f normal(int i) const;
+	Vec2f uv(int i) const;
+	size_t bytes() const;
+
+	static unsigned int encodeNormal(Vec3f n);
+	static Vec3f decodeNormal(unsigned int e);
+
+	/**
+	 * Get the position, texture coordinate and normal indices of a corner of a face
+	 *
+	 * @param iface the index of the face
+	 * @param nvert the index of the corner within the face
+	 */
+	Vec3i corner(int iface, int nvert) const {
+		const Meshlet &m = meshlets_[iface / MESHLET];
+		int k = m.offset + ((iface % MESHLET) * 3 + nvert) * 3;
+		if (m.wide) return Vec3i(m.base[0] + wide_[k], m.base[1] + wide_[k + 1], m.base[2] + wide_[k + 2]);
+		return Vec3i(m.base[0] + narrow_[k], m.base[1] + narrow_[k + 1], m.base[2] + narrow_[k + 2]);
+	}
+};
+
+#endif //__QUANTIZED_H__
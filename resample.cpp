@@ -0,0 +1,288 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "resample.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * The weights of the source pixels for each output pixel along one axis. Output pixel i is the sum
+ * of source pixels first[i] to first[i] + count[i] - 1, weighted by weights[i * n] onwards.
+ */
+struct Taps {
+	int n;
+	std::vector<int> first;
+	std::vector<int> count;
+	std::vector<float> weights;
+};
+
+/**
+ * @return how far from its center a filter reaches, in source pixels when not shrinking
+ */
+static float filterRadius(Resampler::Filter filter) {
+	switch (filter) {
+	case Resampler::BOX:      return .5f;
+	case Resampler::BILINEAR: return 1.f;
+	default:                  return 3.f;
+	}
+}
+
+/**
+ * @param x the signed distance from the center of the filter
+ *
+ * @return the weight of a source pixel at that distance
+ */
+static float filterWeight(Resampler::Filter filter, float x) {
+	switch (filter) {
+	case Resampler::BOX:
+		return x >= -.5f && x < .5f ? 1.f : 0.f;
+	case Resampler::BILINEAR:
+		return std::max(0.f, 1.f - std::abs(x));
+	default:
+		if (x == 0) return 1.f;
+		if (std::abs(x) >= 3.f) return 0.f;
+		float px = (float)M_PI * x;
+		return 3.f * std::sin(px) * std::sin(px / 3.f) / (px * px);
+	}
+}
+
+/**
+ * Find the weights for resampling one axis. When shrinking, the filter is stretched by the ratio of
+ * the sizes so every source pixel contributes; at the borders the weights inside are renormalized.
+ *
+ * @param srcN the size of the source along the axis
+ * @param dstN the size of the output along the axis
+ */
+static void buildTaps(int srcN, int dstN, Resampler::Filter filter, Taps &taps) {
+	float scale   = srcN / (float)dstN;
+	float fscale  = std::max(1.f, scale);
+	float support = filterRadius(filter) * fscale;
+	taps.n = (int)std::ceil(2 * support) + 1;
+	taps.first.resize(dstN);
+	taps.count.resize(dstN);
+	taps.weights.assign((size_t)dstN * taps.n, 0.f);
+
+	for (int i = 0; i < dstN; i++) {
+		float center = (i + .5f) * scale;
+		// The source pixels whose centers are within the support
+		int lo = std::max(0, (int)std::ceil(center - support - .5f));
+		int hi = std::min(srcN - 1, (int)std::ceil(center + support - .5f) - 1);
+		float* w = &taps.weights[(size_t)i * taps.n];
+		float sum = 0;
+		for (int j = lo; j <= hi && j - lo < taps.n; j++) {
+			w[j - lo] = filterWeight(filter, (j + .5f - center) / fscale);
+			sum += w[j - lo];
+		}
+		if (sum == 0) {
+			// The filter falls between source pixels; take the nearest
+			lo = std::min(srcN - 1, (int)center);
+			hi = lo;
+			w[0] = sum = 1.f;
+		}
+		for (int k = 0; k <= hi - lo && k < taps.n; k++) {
+			w[k] /= sum;
+		}
+		taps.first[i] = lo;
+		taps.count[i] = std::min(hi - lo + 1, taps.n);
+	}
+}
+
+/**
+ * Convert a row of pixels to four-channel floats
+ */
+static void unpackRow(const ImageView &src, int y, float* out) {
+	int bytespp = src.bytespp();
+	const unsigned char* p = src.pixel(0, y);
+	int stride = src.stride();
+	for (int x = 0; x < src.width(); x++, p += stride) {
+		// Each case falls through to the channels below it
+		switch (bytespp) {
+		case 4:  out[4 * x + 3] = p[3];
+		case 3:  out[4 * x + 2] = p[2];
+		         out[4 * x + 1] = p[1];
+		default: out[4 * x]     = p[0];
+		}
+	}
+}
+
+/**
+ * Filter a row of four-channel float pixels along x
+ */
+static void filterRow(const float* in, float* out, const Taps &taps, int dstW) {
+	for (int x = 0; x < dstW; x++) {
+		const float* w = &taps.weights[(size_t)x * taps.n];
+		const float* p = in + taps.first[x] * 4;
+#ifdef __SSE2__
+		__m128 sum = _mm_setzero_ps();
+		for (int k = 0; k < taps.count[x]; k++) {
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w[k]), _mm_loadu_ps(p + 4 * k)));
+		}
+		_mm_storeu_ps(out + 4 * x, sum);
+#else
+		float sum[4] = {0, 0, 0, 0};
+		for (int k = 0; k < taps.count[x]; k++) {
+			for (int c = 0; c < 4; c++) sum[c] += w[k] * p[4 * k + c];
+		}
+		memcpy(out + 4 * x, sum, sizeof(sum));
+#endif
+	}
+}
+
+/**
+ * Add a weighted row of floats to a sum
+ */
+static void accumulateRow(float* sum, const float* row, float w, int n) {
+	int i = 0;
+#ifdef __SSE2__
+	__m128 ww = _mm_set1_ps(w);
+	for (; i + 4 <= n; i += 4) {
+		_mm_storeu_ps(sum + i, _mm_add_ps(_mm_loadu_ps(sum + i), _mm_mul_ps(ww, _mm_loadu_ps(row + i))));
+	}
+#endif
+	for (; i < n; i++) {
+		sum[i] += w * row[i];
+	}
+}
+
+/**
+ * Round a row of four-channel float pixels to bytes, clamping the overshoot of negative lobes
+ */
+static void packRow(const float* in, const ImageView &dst, int y) {
+	int bytespp = dst.bytespp();
+	int stride  = dst.stride();
+	unsigned char* p = dst.pixel(0, y);
+	for (int x = 0; x < dst.width(); x++, p += stride) {
+		unsigned char c[4];
+#ifdef __SSE2__
+		__m128i v = _mm_cvtps_epi32(_mm_loadu_ps(in + 4 * x));
+		v = _mm_packs_epi32(v, v);
+		v = _mm_packus_epi16(v, v);
+		*(int*)c = _mm_cvtsi128_si32(v);
+#else
+		for (int k = 0; k < 4; k++) {
+			c[k] = (unsigned char)std::min(255.f, std::max(0.f, std::floor(in[4 * x + k] + .5f)));
+		}
+#endif
+		// Each case falls through to the channels below it
+		switch (bytespp) {
+		case 4:  p[3] = c[3];
+		case 3:  p[2] = c[2];
+		         p[1] = c[1];
+		default: p[0] = c[0];
+		}
+	}
+}
+
+bool Resampler::resample(const ImageView &src, const ImageView &dst, Filter filter, ThreadPool &pool) {
+	return resample(src, std::vector<ImageView>(1, dst), filter, pool);
+}
+
+/**
+ * Resample an image to one or more sizes. The source is read once, in bands of rows: each band
+ * task converts its rows to floats and filters them along x for every output while they are in
+ * cache, then filters the output rows that start in the band along y. A band also filters the
+ * few rows past its end that its last output rows reach, so bands never wait on each other.
+ *
+ * @param src    the image to resample
+ * @param dst    the images to write, each with its own size and the bytes per pixel of the source
+ * @param filter the filter to resample with
+ * @param pool   the threads to run on
+ *
+ * @return false if the images are empty or do not have the same bytes per pixel
+ */
+bool Resampler::resample(const ImageView &src, const std::vector<ImageView> &dst, Filter filter, ThreadPool &pool) {
+	int bytespp = src.bytespp();
+	if (src.width() <= 0 || src.height() <= 0 || bytespp > 4) return false;
+	for (size_t k = 0; k < dst.size(); k++) {
+		if (dst[k].width() <= 0 || dst[k].height() <= 0 || dst[k].bytespp() != bytespp) return false;
+	}
+
+	std::vector<Taps> tapsX(dst.size());
+	std::vector<Taps> tapsY(dst.size());
+	int maxTaps = 0;
+	for (size_t k = 0; k < dst.size(); k++) {
+		buildTaps(src.width(), dst[k].width(), filter, tapsX[k]);
+		buildTaps(src.height(), dst[k].height(), filter, tapsY[k]);
+		maxTaps = std::max(maxTaps, tapsY[k].n);
+	}
+
+	// Find the output rows whose first source row falls in each band. Bands are a few times the
+	// height of the tallest filter, so the rows filtered twice are a small part of each band.
+	const int BAND = std::max(64, 4 * maxTaps);
+	int nbands = (src.height() + BAND - 1) / BAND;
+	std::vector<std::vector<int> > bandRows(dst.size());
+	for (size_t k = 0; k < dst.size(); k++) {
+		bandRows[k].assign(nbands + 1, 0);
+		for (int y = 0; y < dst[k].height(); y++) {
+			bandRows[k][tapsY[k].first[y] / BAND + 1]++;
+		}
+		for (int b = 0; b < nbands; b++) {
+			bandRows[k][b + 1] += bandRows[k][b];
+		}
+	}
+
+	pool.parallelFor(0, nbands, 1, [&](int lo, int hi) {
+		std::vector<float> row(src.width() * 4, 0.f);
+		std::vector<std::vector<float> > rows(dst.size());
+		std::vector<float> sum;
+		for (int b = lo; b < hi; b++) {
+			// The source rows each output reads for its rows in this band
+			int y0 = b * BAND;
+			int y1 = y0;
+			std::vector<int> end(dst.size(), y0);
+			for (size_t k = 0; k < dst.size(); k++) {
+				const Taps &taps = tapsY[k];
+				for (int y = bandRows[k][b]; y < bandRows[k][b + 1]; y++) {
+					end[k] = std::max(end[k], taps.first[y] + taps.count[y]);
+				}
+				rows[k].resize((size_t)(end[k] - y0) * dst[k].width() * 4);
+				y1 = std::max(y1, end[k]);
+			}
+
+			// Filter along x
+			for (int y = y0; y < y1; y++) {
+				unpackRow(src, y, &row[0]);
+				for (size_t k = 0; k < dst.size(); k++) {
+					if (y >= end[k]) continue;
+					filterRow(&row[0], &rows[k][(size_t)(y - y0) * dst[k].width() * 4], tapsX[k], dst[k].width());
+				}
+			}
+
+			// Filter along y
+			for (size_t k = 0; k < dst.size(); k++) {
+				const Taps &taps = tapsY[k];
+				int n = dst[k].width() * 4;
+				sum.resize(n);
+				for (int y = bandRows[k][b]; y < bandRows[k][b + 1]; y++) {
+					std::fill(sum.begin(), sum.end(), 0.f);
+					const float* w = &taps.weights[(size_t)y * taps.n];
+					for (int j = 0; j < taps.count[y]; j++) {
+						accumulateRow(&sum[0], &rows[k][(size_t)(taps.first[y] + j - y0) * n], w[j], n);
+					}
+					packRow(&sum[0], dst[k], y);
+				}
+			}
+		}
+	});
+	return true;
+}
+
+/**
+ * @param name   box, bilinear or lanczos
+ * @param filter set to the filter named
+ *
+ * @return false if the name is not a filter
+ */
+bool Resampler::parseFilter(const char *name, Filter &filter) {
+	if (!strcmp(name, "box")) {
+		filter = BOX;
+	} else if (!strcmp(name, "bilinear")) {
+		filter = BILINEAR;
+	} else if (!strcmp(name, "lanczos")) {
+		filter = LANCZOS;
+	} else {
+		return false;
+	}
+	return true;
+}
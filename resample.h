@@ -0,0 +1,25 @@
+#ifndef __RESAMPLE_H__
+#define __RESAMPLE_H__
+
+#include <vector>
+#include "tgaimage.h"
+#include "threadpool.h"
+
+/**
+ * Resamples images with separable filters: each source row is filtered horizontally into a buffer
+ * of floats, then each output row is filtered vertically from the buffered rows. Both passes run
+ * across rows on a thread pool, with four channels of a pixel in one SSE register. Several output
+ * sizes can be made from a single read of the source.
+ */
+class Resampler {
+public:
+	enum Filter {
+		BOX, BILINEAR, LANCZOS
+	};
+
+	static bool resample(const ImageView &src, const ImageView &dst, Filter filter, ThreadPool &pool);
+	static bool resample(const ImageView &src, const std::vector<ImageView> &dst, Filter filter, ThreadPool &pool);
+	static bool parseFilter(const char *name, Filter &filter);
+};
+
+#endif //__RESAMPLE_H__
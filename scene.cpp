@@ -0,0 +1,274 @@
+#include <algorithm>
+#include "scene.h"
+
+Scene::Scene() : objects_(), nodes_(), moved_(), stack_(), built_(false), visited_(0) {
+}
+
+/**
+ * Place a model in the scene. The model is not copied and must outlive the scene.
+ *
+ * @param model    the model to place
+ * @param instance the transform and tint of the placement
+ *
+ * @return the id of the new object
+ */
+int Scene::add(Model &model, const Instance &instance) {
+	Object o;
+	o.model    = &model;
+	o.instance = instance;
+	o.bounds   = instanceBounds(model, instance);
+	o.leaf     = -1;
+	objects_.push_back(o);
+
+	// The hierarchy has to be rebuilt to include the new object
+	built_ = false;
+	return (int)objects_.size() - 1;
+}
+
+/**
+ * Change the transform of an object. The hierarchy is refitted on the next query rather than rebuilt.
+ *
+ * @param id       the id of the object to move
+ * @param instance the new transform and tint of the object
+ */
+void Scene::move(int id, const Instance &instance) {
+	Object &o = objects_[id];
+	o.instance = instance;
+	o.bounds   = instanceBounds(*o.model, instance);
+	if (built_) {
+		moved_.push_back(id);
+	}
+}
+
+const Instance &Scene::instance(int id) {
+	return objects_[id].instance;
+}
+
+int Scene::nobjects() {
+	return (int)objects_.size();
+}
+
+/**
+ * Get the world-space bounding box of one object
+ *
+ * @param id the id of the object
+ */
+AABB Scene::objectBounds(int id) {
+	return objects_[id].bounds;
+}
+
+/**
+ * Get the bounding box of the whole scene
+ */
+AABB Scene::bounds() {
+	if (!built_) build();
+	refit();
+	return nodes_.empty() ? AABB() : nodes_[0].bounds;
+}
+
+/**
+ * Build the hierarchy from scratch by recursively splitting the objects at the median of the longest axis
+ */
+void Scene::build() {
+	nodes_.clear();
+	moved_.clear();
+	nodes_.reserve(std::max(0, 2 * nobjects() - 1));
+
+	std::vector<int> order(objects_.size());
+	for (int i = 0; i < nobjects(); i++) {
+		order[i] = i;
+	}
+	if (!order.empty()) {
+		buildRange(order, 0, (int)order.size(), -1);
+	}
+	built_ = true;
+}
+
+/**
+ * Build the subtree for a range of objects
+ *
+ * @param order  the object ids, partially sorted in place
+ * @param begin  the first object in the range
+ * @param end    one past the last object in the range
+ * @param parent the parent of the new subtree
+ *
+ * @return the index of the root of the new subtree
+ */
+int Scene::buildRange(std::vector<int> &order, int begin, int end, int parent) {
+	int index = (int)nodes_.size();
+	nodes_.push_back(Node());
+	Node &n = nodes_[index];
+	n.parent = parent;
+	n.left   = -1;
+	n.right  = -1;
+	n.object = -1;
+
+	// Leaves hold exactly one object
+	if (end - begin == 1) {
+		n.object = order[begin];
+		n.bounds = objects_[n.object].bounds;
+		objects_[n.object].leaf = index;
+		return index;
+	}
+
+	// Split along the longest axis of the box around the object centers
+	AABB centers;
+	for (int i = begin; i < end; i++) {
+		Vec3f c = objects_[order[i]].bounds.center();
+		centers.expand(AABB(c, c));
+	}
+	Vec3f extent = centers.hi - centers.lo;
+	int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+	int mid = (begin + end) / 2;
+	std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, [&](int a, int b) {
+		return objects_[a].bounds.center()[axis] < objects_[b].bounds.center()[axis];
+	});
+
+	// Children are always stored after their parent; refer to the node by index since nodes_ may grow
+	int left  = buildRange(order, begin, mid, index);
+	int right = buildRange(order, mid, end, index);
+	nodes_[index].left   = left;
+	nodes_[index].right  = right;
+	nodes_[index].bounds = nodes_[left].bounds;
+	nodes_[index].bounds.expand(nodes_[right].bounds);
+	return index;
+}
+
+/**
+ * Update the bounds of the nodes above every object that moved since the last refit. Each walk
+ * towards the root stops as soon as a node's bounds are unchanged.
+ */
+void Scene::refit() {
+	for (int k = 0; k < (int)moved_.size(); k++) {
+		int node = objects_[moved_[k]].leaf;
+		nodes_[node].bounds = objects_[moved_[k]].bounds;
+
+		for (node = nodes_[node].parent; node >= 0; node = nodes_[node].parent) {
+			Node &n = nodes_[node];
+			AABB b = nodes_[n.left].bounds;
+			b.expand(nodes_[n.right].bounds);
+			if (b == n.bounds) break;
+			n.bounds = b;
+		}
+	}
+	moved_.clear();
+}
+
+/**
+ * Find the objects that overlap a view
+ *
+ * @param view    the region of the xy-plane that is drawn
+ * @param visible filled with the ids of the objects that overlap the view
+ */
+void Scene::collect(const ViewWindow &view, std::vector<int> &visible) {
+	visible.resize(objects_.size());
+	visible.resize(collect(view, visible.empty() ? NULL : &visible[0]));
+}
+
+/**
+ * Find the objects that overlap a view
+ *
+ * @param view    the region of the xy-plane that is drawn
+ * @param visible filled with the ids of the objects that overlap the view; room for nobjects() ids
+ *
+ * @return the number of objects found
+ */
+int Scene::collect(const ViewWindow &view, int* visible) {
+	int count = 0;
+	visited_ = 0;
+	if (!built_) build();
+	refit();
+	if (nodes_.empty()) return 0;
+
+	stack_.clear();
+	stack_.push_back(0);
+	while (!stack_.empty()) {
+		int node = stack_.back();
+		stack_.pop_back();
+		visited_++;
+
+		const Node &n = nodes_[node];
+		if (!view.overlaps(n.bounds)) continue;
+
+		// Everything below a node that is completely inside the view is visible
+		if (view.contains(n.bounds)) {
+			collectSubtree(node, visible, count);
+		} else if (n.object >= 0) {
+			visible[count++] = n.object;
+		} else {
+			stack_.push_back(n.right);
+			stack_.push_back(n.left);
+		}
+	}
+	return count;
+}
+
+/**
+ * Add every object below a node without testing its bounds
+ *
+ * @param node    the root of the subtree
+ * @param visible the list to add the object ids to
+ * @param count   the number of ids in the list; updated
+ */
+void Scene::collectSubtree(int node, int* visible, int &count) {
+	const Node &n = nodes_[node];
+	if (n.object >= 0) {
+		visible[count++] = n.object;
+	} else {
+		collectSubtree(n.left, visible, count);
+		collectSubtree(n.right, visible, count);
+	}
+}
+
+/**
+ * Draw the objects that overlap a view
+ *
+ * @param image   the image to draw to
+ * @param context the frame whose arena holds the transient data of the draw
+ * @param view    the region of the xy-plane that is drawn
+ *
+ * @return the number of objects drawn
+ */
+int Scene::render(TGAImage &image, RenderContext &context, const ViewWindow &view) {
+	return render(image, context, view, view);
+}
+
+/**
+ * Draw the objects that overlap part of a view
+ *
+ * @param image   the image to draw to
+ * @param context the frame whose arena holds the transient data of the draw
+ * @param view    the region of the xy-plane that is mapped onto the image
+ * @param cull    the region of the xy-plane that objects must overlap to be drawn
+ *
+ * @return the number of objects drawn
+ */
+int Scene::render(TGAImage &image, RenderContext &context, const ViewWindow &view, const ViewWindow &cull) {
+	Arena &arena = context.frame;
+	int* visible = arena.allocate<int>(objects_.size());
+	int count = collect(cull, visible);
+
+	// Size the vertex scratch space for the largest visible model
+	int nverts = 0;
+	for (int k = 0; k < count; k++) {
+		nverts = std::max(nverts, objects_[visible[k]].model->nverts());
+	}
+	Vec3f* scratch = arena.allocate<Vec3f>(nverts);
+	TriangleBatch* batch = new (arena.allocate(sizeof(TriangleBatch), alignof(TriangleBatch))) TriangleBatch();
+
+	for (int k = 0; k < count; k++) {
+		const Object &o = objects_[visible[k]];
+		renderInstance(*o.model, o.instance, NULL, scratch, view, image, *batch);
+	}
+	batch->flush(image);
+
+	return count;
+}
+
+/**
+ * Get the number of hierarchy nodes tested by the last query
+ */
+int Scene::nodesVisited() {
+	return visited_;
+}
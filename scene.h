@@ -0,0 +1,62 @@
+#ifndef __SCENE_H__
+#define __SCENE_H__
+
+#include <vector>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "model.h"
+#include "instance.h"
+#include "arena.h"
+
+/**
+ * A collection of placed models, organized in a bounding volume hierarchy so that drawing a view
+ * only touches the parts of the scene that overlap it
+ */
+class Scene {
+private:
+	struct Object {
+		Model*   model;
+		Instance instance;
+		AABB     bounds;
+		int      leaf;
+	};
+
+	struct Node {
+		AABB bounds;
+		int  parent;
+		int  left;
+		int  right;
+		int  object; // -1 for internal nodes
+	};
+
+	std::vector<Object> objects_;
+	std::vector<Node>   nodes_;
+	std::vector<int>    moved_;
+	std::vector<int>    stack_;
+	bool                built_;
+	int                 visited_;
+
+	int  buildRange(std::vector<int> &order, int begin, int end, int parent);
+	int  collect(const ViewWindow &view, int* visible);
+	void collectSubtree(int node, int* visible, int &count);
+
+	Scene(const Scene &);
+	Scene & operator =(const Scene &);
+
+public:
+	Scene();
+	int add(Model &model, const Instance &instance);
+	void move(int id, const Instance &instance);
+	const Instance &instance(int id);
+	int nobjects();
+	AABB objectBounds(int id);
+	AABB bounds();
+	void build();
+	void refit();
+	void collect(const ViewWindow &view, std::vector<int> &visible);
+	int render(TGAImage &image, RenderContext &context, const ViewWindow &view = ViewWindow());
+	int render(TGAImage &image, RenderContext &context, const ViewWindow &view, const ViewWindow &cull);
+	int nodesVisited();
+};
+
+#endif //__SCENE_H__
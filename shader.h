@@ -0,0 +1,552 @@
+#ifndef __SHADER_H__
+#define __SHADER_H__
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "model.h"
+#include "shadow.h"
+#include "threadpool.h"
+#include "color.h"
+
+/*
+ * A shader is a plain struct with a fixed number of varyings and two stages:
+ *
+ *   static const int VARYINGS;
+ *   Vec3f vertex(int iface, int nvert, float* varying);
+ *   bool  fragment(const Vec3f &frag, const float* varying, TGAColor &color);
+ *
+ * The vertex stage returns the screen coordinates (in pixels) and depth of a face's vertex and
+ * fills in its varyings. The fragment stage receives the pixel center and depth of a fragment and
+ * its interpolated varyings, and returns false to discard it.
+ *
+ * The rasterizer is a template over the shader, so both stages are inlined into its loops and a
+ * new shading model costs nothing more than its own arithmetic.
+ */
+
+/**
+ * Map a point in the default view [-1, 1] x [-1, 1] onto an image
+ *
+ * @param v     the point to map
+ * @param image the image being drawn to
+ */
+inline Vec3f toScreen(const Vec3f &v, TGAImage &image) {
+	return Vec3f((v.x + 1.) * image.get_width() / 2., (v.y + 1.) * image.get_height() / 2., v.z);
+}
+
+/**
+ * The end of the fragment stage for most shaders: run the shader's fragment stage on each fragment
+ * and write the color it returns
+ */
+template <class Shader> struct ShadedOutput {
+	Shader &shader;
+	TGAImage &image;
+
+	ShadedOutput(Shader &s, TGAImage &i) : shader(s), image(i) {
+	}
+
+	bool write(int x, int y, float z, const float* varying) {
+		TGAColor color;
+		if (!shader.fragment(Vec3f(x + .5f, y + .5f, z), varying, color)) return false;
+		image.put(x, y, color);
+		return true;
+	}
+
+	void endRow() {
+	}
+};
+
+template <class Shader> struct Packed;
+
+/**
+ * The end of the fragment stage for a Packed shader: queue the texel and intensity of each fragment
+ * of a row, then light the queue a span at a time with PackedColor and write it
+ */
+template <class Shader> struct PackedOutput {
+	static const int SPAN = 64;
+
+	Shader &shader;
+	TGAImage &image;
+	bool gamma;
+	int y;
+	int n;
+	int xs[SPAN];
+	unsigned int texels[SPAN];
+	unsigned short k[SPAN];
+
+	PackedOutput(Packed<Shader> &p, TGAImage &i) : shader(p.shader), image(i), gamma(p.gamma), y(0), n(0) {
+	}
+
+	bool write(int x, int row, float, const float* varying) {
+		if (n == SPAN) endRow();
+		y = row;
+		xs[n] = x;
+		texels[n] = shader.texel(varying);
+		k[n] = PackedColor::toFixed(shader.intensity(varying));
+		n++;
+		return true;
+	}
+
+	void endRow() {
+		if (gamma) {
+			PackedColor::scaleLinear(texels, k, texels, n);
+		} else {
+			PackedColor::scale(texels, k, texels, n);
+		}
+		int bytespp = image.get_bytespp();
+		for (int i = 0; i < n; i++) {
+			memcpy(image.pixel(xs[i], y), &texels[i], bytespp);
+		}
+		n = 0;
+	}
+};
+
+/**
+ * Picks the end of the fragment stage for a shader
+ */
+template <class Shader> struct FragmentOutput {
+	typedef ShadedOutput<Shader> type;
+};
+
+template <class Shader> struct FragmentOutput<Packed<Shader> > {
+	typedef PackedOutput<Shader> type;
+};
+
+/**
+ * Fill a triangle within a rectangle of the image. The bounding box is clamped to the rectangle
+ * once, so the pixel loops write without bounds checks. When PERSPECTIVE is set the varyings are
+ * interpolated linearly in 1/w rather than on screen.
+ *
+ * @param invW 1/w of the 3 vertices; only read when PERSPECTIVE is set
+ */
+template <bool PERSPECTIVE, class Shader>
+void rasterizeTriangle(Shader &shader, const Vec3f* screen, const float (*varying)[Shader::VARYINGS], TGAImage &image, const Rect &clip, const float* invW) {
+	const int N = Shader::VARYINGS;
+	const Vec3f &v0 = screen[0];
+	const Vec3f &v1 = screen[1];
+	const Vec3f &v2 = screen[2];
+
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+	if (area <= 0) return;
+
+	// Find the bounding box for the triangle
+	int x0 = std::max((int)std::floor(std::min(std::min(v0.x, v1.x), v2.x)), clip.x0);
+	int y0 = std::max((int)std::floor(std::min(std::min(v0.y, v1.y), v2.y)), clip.y0);
+	int x1 = std::min((int)std::ceil (std::max(std::max(v0.x, v1.x), v2.x)), clip.x1 - 1);
+	int y1 = std::min((int)std::ceil (std::max(std::max(v0.y, v1.y), v2.y)), clip.y1 - 1);
+	if (x0 > x1 || y0 > y1) return;
+	image.materialize(Rect(x0, y0, x1 + 1, y1 + 1));
+	typename FragmentOutput<Shader>::type output(shader, image);
+
+	// Barycentric coordinates are evaluated at the first pixel center of each row and stepped along x.
+	// Evaluating every row from scratch keeps the result independent of where the clipping rectangle
+	// starts, so a band rasterized on its own matches the same rows of a whole-image pass.
+	float inv = 1.f / area;
+	float px = x0 + .5f;
+	const Vec3f* from[3] = {&v1, &v2, &v0};
+	const Vec3f* to[3]   = {&v2, &v0, &v1};
+	float dx[3], dy[3], l[3];
+	for (int k = 0; k < 3; k++) {
+		dx[k] = -(to[k]->y - from[k]->y) * inv;
+		dy[k] =  (to[k]->x - from[k]->x) * inv;
+	}
+
+	for (int y = y0; y <= y1; y++) {
+		float py = y + .5f;
+		for (int k = 0; k < 3; k++) {
+			l[k] = dy[k] * (py - from[k]->y) + dx[k] * (px - from[k]->x);
+		}
+
+		// Solve the barycentric coordinates for the span of covered pixels
+		int left  = x0;
+		int right = x1;
+		for (int k = 0; k < 3; k++) {
+			if (dx[k] > 0) {
+				left  = std::max(left,  x0 + (int)std::ceil(-l[k] / dx[k]));
+			} else if (dx[k] < 0) {
+				right = std::min(right, x0 + (int)std::floor(l[k] / -dx[k]));
+			} else if (l[k] < 0) {
+				right = left - 1;
+			}
+		}
+
+		for (int x = left; x <= right; x++) {
+			float b0 = l[0] + dx[0] * (x - x0);
+			float b1 = l[1] + dx[1] * (x - x0);
+			float b2 = l[2] + dx[2] * (x - x0);
+
+			float z = b0 * v0.z + b1 * v1.z + b2 * v2.z;
+			float &depth = image.depth(x, y);
+			if (depth >= z) continue;
+
+			float interpolated[N];
+			if (PERSPECTIVE) {
+				float w0 = b0 * invW[0];
+				float w1 = b1 * invW[1];
+				float w2 = b2 * invW[2];
+				float w  = 1.f / (w0 + w1 + w2);
+				w0 *= w;
+				w1 *= w;
+				w2 *= w;
+				for (int k = 0; k < N; k++) {
+					interpolated[k] = w0 * varying[0][k] + w1 * varying[1][k] + w2 * varying[2][k];
+				}
+			} else {
+				for (int k = 0; k < N; k++) {
+					interpolated[k] = b0 * varying[0][k] + b1 * varying[1][k] + b2 * varying[2][k];
+				}
+			}
+
+			if (!output.write(x, y, z, interpolated)) continue;
+			depth = z;
+		}
+		output.endRow();
+	}
+}
+
+/**
+ * Fill a triangle within a rectangle of the image. Calls with disjoint rectangles may run concurrently.
+ *
+ * @param shader  the shader to run
+ * @param screen  the screen coordinates and depth of the 3 vertices
+ * @param varying the varyings of the 3 vertices
+ * @param image   the image to draw to
+ * @param clip    the rectangle that may be written to; must lie within the image
+ */
+template <class Shader>
+void rasterize(Shader &shader, const Vec3f* screen, const float (*varying)[Shader::VARYINGS], TGAImage &image, const Rect &clip) {
+	rasterizeTriangle<false>(shader, screen, varying, image, clip, NULL);
+}
+
+/**
+ * Fill a triangle, running the fragment stage of a shader on every pixel that passes the depth test.
+ * Only faces wound counter-clockwise on screen (towards the viewer) are drawn.
+ *
+ * @param shader  the shader to run
+ * @param screen  the screen coordinates and depth of the 3 vertices
+ * @param varying the varyings of the 3 vertices
+ * @param image   the image to draw to; writes are restricted to its clipping rectangle
+ */
+template <class Shader>
+void rasterize(Shader &shader, const Vec3f* screen, const float (*varying)[Shader::VARYINGS], TGAImage &image) {
+	rasterize(shader, screen, varying, image, image.getClip());
+}
+
+/**
+ * Draw every face of a model with a shader
+ *
+ * @param model  the model to draw
+ * @param shader the shader to run
+ * @param image  the image to draw to
+ */
+template <class Shader>
+void renderModel(Model &model, Shader &shader, TGAImage &image) {
+	Vec3f screen[3];
+	float varying[3][Shader::VARYINGS];
+
+	for (int i = 0; i < model.nfaces(); i++) {
+		for (int j = 0; j < 3; j++) {
+			screen[j] = shader.vertex(i, j, varying[j]);
+		}
+		rasterize(shader, screen, varying, image);
+	}
+}
+
+/**
+ * Draw the faces of a model with a shader in a given order
+ *
+ * @param model  the model to draw
+ * @param shader the shader to run
+ * @param image  the image to draw to
+ * @param order  the indices of the faces to draw, in the order to draw them
+ * @param n      the number of faces to draw
+ */
+template <class Shader>
+void renderModel(Model &model, Shader &shader, TGAImage &image, const int* order, int n) {
+	Vec3f screen[3];
+	float varying[3][Shader::VARYINGS];
+
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < 3; j++) {
+			screen[j] = shader.vertex(order[i], j, varying[j]);
+		}
+		rasterize(shader, screen, varying, image);
+	}
+}
+
+/**
+ * Draw every face of a model with a shader on a thread pool. The vertex stage runs in parallel over
+ * the faces, then each band of rows is rasterized by its own task, so no two tasks write the same pixel.
+ *
+ * @param model      the model to draw
+ * @param shader     the shader to run; both stages must be safe to call concurrently
+ * @param image      the image to draw to
+ * @param pool       the pool to run the stages on
+ * @param bandHeight the height of the bands of rows
+ */
+template <class Shader>
+void renderModel(Model &model, Shader &shader, TGAImage &image, ThreadPool &pool, int bandHeight = 32) {
+	const int N = Shader::VARYINGS;
+	int nfaces = model.nfaces();
+	std::vector<Vec3f> screen(nfaces * 3);
+	std::vector<float> varyings(nfaces * 3 * N);
+	std::vector<Vec2f> span(nfaces);
+	float (*varying)[N] = reinterpret_cast<float (*)[N]>(&varyings[0]);
+
+	pool.parallelFor(0, nfaces, 256, [&](int lo, int hi) {
+		for (int i = lo; i < hi; i++) {
+			for (int j = 0; j < 3; j++) {
+				screen[i * 3 + j] = shader.vertex(i, j, varying[i * 3 + j]);
+			}
+			span[i] = Vec2f(
+				std::min(std::min(screen[i * 3].y, screen[i * 3 + 1].y), screen[i * 3 + 2].y),
+				std::max(std::max(screen[i * 3].y, screen[i * 3 + 1].y), screen[i * 3 + 2].y)
+			);
+		}
+	});
+
+	// Materialize the tiles the model covers up front, so the bands only ever read the tile states
+	Rect clip = image.getClip();
+	Rect bounds(clip.x1, clip.y1, clip.x0, clip.y0);
+	for (int i = 0; i < nfaces * 3; i++) {
+		bounds.x0 = std::min(bounds.x0, (int)std::floor(screen[i].x));
+		bounds.y0 = std::min(bounds.y0, (int)std::floor(screen[i].y));
+		bounds.x1 = std::max(bounds.x1, (int)std::ceil(screen[i].x) + 1);
+		bounds.y1 = std::max(bounds.y1, (int)std::ceil(screen[i].y) + 1);
+	}
+	image.materialize(bounds.intersect(clip));
+
+	int nbands = (clip.y1 - clip.y0 + bandHeight - 1) / bandHeight;
+	pool.parallelFor(0, nbands, 1, [&](int lo, int hi) {
+		for (int b = lo; b < hi; b++) {
+			Rect band(clip.x0, clip.y0 + b * bandHeight, clip.x1, std::min(clip.y1, clip.y0 + (b + 1) * bandHeight));
+			for (int i = 0; i < nfaces; i++) {
+				if (span[i].y < band.y0 - 1 || span[i].x > band.y1 + 1) continue;
+				rasterize(shader, &screen[i * 3], &varying[i * 3], image, band);
+			}
+		}
+	});
+}
+
+/**
+ * Samples the texture with no lighting
+ */
+struct UnlitTexturedShader {
+	static const int VARYINGS = 2;
+
+	Model &model;
+	TGAImage &image;
+	TGAImage &texture;
+
+	UnlitTexturedShader(Model &m, TGAImage &i) : model(m), image(i), texture(m.texture()) {
+	}
+
+	Vec3f vertex(int iface, int nvert, float* varying) {
+		Vec2f uv = model.uvf(iface, nvert);
+		varying[0] = uv.x * texture.get_width();
+		varying[1] = uv.y * texture.get_height();
+		return toScreen(model.vert(model.face(iface)[nvert]), image);
+	}
+
+	bool fragment(const Vec3f &, const float* varying, TGAColor &color) {
+		color = texture.get(varying[0], varying[1]);
+		return true;
+	}
+
+	unsigned int texel(const float* varying) {
+		return texture.get(varying[0], varying[1]).val;
+	}
+
+	float intensity(const float*) {
+		return 1.f;
+	}
+};
+
+/**
+ * Lights each vertex from its normal and interpolates the intensity across the face
+ */
+struct GouraudShader {
+	static const int VARYINGS = 3;
+
+	Model &model;
+	TGAImage &image;
+	TGAImage &texture;
+	Vec3f toLight;
+
+	GouraudShader(Model &m, TGAImage &i, Vec3f lightDir) : model(m), image(i), texture(m.texture()), toLight(lightDir * -1.f) {
+		toLight.normalize();
+	}
+
+	Vec3f vertex(int iface, int nvert, float* varying) {
+		Vec2f uv = model.uvf(iface, nvert);
+		varying[0] = uv.x * texture.get_width();
+		varying[1] = uv.y * texture.get_height();
+		varying[2] = std::max(0.f, model.normal(iface, nvert) * toLight);
+		return toScreen(model.vert(model.face(iface)[nvert]), image);
+	}
+
+	bool fragment(const Vec3f &, const float* varying, TGAColor &color) {
+		color = texture.get(varying[0], varying[1]);
+		color * intensity(varying);
+		return true;
+	}
+
+	unsigned int texel(const float* varying) {
+		return texture.get(varying[0], varying[1]).val;
+	}
+
+	float intensity(const float* varying) {
+		return varying[2];
+	}
+};
+
+/**
+ * Lights each vertex like GouraudShader, sampling the model's block-compressed texture
+ */
+struct BlockTexturedShader {
+	static const int VARYINGS = 3;
+
+	Model &model;
+	TGAImage &image;
+	const BlockTexture &texture;
+	Vec3f toLight;
+
+	BlockTexturedShader(Model &m, TGAImage &i, Vec3f lightDir) : model(m), image(i), texture(m.blockTexture()), toLight(lightDir * -1.f) {
+		toLight.normalize();
+	}
+
+	Vec3f vertex(int iface, int nvert, float* varying) {
+		Vec2f uv = model.uvf(iface, nvert);
+		varying[0] = uv.x * texture.get_width();
+		varying[1] = uv.y * texture.get_height();
+		varying[2] = std::max(0.f, model.normal(iface, nvert) * toLight);
+		return toScreen(model.vert(model.face(iface)[nvert]), image);
+	}
+
+	bool fragment(const Vec3f &, const float* varying, TGAColor &color) {
+		color = texture.get(varying[0], varying[1]);
+		color * varying[2];
+		return true;
+	}
+};
+
+/**
+ * Interpolates the vertex normals across the face and lights each fragment, with a specular highlight
+ */
+struct PhongShader {
+	static const int VARYINGS = 5;
+
+	Model &model;
+	TGAImage &image;
+	TGAImage &texture;
+	Vec3f toLight;
+	Vec3f halfway;
+
+	PhongShader(Model &m, TGAImage &i, Vec3f lightDir) : model(m), image(i), texture(m.texture()), toLight(lightDir * -1.f) {
+		toLight.normalize();
+		halfway = toLight + Vec3f(0, 0, 1);
+		halfway.normalize();
+	}
+
+	Vec3f vertex(int iface, int nvert, float* varying) {
+		Vec2f uv = model.uvf(iface, nvert);
+		Vec3f n  = model.normal(iface, nvert);
+		varying[0] = uv.x * texture.get_width();
+		varying[1] = uv.y * texture.get_height();
+		varying[2] = n.x;
+		varying[3] = n.y;
+		varying[4] = n.z;
+		return toScreen(model.vert(model.face(iface)[nvert]), image);
+	}
+
+	bool fragment(const Vec3f &, const float* varying, TGAColor &color) {
+		color = texture.get(varying[0], varying[1]);
+		color * intensity(varying);
+		return true;
+	}
+
+	unsigned int texel(const float* varying) {
+		return texture.get(varying[0], varying[1]).val;
+	}
+
+	float intensity(const float* varying) {
+		Vec3f n(varying[2], varying[3], varying[4]);
+		n.normalize();
+		float diffuse  = std::max(0.f, n * toLight);
+		float specular = std::pow(std::max(0.f, n * halfway), 32.f);
+		return std::min(1.f, diffuse + .3f * specular);
+	}
+};
+
+/**
+ * Lights each face with a flat intensity, darkening the fragments a shadow map says are hidden from the light
+ */
+struct ShadowShader {
+	static const int VARYINGS = 3;
+
+	Model &model;
+	TGAImage &image;
+	TGAImage &texture;
+	const ShadowMap &shadow;
+	Vec3f toLight;
+	float ambient;
+
+	ShadowShader(Model &m, TGAImage &i, ShadowMap &s, float a) : model(m), image(i), texture(m.texture()), shadow(s), toLight(s.lightDir() * -1.f), ambient(a) {
+		s.setScreen(i.get_width(), i.get_height());
+	}
+
+	Vec3f vertex(int iface, int nvert, float* varying) {
+		const int* face = model.face(iface);
+		Vec3f v0 = model.vert(face[0]);
+		Vec3f n  = (model.vert(face[1]) - v0) ^ (model.vert(face[2]) - v0);
+		n.normalize();
+
+		Vec2f uv = model.uvf(iface, nvert);
+		varying[0] = uv.x * texture.get_width();
+		varying[1] = uv.y * texture.get_height();
+		varying[2] = ambient + (1 - ambient) * std::max(0.f, n * toLight);
+		return toScreen(model.vert(face[nvert]), image);
+	}
+
+	bool fragment(const Vec3f &frag, const float* varying, TGAColor &color) {
+		color = texture.get(varying[0], varying[1]);
+		color * (shadow.lit(frag) ? varying[2] : ambient);
+		return true;
+	}
+};
+
+/**
+ * Wraps a shader whose fragment stage scales a texel by an intensity, so that the rasterizer lights
+ * the fragments of a row together with PackedColor in fixed point rather than one TGAColor at a
+ * time in floats. The results can differ from the wrapped shader's by one level in a channel. The
+ * wrapped shader provides
+ *
+ *   unsigned int texel(const float* varying);       the texel as packed BGRA
+ *   float        intensity(const float* varying);
+ *
+ * With gamma set, the texture is taken as sRGB and lit in linear light.
+ */
+template <class Shader> struct Packed {
+	static const int VARYINGS = Shader::VARYINGS;
+
+	Shader &shader;
+	bool gamma;
+
+	Packed(Shader &s, bool g = false) : shader(s), gamma(g) {
+	}
+
+	Vec3f vertex(int iface, int nvert, float* varying) {
+		return shader.vertex(iface, nvert, varying);
+	}
+
+	bool fragment(const Vec3f &, const float* varying, TGAColor &color) {
+		unsigned int texel = shader.texel(varying);
+		unsigned short k = PackedColor::toFixed(shader.intensity(varying));
+		color = TGAColor(gamma ? PackedColor::scaleLinear(texel, k) : PackedColor::scale(texel, k), 4);
+		return true;
+	}
+};
+
+#endif //__SHADER_H__
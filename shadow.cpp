@@ -0,0 +1,186 @@
+#include <cmath>
+#include <algorithm>
+#include "shadow.h"
+#include "model.h"
+
+DepthMap::DepthMap(int w, int h) : width(w), height(h), depth(w * h) {
+	clear();
+}
+
+/**
+ * Reset every texel to the far plane
+ */
+void DepthMap::clear() {
+	std::fill(depth.begin(), depth.end(), -INFINITY);
+}
+
+int DepthMap::get_width() {
+	return width;
+}
+
+int DepthMap::get_height() {
+	return height;
+}
+
+/**
+ * Write the depth of a triangle. Unlike TGAImage::triFill, nothing but depth is interpolated:
+ * each row's span is solved from the edge functions and depth is stepped along it.
+ *
+ * @param v0 the map coordinates and depth of the 1st vertex
+ * @param v1 the map coordinates and depth of the 2nd vertex
+ * @param v2 the map coordinates and depth of the 3rd vertex
+ */
+void DepthMap::rasterize(Vec3f v0, Vec3f v1, Vec3f v2) {
+	// Both windings are rasterized; make the signed area positive
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+	if (area == 0) return;
+	if (area < 0) {
+		std::swap(v1, v2);
+		area = -area;
+	}
+
+	// Find the bounding box for the triangle
+	int x0 = std::max((int)std::floor(std::min(std::min(v0.x, v1.x), v2.x)), 0);
+	int y0 = std::max((int)std::floor(std::min(std::min(v0.y, v1.y), v2.y)), 0);
+	int x1 = std::min((int)std::ceil (std::max(std::max(v0.x, v1.x), v2.x)), width  - 1);
+	int y1 = std::min((int)std::ceil (std::max(std::max(v0.y, v1.y), v2.y)), height - 1);
+	if (x0 > x1 || y0 > y1) return;
+
+	// Edge functions and their steps, evaluated at the first pixel center
+	float px = x0 + .5f;
+	float py = y0 + .5f;
+	float e0 = (v2.x - v1.x) * (py - v1.y) - (v2.y - v1.y) * (px - v1.x);
+	float e1 = (v0.x - v2.x) * (py - v2.y) - (v0.y - v2.y) * (px - v2.x);
+	float e2 = (v1.x - v0.x) * (py - v0.y) - (v1.y - v0.y) * (px - v0.x);
+	float dx0 = -(v2.y - v1.y), dy0 = v2.x - v1.x;
+	float dx1 = -(v0.y - v2.y), dy1 = v0.x - v2.x;
+	float dx2 = -(v1.y - v0.y), dy2 = v1.x - v0.x;
+
+	// Depth is an affine function of the edge functions
+	float inv = 1.f / area;
+	float z   = (e0 * v0.z + e1 * v1.z + e2 * v2.z) * inv;
+	float dzx = (dx0 * v0.z + dx1 * v1.z + dx2 * v2.z) * inv;
+	float dzy = (dy0 * v0.z + dy1 * v1.z + dy2 * v2.z) * inv;
+
+	float e[3]  = {e0, e1, e2};
+	float dx[3] = {dx0, dx1, dx2};
+	float dy[3] = {dy0, dy1, dy2};
+
+	for (int y = y0; y <= y1; y++) {
+		// Solve the edge functions for the span of covered pixels, so the inner loop only tests depth
+		int left  = x0;
+		int right = x1;
+		for (int k = 0; k < 3; k++) {
+			if (dx[k] > 0) {
+				left  = std::max(left,  x0 + (int)std::ceil(-e[k] / dx[k]));
+			} else if (dx[k] < 0) {
+				right = std::min(right, x0 + (int)std::floor(e[k] / -dx[k]));
+			} else if (e[k] < 0) {
+				right = left - 1;
+			}
+		}
+
+		float* row = &depth[y * width];
+		for (int x = left; x <= right; x++) {
+			float wz = z + dzx * (x - x0);
+			row[x] = row[x] < wz ? wz : row[x];
+		}
+
+		for (int k = 0; k < 3; k++) {
+			e[k] += dy[k];
+		}
+		z += dzy;
+	}
+}
+
+/**
+ * Create a shadow map for a directional light
+ *
+ * @param lightDir   the direction the light travels in
+ * @param resolution the width and height of the map in texels
+ */
+ShadowMap::ShadowMap(Vec3f lightDir, int resolution) : map_(resolution, resolution), lightDir_(lightDir), center_(), radius_(1), bias_(0) {
+	lightDir_.normalize();
+
+	// Build an orthonormal basis where w points towards the light
+	w_ = lightDir_ * -1.f;
+	Vec3f up = std::abs(w_.y) < .99f ? Vec3f(0, 1, 0) : Vec3f(1, 0, 0);
+	u_ = up ^ w_;
+	u_.normalize();
+	v_ = w_ ^ u_;
+
+	fit(Vec3f(0, 0, 0), 1);
+	setScreen(1, 1);
+}
+
+/**
+ * Make the map cover a bounding sphere
+ *
+ * @param center the center of the sphere
+ * @param radius the radius of the sphere
+ */
+void ShadowMap::fit(Vec3f center, float radius) {
+	center_ = center;
+	radius_ = radius;
+
+	// Allow for a few texels of depth error across a texel's footprint
+	bias_ = 3.f * radius / map_.get_width();
+}
+
+/**
+ * Set the screen space that lit() receives fragments in: the default view of an image of the given size
+ *
+ * @param width  the width of the image being shaded
+ * @param height the height of the image being shaded
+ */
+void ShadowMap::setScreen(int width, int height) {
+	// world = (2 x / width - 1, 2 y / height - 1, z), composed with the (affine) world-to-map transform
+	Vec3f origin = toMap(Vec3f(-1, -1, 0));
+	Vec3f ex = toMap(Vec3f(-1 + 2.f / width, -1, 0)) - origin;
+	Vec3f ey = toMap(Vec3f(-1, -1 + 2.f / height, 0)) - origin;
+	Vec3f ez = toMap(Vec3f(-1, -1, 1)) - origin;
+
+	for (int i = 0; i < 3; i++) {
+		screen_[i][0] = ex[i];
+		screen_[i][1] = ey[i];
+		screen_[i][2] = ez[i];
+		screen_[i][3] = origin[i];
+	}
+}
+
+/**
+ * Transform a world-space point to map coordinates and depth towards the light
+ *
+ * @param world the point to transform
+ */
+Vec3f ShadowMap::toMap(Vec3f world) {
+	Vec3f d = world - center_;
+	float half = map_.get_width() * .5f;
+	return Vec3f(
+		(d * u_ / radius_ + 1) * half,
+		(d * v_ / radius_ + 1) * half,
+		d * w_
+	);
+}
+
+/**
+ * Rasterize the depth of a model as seen from the light
+ *
+ * @param model the model that casts shadows
+ */
+void ShadowMap::render(Model &model) {
+	map_.clear();
+
+	for (int i = 0; i < model.nfaces(); i++) {
+		const int* face = model.face(i);
+		map_.rasterize(toMap(model.vert(face[0])), toMap(model.vert(face[1])), toMap(model.vert(face[2])));
+	}
+}
+
+Vec3f ShadowMap::lightDir() {
+	return lightDir_;
+}
+
+DepthMap &ShadowMap::depth() {
+	return map_;
+}
@@ -0,0 +1,80 @@
+#ifndef __SHADOW_H__
+#define __SHADOW_H__
+
+#include <vector>
+#include "geometry.h"
+
+class Model;
+
+/**
+ * A compact depth-only render target. Larger depths are nearer to the viewer, as in the z-buffer.
+ */
+class DepthMap {
+private:
+	int width;
+	int height;
+	std::vector<float> depth;
+
+public:
+	DepthMap(int w, int h);
+	void clear();
+	void rasterize(Vec3f v0, Vec3f v1, Vec3f v2);
+	int get_width();
+	int get_height();
+
+	float get(int x, int y) const {
+		return depth[x + y * width];
+	}
+
+	/**
+	 * Test a point against the stored depth
+	 *
+	 * @return true if nothing in the map is nearer than z at (x, y); points outside the map are never occluded
+	 */
+	bool visible(float x, float y, float z) const {
+		int ix = x;
+		int iy = y;
+		if (x < 0 || y < 0 || ix >= width || iy >= height) return true;
+		return depth[ix + iy * width] <= z;
+	}
+};
+
+/**
+ * The depth of the scene as seen from a directional light, used to find which fragments the light
+ * does not reach
+ */
+class ShadowMap {
+private:
+	DepthMap map_;
+	Vec3f lightDir_;
+	Vec3f u_, v_, w_;
+	Vec3f center_;
+	float radius_;
+	float bias_;
+	float screen_[3][4];
+
+public:
+	ShadowMap(Vec3f lightDir, int resolution);
+	void fit(Vec3f center, float radius);
+	void setScreen(int width, int height);
+	void render(Model &model);
+	Vec3f toMap(Vec3f world);
+	Vec3f lightDir();
+	DepthMap &depth();
+
+	/**
+	 * Look up a fragment in the map
+	 *
+	 * @param p the fragment in the screen space given to setScreen
+	 *
+	 * @return true if the fragment is lit; false if it is in shadow
+	 */
+	bool lit(const Vec3f &p) const {
+		float x = screen_[0][0] * p.x + screen_[0][1] * p.y + screen_[0][2] * p.z + screen_[0][3];
+		float y = screen_[1][0] * p.x + screen_[1][1] * p.y + screen_[1][2] * p.z + screen_[1][3];
+		float z = screen_[2][0] * p.x + screen_[2][1] * p.y + screen_[2][2] * p.z + screen_[2][3];
+		return map_.visible(x, y, z + bias_);
+	}
+};
+
+#endif //__SHADOW_H__
@@ -0,0 +1,283 @@
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include "texture.h"
+#include "threadpool.h"
+
+/**
+ * Get a number that identifies a texture in the decode caches for as long as the program runs
+ */
+static unsigned int nextId() {
+	static std::atomic<unsigned int> next(1);
+	return next++;
+}
+
+BlockTexture::BlockTexture() : id(nextId()), width(0), height(0), blocksX(0), blocks() {
+}
+
+/**
+ * Compress an image
+ *
+ * @param image the image to compress; only its color channels are kept
+ */
+BlockTexture::BlockTexture(TGAImage &image) : BlockTexture(image, ThreadPool::shared()) {
+}
+
+/**
+ * Compress an image, encoding rows of blocks in parallel
+ *
+ * @param image the image to compress; only its color channels are kept
+ * @param pool  the pool to encode on
+ */
+BlockTexture::BlockTexture(TGAImage &image, ThreadPool &pool) : id(nextId()), width(image.get_width()), height(image.get_height()), blocksX((width + 3) / 4), blocks() {
+	int blocksY = (height + 3) / 4;
+	blocks.resize(blocksX * blocksY);
+
+	pool.parallelFor(0, blocksY, 4, [&](int lo, int hi) {
+		unsigned char texels[16][3];
+		for (int by = lo; by < hi; by++) {
+			for (int bx = 0; bx < blocksX; bx++) {
+				// Gather the block, repeating the last row and column of the image into partial blocks
+				for (int i = 0; i < 16; i++) {
+					TGAColor c = image.get(std::min(bx * 4 + (i & 3), width - 1), std::min(by * 4 + (i >> 2), height - 1));
+					if (c.bytespp == TGAImage::GRAYSCALE) {
+						c.g = c.r = c.b;
+					}
+					texels[i][0] = c.r;
+					texels[i][1] = c.g;
+					texels[i][2] = c.b;
+				}
+				blocks[by * blocksX + bx] = encodeBlock(texels);
+			}
+		}
+	});
+}
+
+static unsigned short toRGB565(const float* c) {
+	int r = std::min(31, std::max(0, (int)std::lround(c[0] * 31 / 255)));
+	int g = std::min(63, std::max(0, (int)std::lround(c[1] * 63 / 255)));
+	int b = std::min(31, std::max(0, (int)std::lround(c[2] * 31 / 255)));
+	return (r << 11) | (g << 5) | b;
+}
+
+static void fromRGB565(unsigned short c, int* rgb) {
+	rgb[0] = (c >> 11) & 31;
+	rgb[1] = (c >> 5) & 63;
+	rgb[2] = c & 31;
+	rgb[0] = (rgb[0] << 3) | (rgb[0] >> 2);
+	rgb[1] = (rgb[1] << 2) | (rgb[1] >> 4);
+	rgb[2] = (rgb[2] << 3) | (rgb[2] >> 2);
+}
+
+/**
+ * Build the 4 colors a block's indices select from
+ *
+ * @param c0      the 1st endpoint
+ * @param c1      the 2nd endpoint
+ * @param palette filled in with the colors as r, g, b
+ */
+static void blockPalette(unsigned short c0, unsigned short c1, int (*palette)[3]) {
+	fromRGB565(c0, palette[0]);
+	fromRGB565(c1, palette[1]);
+	for (int k = 0; k < 3; k++) {
+		palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+		palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+	}
+}
+
+/**
+ * Pick each texel's nearest color in a block's palette
+ *
+ * @return the indices, 2 bits per texel starting from the lowest bits
+ */
+static unsigned int blockIndices(const unsigned char (*texels)[3], int (*palette)[3]) {
+	unsigned int indices = 0;
+	for (int i = 0; i < 16; i++) {
+		int best = 0;
+		int bestError = 1 << 30;
+		for (int p = 0; p < 4; p++) {
+			int error = 0;
+			for (int k = 0; k < 3; k++) {
+				int d = texels[i][k] - palette[p][k];
+				error += d * d;
+			}
+			if (error < bestError) {
+				bestError = error;
+				best = p;
+			}
+		}
+		indices |= best << (2 * i);
+	}
+	return indices;
+}
+
+/**
+ * Compress 4x4 texels. The endpoints are the extremes of the texels along their principal axis,
+ * refined once by a least-squares fit to the indices they produce.
+ *
+ * @param texels the texels in rows, as r, g, b
+ */
+BlockTexture::Block BlockTexture::encodeBlock(const unsigned char (*texels)[3]) {
+	// Find the principal axis of the colors by power iteration on their covariance
+	float mean[3] = {0, 0, 0};
+	for (int i = 0; i < 16; i++) {
+		for (int k = 0; k < 3; k++) mean[k] += texels[i][k] / 16.f;
+	}
+	float cov[3][3] = {{0}};
+	for (int i = 0; i < 16; i++) {
+		float d[3] = {texels[i][0] - mean[0], texels[i][1] - mean[1], texels[i][2] - mean[2]};
+		for (int a = 0; a < 3; a++) {
+			for (int b = 0; b < 3; b++) cov[a][b] += d[a] * d[b];
+		}
+	}
+	float axis[3] = {1, 1, 1};
+	for (int iter = 0; iter < 8; iter++) {
+		float next[3];
+		for (int a = 0; a < 3; a++) {
+			next[a] = cov[a][0] * axis[0] + cov[a][1] * axis[1] + cov[a][2] * axis[2];
+		}
+		float norm = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+		if (norm < 1e-6f) break;
+		for (int a = 0; a < 3; a++) axis[a] = next[a] / norm;
+	}
+
+	// Take the extremes along the axis as the endpoints
+	float lo = 1e30f, hi = -1e30f;
+	for (int i = 0; i < 16; i++) {
+		float t = (texels[i][0] - mean[0]) * axis[0] + (texels[i][1] - mean[1]) * axis[1] + (texels[i][2] - mean[2]) * axis[2];
+		lo = std::min(lo, t);
+		hi = std::max(hi, t);
+	}
+	float e0[3], e1[3];
+	for (int k = 0; k < 3; k++) {
+		e0[k] = mean[k] + axis[k] * hi;
+		e1[k] = mean[k] + axis[k] * lo;
+	}
+
+	// Quantize the endpoints and index the texels, then refit the endpoints to the indices by least
+	// squares and keep whichever of the two encodings is closer
+	Block best;
+	int bestError = -1;
+	for (int pass = 0; pass < 2; pass++) {
+		Block block;
+		block.c0 = toRGB565(e0);
+		block.c1 = toRGB565(e1);
+
+		// The decoder reads c0 <= c1 as the 3-color mode, which this format does not use
+		if (block.c0 < block.c1) {
+			std::swap(block.c0, block.c1);
+			std::swap(e0, e1);
+		}
+		int palette[4][3];
+		blockPalette(block.c0, block.c1, palette);
+		block.indices = block.c0 == block.c1 ? 0 : blockIndices(texels, palette);
+
+		int error = 0;
+		for (int i = 0; i < 16; i++) {
+			const int* p = palette[(block.indices >> (2 * i)) & 3];
+			for (int k = 0; k < 3; k++) error += (texels[i][k] - p[k]) * (texels[i][k] - p[k]);
+		}
+		if (bestError < 0 || error < bestError) {
+			best = block;
+			bestError = error;
+		}
+		if (block.c0 == block.c1) break;
+
+		static const float weight[4] = {1.f, 0.f, 2.f / 3, 1.f / 3};
+		float aa = 0, ab = 0, bb = 0;
+		float ax[3] = {0, 0, 0}, bx[3] = {0, 0, 0};
+		for (int i = 0; i < 16; i++) {
+			float a = weight[(block.indices >> (2 * i)) & 3];
+			float b = 1 - a;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (int k = 0; k < 3; k++) {
+				ax[k] += a * texels[i][k];
+				bx[k] += b * texels[i][k];
+			}
+		}
+		float det = aa * bb - ab * ab;
+		if (std::fabs(det) < 1e-6f) break;
+		for (int k = 0; k < 3; k++) {
+			e0[k] = (ax[k] * bb - bx[k] * ab) / det;
+			e1[k] = (bx[k] * aa - ax[k] * ab) / det;
+		}
+	}
+	return best;
+}
+
+/**
+ * Expand a block into packed texels in the layout of TGAColor: b, g, r, then an opaque alpha
+ */
+void BlockTexture::decodeBlock(const Block &b, unsigned int* texels) {
+	int palette[4][3];
+	blockPalette(b.c0, b.c1, palette);
+	unsigned int packed[4];
+	for (int p = 0; p < 4; p++) {
+		packed[p] = palette[p][2] | (palette[p][1] << 8) | (palette[p][0] << 16) | 0xff000000u;
+	}
+	for (int i = 0; i < 16; i++) {
+		texels[i] = packed[(b.indices >> (2 * i)) & 3];
+	}
+}
+
+/**
+ * Get the texels of a block from the calling thread's cache, decoding the block on a miss
+ *
+ * @param bx the column of the block
+ * @param by the row of the block
+ */
+const unsigned int* BlockTexture::decoded(int bx, int by) const {
+	static thread_local CacheLine cache[CACHE_LINES];
+
+	// Neighboring blocks along a row and down a column map to different lines
+	int block = by * blocksX + bx;
+	CacheLine &line = cache[(bx + by * 5) & (CACHE_LINES - 1)];
+	if (line.owner != id || line.block != block) {
+		decodeBlock(blocks[block], line.texels);
+		line.owner = id;
+		line.block = block;
+	}
+	return line.texels;
+}
+
+int BlockTexture::get_width() const {
+	return width;
+}
+
+int BlockTexture::get_height() const {
+	return height;
+}
+
+/**
+ * Get the size of the compressed texels
+ */
+size_t BlockTexture::bytes() const {
+	return blocks.size() * sizeof(Block);
+}
+
+/**
+ * Measure the compression error against an image
+ *
+ * @param image the image that was compressed
+ *
+ * @return the root mean square error per color channel, in levels of 0 to 255
+ */
+float BlockTexture::rmse(TGAImage &image) const {
+	double sum = 0;
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			TGAColor a = image.get(x, y);
+			TGAColor b = get(x, y);
+			if (a.bytespp == TGAImage::GRAYSCALE) {
+				a.g = a.r = a.b;
+			}
+			for (int k = 0; k < 3; k++) {
+				double d = a.raw[k] - b.raw[k];
+				sum += d * d;
+			}
+		}
+	}
+	return std::sqrt(sum / (3. * width * height));
+}
@@ -0,0 +1,66 @@
+#ifndef __TEXTURE_H__
+#define __TEXTURE_H__
+
+#include <vector>
+#include "tgaimage.h"
+
+class ThreadPool;
+
+/**
+ * A texture compressed into 4x4 blocks of 8 bytes, in the layout of BC1 without its transparent
+ * mode: two RGB565 endpoints followed by a 2-bit index per texel into the endpoints and the two
+ * colors a third and two thirds of the way between them. That is 4 bits per texel against 24 for an
+ * RGB TGAImage.
+ *
+ * get() decodes whole blocks into a small cache owned by the calling thread, so the texels of a span
+ * that fall in the same block are only decoded once.
+ */
+class BlockTexture {
+private:
+	struct Block {
+		unsigned short c0;
+		unsigned short c1;
+		unsigned int indices;
+	};
+
+	struct CacheLine {
+		unsigned int owner;
+		int block;
+		unsigned int texels[16];
+	};
+
+	static const int CACHE_LINES = 64;
+
+	unsigned int id;
+	int width;
+	int height;
+	int blocksX;
+	std::vector<Block> blocks;
+
+	static Block encodeBlock(const unsigned char (*texels)[3]);
+	static void decodeBlock(const Block &b, unsigned int* texels);
+	const unsigned int* decoded(int bx, int by) const;
+
+public:
+	BlockTexture();
+	BlockTexture(TGAImage &image);
+	BlockTexture(TGAImage &image, ThreadPool &pool);
+	int get_width() const;
+	int get_height() const;
+	size_t bytes() const;
+	float rmse(TGAImage &image) const;
+
+	/**
+	 * Get the color of a texel
+	 *
+	 * @return the color, or black if the coordinates are out of bounds
+	 */
+	TGAColor get(int x, int y) const {
+		if (x<0 || y<0 || x>=width || y>=height) {
+			return TGAColor();
+		}
+		return TGAColor(decoded(x >> 2, y >> 2)[((y & 3) << 2) | (x & 3)], 3);
+	}
+};
+
+#endif //__TEXTURE_H__
@@ -1,63 +1,172 @@
 #include <iostream>
 #include <fstream>
 #include <string.h>
+#include <algorithm>
 #include <time.h>
 #include <math.h>
+#include <vector>
 #include "tgaimage.h"
+#include "threadpool.h"
+#include "framepool.h"
 
-TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
+TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0), zbuffer(NULL), clip(), framePool(NULL), tileState(NULL), tilesX(0), tilesY(0), clearedTiles(0), nclearColors(0) {
 }
 
-TGAImage::TGAImage(int w, int h, int bpp) : data(NULL), width(w), height(h), bytespp(bpp) {
-	unsigned long nbytes = width*height*bytespp;
-	data = new unsigned char[nbytes];
-	memset(data, 0, nbytes);
+TGAImage::TGAImage(int w, int h, int bpp) : data(NULL), width(w), height(h), bytespp(bpp), zbuffer(NULL), clip(0, 0, w, h), framePool(NULL), tileState(NULL) {
+	data = allocate(width*height*bytespp);
 
+	// The buffers start out cleared, so neither is written until it is drawn to
 	initializeZBuffer();
+	initializeTiles();
+	clear();
 }
 
-TGAImage::TGAImage(const TGAImage &img) {
+/**
+ * Create an image whose buffers are checked out of a pool, and returned to it when the image dies
+ *
+ * @param pool the pool, which must outlive the image
+ */
+TGAImage::TGAImage(int w, int h, int bpp, FramePool &pool) : data(NULL), width(w), height(h), bytespp(bpp), zbuffer(NULL), clip(0, 0, w, h), framePool(&pool), tileState(NULL) {
+	data = allocate(width*height*bytespp);
+	initializeZBuffer();
+	initializeTiles();
+	clear();
+}
+
+/**
+ * Copy an image onto the heap. The copy only has a depth buffer if the image has one.
+ */
+TGAImage::TGAImage(const TGAImage &img) : zbuffer(NULL), framePool(NULL), tileState(NULL) {
 	width = img.width;
 	height = img.height;
 	bytespp = img.bytespp;
 	unsigned long nbytes = width*height*bytespp;
-	data = new unsigned char[nbytes];
+	data = allocate(nbytes);
 	memcpy(data, img.data, nbytes);
+	clip = Rect(0, 0, width, height);
+
+	initializeTiles();
+	memcpy(tileState, img.tileState, tilesX*tilesY);
+	std::copy(img.clearColors, img.clearColors + img.nclearColors, clearColors);
+	clearedTiles = img.clearedTiles;
+	nclearColors = img.nclearColors;
+
+	// The depth of the materialized tiles is not copied
+	if (img.zbuffer) {
+		initializeZBuffer();
+		for (int i = 0; i < width; i++) {
+			std::fill(zbuffer[i], zbuffer[i] + height, -1.0 / 0.0);
+		}
+	}
+}
 
-	initializeZBuffer();
+/**
+ * Allocate a buffer from the pool of the image, or from the heap
+ */
+unsigned char* TGAImage::allocate(size_t bytes) {
+	return framePool ? (unsigned char*)framePool->acquire(bytes) : new unsigned char[bytes];
+}
+
+/**
+ * Release a buffer from allocate()
+ *
+ * @param bytes the size it was allocated with
+ */
+void TGAImage::release(void* p, size_t bytes) {
+	if (!p) return;
+	if (framePool) {
+		framePool->release(p, bytes);
+	} else {
+		delete [] (unsigned char*)p;
+	}
 }
 
+/**
+ * Get the size of the depth buffer block for the current size
+ */
+size_t TGAImage::depthBytes() {
+	return sizeof(float*) * width + sizeof(float) * width * height;
+}
+
+/**
+ * Allocate the depth buffer for the current size, with the columns laid end to end after their
+ * pointers
+ */
 void TGAImage::initializeZBuffer() {
-	zbuffer = new float*[width];
-	
+	zbuffer = (float**)allocate(depthBytes());
+	float* columns = (float*)(zbuffer + width);
 	for (int i = 0; i < width; i++) {
-		zbuffer[i] = new float[height];
-
-		for (int j = 0; j < height; j++) {
-			zbuffer[i][j] = -1.0 / 0.0;
-		}
+		zbuffer[i] = columns + (long)i * height;
 	}
 }
 
+void TGAImage::releaseZBuffer() {
+	release(zbuffer, depthBytes());
+	zbuffer = NULL;
+}
+
+/**
+ * Allocate the tile states for the current size, with every tile materialized
+ */
+void TGAImage::initializeTiles() {
+	release(tileState, tilesX*tilesY);
+	tilesX = (width  + TILE - 1) / TILE;
+	tilesY = (height + TILE - 1) / TILE;
+	tileState = allocate(tilesX*tilesY);
+	memset(tileState, 0, tilesX*tilesY);
+	clearedTiles = 0;
+	nclearColors = 0;
+}
+
 TGAImage::~TGAImage() {
-	if (data) delete [] data;
+	release(data, width*height*bytespp);
+	releaseZBuffer();
+	release(tileState, tilesX*tilesY);
 }
 
+/**
+ * Copy an image into this one, keeping this image's pool. Like the copy constructor, this image
+ * only keeps a depth buffer if the image has one.
+ */
 TGAImage & TGAImage::operator =(const TGAImage &img) {
 	if (this != &img) {
-		if (data) delete [] data;
+		release(data, width*height*bytespp);
+		releaseZBuffer();
 		width  = img.width;
 		height = img.height;
 		bytespp = img.bytespp;
 		unsigned long nbytes = width*height*bytespp;
-		data = new unsigned char[nbytes];
+		data = allocate(nbytes);
 		memcpy(data, img.data, nbytes);
+		clip = Rect(0, 0, width, height);
+
+		initializeTiles();
+		memcpy(tileState, img.tileState, tilesX*tilesY);
+		std::copy(img.clearColors, img.clearColors + img.nclearColors, clearColors);
+		clearedTiles = img.clearedTiles;
+		nclearColors = img.nclearColors;
+
+		if (img.zbuffer) {
+			initializeZBuffer();
+			for (int i = 0; i < width; i++) {
+				std::fill(zbuffer[i], zbuffer[i] + height, -1.0 / 0.0);
+			}
+		}
 	}
 	return *this;
 }
 
-bool TGAImage::read_tga_file(const char *filename) {
-	if (data) delete [] data;
+/**
+ * Read an image from a TGA file
+ *
+ * @param filename the file to read
+ * @param bottomUp true to store the bottom row first, as the renderer and the texture lookups expect;
+ *                 false to store the top row first
+ */
+bool TGAImage::read_tga_file(const char *filename, bool bottomUp) {
+	// An image read from a file has no depth buffer
+	release(data, width*height*bytespp);
+	releaseZBuffer();
 	data = NULL;
 	std::ifstream in;
 	in.open (filename, std::ios::binary);
@@ -76,13 +185,15 @@ bool TGAImage::read_tga_file(const char *filename) {
 	width   = header.width;
 	height  = header.height;
 	bytespp = header.bitsperpixel>>3;
+	clip    = Rect(0, 0, width, height);
 	if (width<=0 || height<=0 || (bytespp!=GRAYSCALE && bytespp!=RGB && bytespp!=RGBA)) {
 		in.close();
 		std::cerr << "bad bpp (or width/height) value\n";
 		return false;
 	}
 	unsigned long nbytes = bytespp*width*height;
-	data = new unsigned char[nbytes];
+	data = allocate(nbytes);
+	initializeTiles();
 	if (3==header.datatypecode || 2==header.datatypecode) {
 		in.read((char *)data, nbytes);
 		if (!in.good()) {
@@ -101,7 +212,7 @@ bool TGAImage::read_tga_file(const char *filename) {
 		std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
 		return false;
 	}
-	if (!(header.imagedescriptor & 0x20)) {
+	if (((header.imagedescriptor & 0x20) != 0) == bottomUp) {
 		flip_vertically();
 	}
 	if (header.imagedescriptor & 0x10) {
@@ -162,6 +273,10 @@ bool TGAImage::load_rle_data(std::ifstream &in) {
 }
 
 bool TGAImage::write_tga_file(const char *filename, bool rle) {
+	return write_tga_file(filename, rle, ThreadPool::shared());
+}
+
+bool TGAImage::write_tga_file(const char *filename, bool rle, ThreadPool &pool) {
 	unsigned char developer_area_ref[4] = {0, 0, 0, 0};
 	unsigned char extension_area_ref[4] = {0, 0, 0, 0};
 	unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
@@ -186,14 +301,18 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
 		return false;
 	}
 	if (!rle) {
-		out.write((char *)data, width*height*bytespp);
+		std::vector<unsigned char> scratch;
+		for (int y = 0; y < height && out.good(); y += TILE) {
+			int y1 = std::min(height, y + TILE);
+			out.write((const char *)resolveRows(y, y1, scratch), (unsigned long)(y1 - y)*width*bytespp);
+		}
 		if (!out.good()) {
 			std::cerr << "can't unload raw data\n";
 			out.close();
 			return false;
 		}
 	} else {
-		if (!unload_rle_data(out)) {
+		if (!unload_rle_data(out, pool)) {
 			out.close();
 			std::cerr << "can't unload rle data\n";
 			return false;
@@ -222,9 +341,16 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
 }
 
 // TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
-bool TGAImage::unload_rle_data(std::ofstream &out) {
+/**
+ * RLE-encode a run of pixels into packets
+ *
+ * @param data    the first pixel
+ * @param npixels the number of pixels
+ * @param bytespp the bytes per pixel
+ * @param out     the buffer to append the packets to
+ */
+static void encode_rle(const unsigned char *data, unsigned long npixels, int bytespp, std::vector<unsigned char> &out) {
 	const unsigned char max_chunk_length = 128;
-	unsigned long npixels = width*height;
 	unsigned long curpix = 0;
 	while (curpix<npixels) {
 		unsigned long chunkstart = curpix*bytespp;
@@ -250,12 +376,59 @@ bool TGAImage::unload_rle_data(std::ofstream &out) {
 			run_length++;
 		}
 		curpix += run_length;
-		out.put(raw?run_length-1:run_length+127);
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
-			return false;
+		out.push_back(raw?run_length-1:run_length+127);
+		out.insert(out.end(), data+chunkstart, data+chunkstart+(raw?run_length*bytespp:bytespp));
+	}
+}
+
+bool TGAImage::unload_rle_data(std::ofstream &out) {
+	return unload_rle_data(out, ThreadPool::shared());
+}
+
+/**
+ * Write the pixels as RLE packets. Bands of scanlines are encoded in parallel and written in order;
+ * packets do not cross the bands, so the output only depends on the band height. A band made only
+ * of tiles cleared to the same color is written as run packets without looking at its pixels.
+ *
+ * @param out  the stream to write to
+ * @param pool the pool to encode the bands on
+ */
+bool TGAImage::unload_rle_data(std::ofstream &out, ThreadPool &pool) {
+	const int band = 2 * TILE;
+	int nbands = (height + band - 1) / band;
+	std::vector<std::vector<unsigned char> > packets(nbands);
+
+	pool.parallelFor(0, nbands, 1, [&](int lo, int hi) {
+		std::vector<unsigned char> scratch;
+		for (int b = lo; b < hi; b++) {
+			int y0 = b * band;
+			int y1 = std::min(height, y0 + band);
+			unsigned long npixels = (unsigned long)(y1 - y0) * width;
+
+			// Check whether the band is a single cleared color
+			unsigned char state = tileState[y0 / TILE * tilesX];
+			for (int i = y0 / TILE * tilesX; state && i < (y1 + TILE - 1) / TILE * tilesX; i++) {
+				if (tileState[i] != state) state = 0;
+			}
+
+			if (state) {
+				const TGAColor &c = clearColors[state - 1];
+				packets[b].reserve((npixels / 128 + 1) * (1 + bytespp));
+				for (unsigned long n = npixels; n > 0; ) {
+					unsigned long run = std::min(n, 128UL);
+					packets[b].push_back(run + 127);
+					packets[b].insert(packets[b].end(), c.raw, c.raw + bytespp);
+					n -= run;
+				}
+			} else {
+				packets[b].reserve(npixels * bytespp + npixels / 128 + 1);
+				encode_rle(resolveRows(y0, y1, scratch), npixels, bytespp, packets[b]);
+			}
 		}
-		out.write((char *)(data+chunkstart), (raw?run_length*bytespp:bytespp));
+	});
+
+	for (int b = 0; b < nbands; b++) {
+		out.write((char *)&packets[b][0], packets[b].size());
 		if (!out.good()) {
 			std::cerr << "can't dump the tga file\n";
 			return false;
@@ -268,6 +441,10 @@ TGAColor TGAImage::get(int x, int y) {
 	if (!data || x<0 || y<0 || x>=width || y>=height) {
 		return TGAColor();
 	}
+	if (clearedTiles) {
+		unsigned char state = tileState[y / TILE * tilesX + x / TILE];
+		if (state) return clearColors[state - 1];
+	}
 	return TGAColor(data+(x+y*width)*bytespp, bytespp);
 }
 
@@ -284,6 +461,9 @@ bool TGAImage::set(int x, int y, TGAColor c) {
 	if (!data || x<0 || y<0 || x>=width || y>=height) {
 		return false;
 	}
+	if (clearedTiles && tileState[y / TILE * tilesX + x / TILE]) {
+		materializeTile(x / TILE, y / TILE);
+	}
 	memcpy(data+(x+y*width)*bytespp, c.raw, bytespp);
 	return true;
 }
@@ -544,6 +724,8 @@ void TGAImage::triFillSweep(Vec3f v0, Vec3f v1, Vec3f v2, TGAColor c) {
 	float invSlope1 = (v1.x - v0.x) / (float) (v1.y - v0.y);
 	float invSlope2 = (v2.x - v1.x) / (float) (v2.y - v1.y);
 
+	materialize(Rect(std::min(std::min(v0.x, v1.x), v2.x), v0.y, std::max(std::max(v0.x, v1.x), v2.x) + 1, v2.y + 1));
+
 	// Draw the triangle
 	for (int y = std::max(0.f, v0.y); y < std::min(get_height() - 1.f, v2.y); y++) {
 		// Find the boundary for the segment between v0 and v2
@@ -601,6 +783,8 @@ void TGAImage::triFillSweep(Vec3f v0, Vec3f v1, Vec3f v2, TGAImage t) {
 	float invSlope1 = (v1.x - v0.x) / (float) (v1.y - v0.y);
 	float invSlope2 = (v2.x - v1.x) / (float) (v2.y - v1.y);
 
+	materialize(Rect(std::min(std::min(v0.x, v1.x), v2.x), v0.y, std::max(std::max(v0.x, v1.x), v2.x) + 1, v2.y + 1));
+
 	// Draw the triangle
 	for (int y = std::max(0.f, v0.y); y < std::min(get_height() - 1.f, v2.y); y++) {
 		// Find the boundary for the segment between v0 and v2
@@ -683,6 +867,7 @@ void TGAImage::triFillBound(Vec3f v0, Vec3f v1, Vec3f v2, TGAColor c) {
 	int y0 = std::max(std::min(std::min(v0.y, v1.y), v2.y), 0.f);	
 	int x1 = std::min(std::max(std::max(v0.x, v1.x), v2.x), get_width()  - 1.f);
 	int y1 = std::max(std::min(std::min(v0.y, v1.y), v2.y), get_height() - 1.f);
+	materialize(Rect(x0, y0, x1 + 1, y1 + 1));
 
 	// Fill the triangle based on the barycentric coordinates of each pixel
 	Vec2i p;
@@ -707,11 +892,30 @@ void TGAImage::triFillBound(Vec3f v0, Vec3f v1, Vec3f v2, TGAColor c) {
 /**
  * Fill the triangle defined by three points; defaults to line sweeping
  *
- * @param v0 the coordinates of the 1st vertex
- * @param v1 the coordinates of the 2nd vertex
- * @param v2 the coordinates of the 3rd vertex
+ * @param v         the screen coordinates of the 3 vertices
+ * @param u         the texture coordinates of the 3 vertices
+ * @param texture   the texture to sample
+ * @param intensity the lighting intensity of the triangle
  */
 void TGAImage::triFill(Vec3f* v, Vec2i* u, TGAImage& texture, float intensity) {
+	triFill(v, u, texture, intensity, TGAColor(255, 255, 255, 255));
+}
+
+/**
+ * Fill the triangle defined by three points, modulating the texture by a tint
+ *
+ * @param v         the screen coordinates of the 3 vertices
+ * @param u         the texture coordinates of the 3 vertices
+ * @param texture   the texture to sample
+ * @param intensity the lighting intensity of the triangle
+ * @param tint      the color to multiply the texture by
+ */
+void TGAImage::triFill(Vec3f* v, Vec2i* u, TGAImage& texture, float intensity, TGAColor tint) {
+	// Fold the tint into per-channel scaling factors
+	float kr = intensity * (tint.r / 255.f);
+	float kg = intensity * (tint.g / 255.f);
+	float kb = intensity * (tint.b / 255.f);
+
 	// Sort the vertices by height (bubblesort)
 	if (v[0].y > v[1].y) {
 		std::swap(v[0], v[1]);
@@ -728,12 +932,20 @@ void TGAImage::triFill(Vec3f* v, Vec2i* u, TGAImage& texture, float intensity) {
 		std::swap(u[0], u[1]);
 	}
 
+	materialize(Rect(
+		std::min(std::min(v[0].x, v[1].x), v[2].x), v[0].y,
+		std::max(std::max(v[0].x, v[1].x), v[2].x) + 1, v[2].y + 1
+	).intersect(clip));
+
 	int total_height = v[2].y-v[0].y;
 	for (int i=0; i<total_height; i++) {
 		bool second_half = i>v[1].y-v[0].y || v[1].y==v[0].y;
 		int segment_height = second_half ? v[2].y-v[1].y : v[1].y-v[0].y;
 		float alpha = (float)i/total_height;
-		float beta  = (float)(i-(second_half ? v[1].y-v[0].y : 0))/segment_height; // be careful: with above conditions no division by zero here
+		float beta  = (float)(i-(second_half ? v[1].y-v[0].y : 0))/segment_height;
+
+		// A segment less than a pixel tall truncates to a height of 0; keep B on the segment instead of at infinity
+		if (beta > 1) beta = 1;
 
 		Vec3f A   = v[0] + (v[2] - v[0]) * alpha;
 		Vec2i uA = u[0] + (u[2] - u[0]) * alpha;
@@ -755,12 +967,25 @@ void TGAImage::triFill(Vec3f* v, Vec2i* u, TGAImage& texture, float intensity) {
 
 		for (int j=A.x; j<=B.x; j++) {
 			float phi = B.x==A.x ? 1. : (float)(j-A.x)/(float)(B.x-A.x);
+
+			// j starts left of A.x, so keep P between A and B rather than extrapolating along a short span
+			if (phi < 0) phi = 0;
+
 			Vec3f   P = Vec3f(A) + Vec3f(B - A) * phi;
 			Vec2i uvP = uA + (uB - uA) * phi;
-			if (zbuffer[(int) P.x][(int) P.y]<P.z) {
-				zbuffer[(int) P.x][(int) P.y] = P.z;
+			int x = P.x;
+			int y = P.y;
+
+			// Skip pixels outside of the clipping rectangle
+			if (x < clip.x0 || y < clip.y0 || x >= clip.x1 || y >= clip.y1) continue;
+
+			if (zbuffer[x][y]<P.z) {
+				zbuffer[x][y] = P.z;
 				TGAColor color = texture.get(uvP.x, uvP.y);
-				set(P.x, P.y, color * intensity);
+				color.r *= kr;
+				color.g *= kg;
+				color.b *= kb;
+				set(x, y, color);
 			}
 		}
 	}
@@ -780,13 +1005,15 @@ int TGAImage::get_height() {
 
 bool TGAImage::flip_horizontally() {
 	if (!data) return false;
+	materialize();
+
+	// Mirror each row in place, a pixel at a time from both ends
+	unsigned long bytes_per_line = width*bytespp;
 	int half = width>>1;
-	for (int i=0; i<half; i++) {
-		for (int j=0; j<height; j++) {
-			TGAColor c1 = get(i, j);
-			TGAColor c2 = get(width-1-i, j);
-			set(i, j, c2);
-			set(width-1-i, j, c1);
+	for (int j=0; j<height; j++) {
+		unsigned char *line = data + j*bytes_per_line;
+		for (int i=0; i<half; i++) {
+			std::swap_ranges(line + i*bytespp, line + (i+1)*bytespp, line + (width-1-i)*bytespp);
 		}
 	}
 	return true;
@@ -795,30 +1022,281 @@ bool TGAImage::flip_horizontally() {
 bool TGAImage::flip_vertically() {
 	if (!data) return false;
 	unsigned long bytes_per_line = width*bytespp;
-	unsigned char *line = new unsigned char[bytes_per_line];
+
+	// When the tile rows mirror onto each other, swap the states of pairs of cleared tiles and only
+	// move the pixels of materialized ones
+	if (clearedTiles && height % TILE == 0) {
+		for (int ty = 0; ty <= (tilesY - 1) / 2; ty++) {
+			int ty2 = tilesY - 1 - ty;
+			for (int tx = 0; tx < tilesX; tx++) {
+				unsigned char &a = tileState[ty * tilesX + tx];
+				unsigned char &b = tileState[ty2 * tilesX + tx];
+				if (a && b) {
+					std::swap(a, b);
+					continue;
+				}
+				materializeTile(tx, ty);
+				materializeTile(tx, ty2);
+
+				unsigned long offset = tx * TILE * bytespp;
+				unsigned long nbytes = (std::min(width, (tx + 1) * TILE) - tx * TILE) * bytespp;
+				for (int j = ty * TILE; j < (ty == ty2 ? ty * TILE + TILE / 2 : (ty + 1) * TILE); j++) {
+					unsigned char *l1 = data + j*bytes_per_line + offset;
+					unsigned char *l2 = data + (height-1-j)*bytes_per_line + offset;
+					std::swap_ranges(l1, l1 + nbytes, l2);
+				}
+			}
+		}
+		return true;
+	}
+	materialize();
+
 	int half = height>>1;
 	for (int j=0; j<half; j++) {
-		unsigned long l1 = j*bytes_per_line;
-		unsigned long l2 = (height-1-j)*bytes_per_line;
-		memmove((void *)line,      (void *)(data+l1), bytes_per_line);
-		memmove((void *)(data+l1), (void *)(data+l2), bytes_per_line);
-		memmove((void *)(data+l2), (void *)line,      bytes_per_line);
+		unsigned char *l1 = data + j*bytes_per_line;
+		unsigned char *l2 = data + (height-1-j)*bytes_per_line;
+		std::swap_ranges(l1, l1 + bytes_per_line, l2);
 	}
-	delete [] line;
 	return true;
 }
 
+/**
+ * Get the pixels, materializing every cleared tile so that they can be read and written directly
+ */
 unsigned char *TGAImage::buffer() {
+	materialize();
 	return data;
 }
 
+/**
+ * Get a view of the pixels, materializing every cleared tile
+ *
+ * @return a view with the first row of the buffer as its row 0
+ */
+ImageView TGAImage::view() {
+	materialize();
+	return ImageView(data, width, height, (long)width*bytespp, bytespp, bytespp);
+}
+
+/**
+ * Get a view of a rectangle of the pixels, materializing the tiles it covers
+ *
+ * @param r the rectangle, clamped to the image
+ */
+ImageView TGAImage::view(const Rect &r) {
+	Rect part = r.intersect(Rect(0, 0, width, height));
+	if (part.empty()) return ImageView();
+	materialize(part);
+	return ImageView(data, width, height, (long)width*bytespp, bytespp, bytespp).crop(part);
+}
+
+/**
+ * Reset the color and the depth of every pixel. Only the tile states are written.
+ */
 void TGAImage::clear() {
-	memset((void *)data, 0, width*height*bytespp);
+	clear(TGAColor(0, 0, 0, 0));
+}
+
+/**
+ * Reset every pixel to a color and the far depth. Only the tile states are written.
+ *
+ * @param c the color to clear to
+ */
+void TGAImage::clear(TGAColor c) {
+	if (!tileState) return;
+	nclearColors = 1;
+	clearColors[0] = c;
+	memset(tileState, 1, tilesX*tilesY);
+	clearedTiles = tilesX*tilesY;
+}
+
+/**
+ * Reset the color and the depth of every pixel in a rectangle
+ *
+ * @param r the rectangle to reset; clamped to the image
+ */
+void TGAImage::clearRect(const Rect &r) {
+	clearRect(r, TGAColor(0, 0, 0, 0));
+}
+
+/**
+ * Reset every pixel in a rectangle to a color and the far depth. Tiles inside the rectangle are
+ * only marked as cleared; the pixels of tiles on its border are written.
+ *
+ * @param r the rectangle to reset; clamped to the image
+ * @param c the color to clear to
+ */
+void TGAImage::clearRect(const Rect &r, TGAColor c) {
+	Rect rc = r.intersect(Rect(0, 0, width, height));
+	if (rc.empty() || !data) return;
+
+	unsigned char state = clearState(c);
+	for (int ty = rc.y0 / TILE; ty <= (rc.y1 - 1) / TILE; ty++) {
+		for (int tx = rc.x0 / TILE; tx <= (rc.x1 - 1) / TILE; tx++) {
+			Rect tile = Rect(tx * TILE, ty * TILE, (tx + 1) * TILE, (ty + 1) * TILE).intersect(Rect(0, 0, width, height));
+			Rect part = tile.intersect(rc);
+			unsigned char &s = tileState[ty * tilesX + tx];
+
+			if (part == tile) {
+				if (!s) clearedTiles++;
+				s = state;
+				continue;
+			}
+
+			materializeTile(tx, ty);
+			for (int y = part.y0; y < part.y1; y++) {
+				for (int x = part.x0; x < part.x1; x++) {
+					memcpy(data + (x + y * width) * bytespp, c.raw, bytespp);
+				}
+			}
+			if (!zbuffer) continue;
+			for (int x = part.x0; x < part.x1; x++) {
+				std::fill(zbuffer[x] + part.y0, zbuffer[x] + part.y1, -1.0 / 0.0);
+			}
+		}
+	}
+}
+
+/**
+ * Find the tile state for a clear color, adding the color if it is new
+ *
+ * @param c the clear color
+ *
+ * @return the tile state that stands for the color
+ */
+unsigned char TGAImage::clearState(TGAColor c) {
+	for (int i = 0; i < nclearColors; i++) {
+		if (!memcmp(clearColors[i].raw, c.raw, bytespp)) return i + 1;
+	}
+
+	// Out of colors; write out the cleared tiles so that the list can start over
+	if (nclearColors == 255) {
+		materialize();
+		nclearColors = 0;
+	}
+	clearColors[nclearColors++] = c;
+	return nclearColors;
+}
+
+/**
+ * Write the clear color and the far depth into a cleared tile
+ *
+ * @param tx the column of the tile
+ * @param ty the row of the tile
+ */
+void TGAImage::materializeTile(int tx, int ty) {
+	unsigned char &state = tileState[ty * tilesX + tx];
+	if (!state) return;
+
+	const TGAColor &c = clearColors[state - 1];
+	int x0 = tx * TILE, x1 = std::min(width,  x0 + TILE);
+	int y0 = ty * TILE, y1 = std::min(height, y0 + TILE);
+	for (int y = y0; y < y1; y++) {
+		unsigned char *p = data + (x0 + y * width) * bytespp;
+		for (int x = x0; x < x1; x++, p += bytespp) {
+			memcpy(p, c.raw, bytespp);
+		}
+	}
+	if (zbuffer) {
+		for (int x = x0; x < x1; x++) {
+			std::fill(zbuffer[x] + y0, zbuffer[x] + y1, -1.0 / 0.0);
+		}
+	}
+
+	state = 0;
+	clearedTiles--;
+}
+
+/**
+ * Materialize every cleared tile
+ */
+void TGAImage::materialize() {
+	materialize(Rect(0, 0, width, height));
+}
+
+/**
+ * Materialize the cleared tiles overlapping a rectangle. A rasterizer calls this once per primitive
+ * before it writes pixels directly with put() and depth().
+ *
+ * @param r the rectangle that will be drawn to; clamped to the image
+ */
+void TGAImage::materialize(const Rect &r) {
+	if (!clearedTiles) return;
+	Rect c = r.intersect(Rect(0, 0, width, height));
+	if (c.empty()) return;
+
+	for (int ty = c.y0 / TILE; ty <= (c.y1 - 1) / TILE; ty++) {
+		for (int tx = c.x0 / TILE; tx <= (c.x1 - 1) / TILE; tx++) {
+			if (tileState[ty * tilesX + tx]) materializeTile(tx, ty);
+		}
+	}
+}
+
+/**
+ * Get the pixels of a band of rows without materializing them
+ *
+ * @param y0      the first row
+ * @param y1      one past the last row
+ * @param scratch storage for the rows if any of their tiles are cleared
+ *
+ * @return the pixels of the rows, row after row
+ */
+const unsigned char* TGAImage::resolveRows(int y0, int y1, std::vector<unsigned char> &scratch) const {
+	const unsigned char *rows = data + (unsigned long)y0 * width * bytespp;
+	if (!clearedTiles) return rows;
+
+	bool cleared = false;
+	for (int i = y0 / TILE * tilesX; !cleared && i < (y1 + TILE - 1) / TILE * tilesX; i++) {
+		cleared = tileState[i] != 0;
+	}
+	if (!cleared) return rows;
+
+	scratch.assign(rows, rows + (unsigned long)(y1 - y0) * width * bytespp);
+	for (int y = y0; y < y1; y++) {
+		for (int tx = 0; tx < tilesX; tx++) {
+			unsigned char state = tileState[y / TILE * tilesX + tx];
+			if (!state) continue;
+			unsigned char *p = &scratch[((y - y0) * width + tx * TILE) * bytespp];
+			for (int x = tx * TILE; x < std::min(width, (tx + 1) * TILE); x++, p += bytespp) {
+				memcpy(p, clearColors[state - 1].raw, bytespp);
+			}
+		}
+	}
+	return &scratch[0];
+}
+
+int TGAImage::getClearedTiles() {
+	return clearedTiles;
+}
+
+/**
+ * Restrict the triangle rasterizer to a rectangle of the image
+ *
+ * @param r the rectangle that may be written to; clamped to the image
+ */
+void TGAImage::setClip(const Rect &r) {
+	clip = r.intersect(Rect(0, 0, width, height));
+}
+
+/**
+ * Let the triangle rasterizer write to the whole image
+ */
+void TGAImage::resetClip() {
+	clip = Rect(0, 0, width, height);
+}
+
+Rect TGAImage::getClip() {
+	return clip;
 }
 
 bool TGAImage::scale(int w, int h) {
 	if (w<=0 || h<=0 || !data) return false;
-	unsigned char *tdata = new unsigned char[w*h*bytespp];
+	materialize();
+
+	// When shrinking, every pixel is written at or before the position it is read from, so the
+	// image can be resampled in place. A pooled buffer has to go back at the size it was taken at.
+	bool inplace = !framePool && w<=width && h<=height;
+	unsigned char *tdata = inplace ? data : allocate(w*h*bytespp);
 	int nscanline = 0;
 	int oscanline = 0;
 	int erry = 0;
@@ -834,7 +1312,7 @@ bool TGAImage::scale(int w, int h) {
 			while (errx>=(int)width) {
 				errx -= width;
 				nx += bytespp;
-				memcpy(tdata+nscanline+nx, data+oscanline+ox, bytespp);
+				memmove(tdata+nscanline+nx, data+oscanline+ox, bytespp);
 			}
 		}
 		erry += h;
@@ -846,10 +1324,315 @@ bool TGAImage::scale(int w, int h) {
 			nscanline += nlinebytes;
 		}
 	}
-	delete [] data;
-	data = tdata;
+	if (!inplace) {
+		release(data, width*height*bytespp);
+		data = tdata;
+	}
+
+	// The depth is not resampled, only cleared to the far plane at the new size
+	bool depth = zbuffer != NULL;
+	releaseZBuffer();
 	width = w;
 	height = h;
+	clip = Rect(0, 0, w, h);
+	initializeTiles();
+	if (depth) {
+		initializeZBuffer();
+		for (int i = 0; i < width; i++) {
+			std::fill(zbuffer[i], zbuffer[i] + height, -1.0 / 0.0);
+		}
+	}
+	return true;
+}
+
+
+TGAStream::TGAStream() : width(0), height(0), bytespp(0), rle(true), rows(0) {
+}
+
+TGAStream::~TGAStream() {
+	if (out.is_open()) out.close();
+}
+
+/**
+ * Create a file and write its header. Rows are stored bottom-up, the order they are written in.
+ *
+ * @param filename the file to create
+ * @param w        the width of the image; at most MAX_SIZE
+ * @param h        the height of the image; at most MAX_SIZE
+ * @param bpp      the bytes per pixel
+ * @param rle      whether to RLE-encode the rows
+ *
+ * @return false if the size is out of range or the file could not be written
+ */
+bool TGAStream::open(const char *filename, int w, int h, int bpp, bool rle) {
+	if (w<=0 || h<=0 || w>MAX_SIZE || h>MAX_SIZE) {
+		std::cerr << "bad width/height value " << w << "x" << h << "\n";
+		return false;
+	}
+	out.open(filename, std::ios::binary);
+	if (!out.is_open()) {
+		std::cerr << "can't open file " << filename << "\n";
+		return false;
+	}
+	width   = w;
+	height  = h;
+	bytespp = bpp;
+	this->rle = rle;
+	rows    = 0;
+
+	TGA_Header header;
+	memset((void *)&header, 0, sizeof(header));
+	header.bitsperpixel = bytespp<<3;
+	header.width  = width;
+	header.height = height;
+	header.datatypecode = (bytespp==TGAImage::GRAYSCALE?(rle?11:3):(rle?10:2));
+	header.imagedescriptor = 0x00; // bottom-left origin
+	out.write((char *)&header, sizeof(header));
+	if (!out.good()) {
+		std::cerr << "can't dump the tga file\n";
+		out.close();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Append the next rows of the file, taken from a window of an image
+ *
+ * @param image the image holding the rows
+ * @param x0    the column of the image the rows start at; the next width pixels are written
+ * @param y0    the first row of the image to write
+ * @param nrows the number of rows to write
+ */
+bool TGAStream::write(const TGAImage &image, int x0, int y0, int nrows) {
+	if (!out.is_open() || image.bytespp!=bytespp || x0<0 || x0+width>image.width || y0<0 || y0+nrows>image.height || rows+nrows>height) {
+		std::cerr << "rows out of range\n";
+		return false;
+	}
+
+	std::vector<unsigned char> scratch;
+	std::vector<unsigned char> packets;
+	const unsigned char *pixels = image.resolveRows(y0, y0 + nrows, scratch);
+	unsigned long linebytes = (unsigned long)image.width*bytespp;
+	for (int j=0; j<nrows; j++) {
+		const unsigned char *line = pixels + j*linebytes + (unsigned long)x0*bytespp;
+		if (rle) {
+			packets.clear();
+			encode_rle(line, width, bytespp, packets);
+			out.write((char *)&packets[0], packets.size());
+		} else {
+			out.write((char *)line, (unsigned long)width*bytespp);
+		}
+	}
+	if (!out.good()) {
+		std::cerr << "can't dump the tga file\n";
+		return false;
+	}
+	rows += nrows;
+	return true;
+}
+
+/**
+ * Write the footer and close the file
+ *
+ * @return false if rows are missing or the file could not be written
+ */
+bool TGAStream::close() {
+	unsigned char developer_area_ref[4] = {0, 0, 0, 0};
+	unsigned char extension_area_ref[4] = {0, 0, 0, 0};
+	unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
+	if (!out.is_open()) return false;
+	out.write((char *)developer_area_ref, sizeof(developer_area_ref));
+	out.write((char *)extension_area_ref, sizeof(extension_area_ref));
+	out.write((char *)footer, sizeof(footer));
+	bool good = out.good();
+	out.close();
+	if (!good) {
+		std::cerr << "can't dump the tga file\n";
+		return false;
+	}
+	if (rows != height) {
+		std::cerr << "only " << rows << " of " << height << " rows written\n";
+		return false;
+	}
+	return true;
+}
+
+int TGAStream::get_rows() {
+	return rows;
+}
+
+ImageView::ImageView() : base_(NULL), width_(0), height_(0), pitch_(0), stride_(0), bytespp_(0) {
+}
+
+/**
+ * @param base   the address of pixel (0, 0)
+ * @param w      the width of the view
+ * @param h      the height of the view
+ * @param pitch  the bytes from a pixel to the one below it; negative when rows go up in memory
+ * @param stride the bytes from a pixel to the one on its right; negative when pixels go left in memory
+ * @param bpp    the bytes per pixel
+ */
+ImageView::ImageView(unsigned char* base, int w, int h, long pitch, int stride, int bpp) :
+	base_(base), width_(w), height_(h), pitch_(pitch), stride_(stride), bytespp_(bpp) {
+}
+
+/**
+ * @return a view of the same pixels upside down
+ */
+ImageView ImageView::flipVertically() const {
+	if (height_ == 0) return *this;
+	return ImageView(pixel(0, height_ - 1), width_, height_, -pitch_, stride_, bytespp_);
+}
+
+/**
+ * @return a view of the same pixels mirrored left to right
+ */
+ImageView ImageView::flipHorizontally() const {
+	if (width_ == 0) return *this;
+	return ImageView(pixel(width_ - 1, 0), width_, height_, pitch_, -stride_, bytespp_);
+}
+
+/**
+ * @param r the rectangle to keep, clamped to the view
+ *
+ * @return a view of the pixels in the rectangle, with its corner as pixel (0, 0)
+ */
+ImageView ImageView::crop(const Rect &r) const {
+	Rect part = r.intersect(Rect(0, 0, width_, height_));
+	if (part.empty()) return ImageView();
+	return ImageView(pixel(part.x0, part.y0), part.x1 - part.x0, part.y1 - part.y0, pitch_, stride_, bytespp_);
+}
+
+TGAColor ImageView::get(int x, int y) const {
+	if (!base_ || x<0 || y<0 || x>=width_ || y>=height_) {
+		return TGAColor();
+	}
+	return TGAColor(pixel(x, y), bytespp_);
+}
+
+/**
+ * Set the value of a pixel in the view
+ *
+ * @return false if the given coordinates are out of bounds; true otherwise
+ */
+bool ImageView::set(int x, int y, TGAColor c) const {
+	if (!base_ || x<0 || y<0 || x>=width_ || y>=height_) {
+		return false;
+	}
+	memcpy(pixel(x, y), c.raw, bytespp_);
 	return true;
 }
 
+/**
+ * Get a band of rows as consecutive pixels, pointing straight into the pixels when they are already
+ * laid out that way and gathering them into a scratch buffer otherwise
+ *
+ * @param y0      the first row
+ * @param y1      the row after the last
+ * @param scratch the buffer to gather the rows into
+ */
+const unsigned char* ImageView::resolveRows(int y0, int y1, std::vector<unsigned char> &scratch) const {
+	unsigned long linebytes = (unsigned long)width_*bytespp_;
+	if (stride_ == bytespp_ && pitch_ == (long)linebytes) return pixel(0, y0);
+
+	scratch.resize((y1 - y0)*linebytes);
+	for (int y = y0; y < y1; y++) {
+		unsigned char *line = &scratch[(y - y0)*linebytes];
+		if (stride_ == bytespp_) {
+			memcpy(line, pixel(0, y), linebytes);
+		} else {
+			for (int x = 0; x < width_; x++) {
+				memcpy(line + x*bytespp_, pixel(x, y), bytespp_);
+			}
+		}
+	}
+	return &scratch[0];
+}
+
+bool ImageView::write_tga_file(const char *filename, bool rle) const {
+	return write_tga_file(filename, rle, ThreadPool::shared());
+}
+
+/**
+ * Write the view to a TGA file. Rows and pixels are written in the order they lie in memory and the
+ * origin bits of the header record which corner that starts from, so a flipped view is written
+ * without moving any pixels.
+ *
+ * @param filename the file to write
+ * @param rle      true to RLE-encode the pixels
+ * @param pool     the pool to encode bands of rows on
+ */
+bool ImageView::write_tga_file(const char *filename, bool rle, ThreadPool &pool) const {
+	if (!base_ || width_>TGAStream::MAX_SIZE || height_>TGAStream::MAX_SIZE) {
+		std::cerr << "bad width/height value " << width_ << "x" << height_ << "\n";
+		return false;
+	}
+
+	ImageView m = *this;
+	unsigned char descriptor = 0x20; // top-left origin
+	if (m.pitch_ < 0) {
+		m = m.flipVertically();
+		descriptor &= ~0x20;
+	}
+	if (m.stride_ < 0) {
+		m = m.flipHorizontally();
+		descriptor |= 0x10;
+	}
+
+	std::ofstream out;
+	out.open(filename, std::ios::binary);
+	if (!out.is_open()) {
+		std::cerr << "can't open file " << filename << "\n";
+		return false;
+	}
+	TGA_Header header;
+	memset((void *)&header, 0, sizeof(header));
+	header.bitsperpixel = bytespp_<<3;
+	header.width  = width_;
+	header.height = height_;
+	header.datatypecode = (bytespp_==TGAImage::GRAYSCALE?(rle?11:3):(rle?10:2));
+	header.imagedescriptor = descriptor;
+	out.write((char *)&header, sizeof(header));
+
+	// Encode bands of rows in parallel and write them in order
+	const int band = 2 * TGAImage::TILE;
+	int nbands = (height_ + band - 1) / band;
+	std::vector<std::vector<unsigned char> > packets(rle ? nbands : 0);
+	if (rle) {
+		pool.parallelFor(0, nbands, 1, [&](int lo, int hi) {
+			std::vector<unsigned char> scratch;
+			for (int b = lo; b < hi; b++) {
+				int y0 = b * band;
+				int y1 = std::min(height_, y0 + band);
+				unsigned long npixels = (unsigned long)(y1 - y0) * width_;
+				packets[b].reserve(npixels * bytespp_ + npixels / 128 + 1);
+				encode_rle(m.resolveRows(y0, y1, scratch), npixels, bytespp_, packets[b]);
+			}
+		});
+	}
+	std::vector<unsigned char> scratch;
+	for (int b = 0; b < nbands && out.good(); b++) {
+		if (rle) {
+			out.write((char *)&packets[b][0], packets[b].size());
+		} else {
+			int y0 = b * band;
+			int y1 = std::min(height_, y0 + band);
+			out.write((const char *)m.resolveRows(y0, y1, scratch), (unsigned long)(y1 - y0)*width_*bytespp_);
+		}
+	}
+
+	unsigned char developer_area_ref[4] = {0, 0, 0, 0};
+	unsigned char extension_area_ref[4] = {0, 0, 0, 0};
+	unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
+	out.write((char *)developer_area_ref, sizeof(developer_area_ref));
+	out.write((char *)extension_area_ref, sizeof(extension_area_ref));
+	out.write((char *)footer, sizeof(footer));
+	bool good = out.good();
+	out.close();
+	if (!good) {
+		std::cerr << "can't dump the tga file\n";
+		return false;
+	}
+	return true;
+}
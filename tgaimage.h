@@ -2,8 +2,14 @@
 #define __IMAGE_H__
 
 #include <fstream>
+#include <cstring>
+#include <vector>
 #include "geometry.h"
 
+class ThreadPool;
+class TGAStream;
+class FramePool;
+
 #pragma pack(push,1)
 struct TGA_Header {
 	char idlength;
@@ -69,9 +75,61 @@ struct TGAColor {
 };
 
 
+/**
+ * A window onto pixels owned by someone else: a base pointer to pixel (0, 0), a signed pitch from
+ * one row to the next and a signed stride from one pixel to the next. Flipping and cropping only
+ * move the base and change the signs, so they take constant time and copy nothing.
+ */
+class ImageView {
+private:
+	unsigned char* base_;
+	int width_;
+	int height_;
+	long pitch_;
+	int stride_;
+	int bytespp_;
+
+	const unsigned char* resolveRows(int y0, int y1, std::vector<unsigned char> &scratch) const;
+
+public:
+	ImageView();
+	ImageView(unsigned char* base, int w, int h, long pitch, int stride, int bpp);
+	ImageView flipVertically() const;
+	ImageView flipHorizontally() const;
+	ImageView crop(const Rect &r) const;
+	TGAColor get(int x, int y) const;
+	bool set(int x, int y, TGAColor c) const;
+	bool write_tga_file(const char *filename, bool rle=true) const;
+	bool write_tga_file(const char *filename, bool rle, ThreadPool &pool) const;
+
+	int width() const { return width_; }
+	int height() const { return height_; }
+	long pitch() const { return pitch_; }
+	int stride() const { return stride_; }
+	int bytespp() const { return bytespp_; }
+	unsigned char* pixel(int x, int y) const { return base_ + y * pitch_ + (long)x * stride_; }
+};
+
+
+/*
+ * The image is divided into TILE x TILE tiles, each of which is either materialized (its color and
+ * depth live in the buffers) or cleared (every pixel holds one of the clear colors and the far depth,
+ * and the buffers hold garbage). Clearing only marks tiles; a tile is materialized the first time it
+ * is drawn to, and the encoder writes cleared tiles as constant runs without materializing them.
+ */
 class TGAImage {
 private:
+	friend class TGAStream;
+
 	void initializeZBuffer();
+	void releaseZBuffer();
+	void initializeTiles();
+	unsigned char* allocate(size_t bytes);
+	void release(void* p, size_t bytes);
+	size_t depthBytes();
+	void materializeTile(int tx, int ty);
+	unsigned char clearState(TGAColor c);
+	const unsigned char* resolveRows(int y0, int y1, std::vector<unsigned char> &scratch) const;
 
 protected:
 	unsigned char* data;
@@ -79,21 +137,39 @@ protected:
 	int height;
 	int bytespp;
 
+	// The column pointers, followed by the columns, in one block
 	float** zbuffer;
+	Rect    clip;
+
+	// Where the buffers come from, or NULL for the heap
+	FramePool* framePool;
+
+	// 0 for a materialized tile, or 1 + the index of the tile's color in clearColors
+	unsigned char* tileState;
+	int            tilesX;
+	int            tilesY;
+	int            clearedTiles;
+	TGAColor       clearColors[255];
+	int            nclearColors;
 
 	bool   load_rle_data(std::ifstream &in);
-	bool unload_rle_data(std::ofstream &out);	
+	bool unload_rle_data(std::ofstream &out);
+	bool unload_rle_data(std::ofstream &out, ThreadPool &pool);
 
 public:
 	enum Format {
 		GRAYSCALE=1, RGB=3, RGBA=4
 	};
 
+	static const int TILE = 8;
+
 	TGAImage();
 	TGAImage(int w, int h, int bpp);
+	TGAImage(int w, int h, int bpp, FramePool &pool);
 	TGAImage(const TGAImage &img);
-	bool read_tga_file(const char *filename);
+	bool read_tga_file(const char *filename, bool bottomUp=false);
 	bool write_tga_file(const char *filename, bool rle=true);
+	bool write_tga_file(const char *filename, bool rle, ThreadPool &pool);
 	bool flip_horizontally();
 	bool flip_vertically();
 	bool scale(int w, int h);
@@ -112,13 +188,57 @@ public:
 	void triFillBound(Vec2i v0, Vec2i v1, Vec2i v2, TGAColor c);
 	void triFillBound(Vec3f v0, Vec3f v1, Vec3f v2, TGAColor c);
 	void triFill(Vec3f* v, Vec2i* u, TGAImage& texture, float intensity);
+	void triFill(Vec3f* v, Vec2i* u, TGAImage& texture, float intensity, TGAColor tint);
 	~TGAImage();
 	TGAImage & operator =(const TGAImage &img);
 	int get_width();
 	int get_height();
 	int get_bytespp();
 	unsigned char *buffer();
+	ImageView view();
+	ImageView view(const Rect &r);
 	void clear();
+	void clear(TGAColor c);
+	void clearRect(const Rect &r);
+	void clearRect(const Rect &r, TGAColor c);
+	void materialize();
+	void materialize(const Rect &r);
+	int  getClearedTiles();
+	void setClip(const Rect &r);
+	void resetClip();
+	Rect getClip();
+
+	// Unchecked access for rasterizers that have already clipped to the image and materialized the pixels
+	float &depth(int x, int y) { return zbuffer[x][y]; }
+	void put(int x, int y, const TGAColor &c) { memcpy(data + (x + y * width) * bytespp, c.raw, bytespp); }
+	unsigned char* pixel(int x, int y) { return data + (x + y * width) * bytespp; }
+};
+
+/**
+ * Writes a TGA file a band of rows at a time, bottom row first, so that the whole image never has
+ * to be in memory. The file is only complete once every row has been written and it is closed.
+ */
+class TGAStream {
+private:
+	std::ofstream out;
+	int width;
+	int height;
+	int bytespp;
+	bool rle;
+	int rows;
+
+	TGAStream(const TGAStream &);
+	TGAStream & operator =(const TGAStream &);
+
+public:
+	static const int MAX_SIZE = 32767;
+
+	TGAStream();
+	~TGAStream();
+	bool open(const char *filename, int w, int h, int bpp, bool rle=true);
+	bool write(const TGAImage &image, int x0, int y0, int nrows);
+	bool close();
+	int get_rows();
 };
 
 #endif //__IMAGE_H__
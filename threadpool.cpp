@@ -0,0 +1,175 @@
+#include <algorithm>
+#include "threadpool.h"
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// The pool and index of the worker running on this thread, if any
+static thread_local ThreadPool* currentPool  = NULL;
+static thread_local int         currentIndex = -1;
+
+/**
+ * Start the workers
+ *
+ * @param threads the number of workers; defaults to the number of hardware threads
+ * @param pin     whether to pin each worker to its own core
+ */
+ThreadPool::ThreadPool(int threads, bool pin) : workers_(), stop_(false), queued_(0), next_(0) {
+	if (threads <= 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	for (int i = 0; i < threads; i++) {
+		workers_.push_back(new Worker());
+	}
+	for (int i = 0; i < threads; i++) {
+		workers_[i]->thread = std::thread(&ThreadPool::run, this, i, pin);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex_);
+		stop_ = true;
+	}
+	wake_.notify_all();
+	for (int i = 0; i < (int)workers_.size(); i++) {
+		workers_[i]->thread.join();
+		delete workers_[i];
+	}
+}
+
+int ThreadPool::size() {
+	return (int)workers_.size();
+}
+
+/**
+ * Get the pool used by every stage that is not given one explicitly
+ */
+ThreadPool &ThreadPool::shared() {
+	static ThreadPool pool;
+	return pool;
+}
+
+/**
+ * Get the index of the calling thread among this pool's workers, or -1 for other threads
+ */
+int ThreadPool::self() {
+	return currentPool == this ? currentIndex : -1;
+}
+
+/**
+ * Queue a task. Workers queue onto their own deque; other threads spread tasks over the workers.
+ *
+ * @param group the group to account the task to
+ * @param fn    the task
+ */
+void ThreadPool::submit(TaskGroup &group, const std::function<void()> &fn) {
+	int index = self();
+	if (index < 0) {
+		index = next_++ % workers_.size();
+	}
+
+	group.pending_++;
+	Worker* w = workers_[index];
+	{
+		std::lock_guard<std::mutex> lock(w->mutex);
+		w->tasks.push_back(Task());
+		w->tasks.back().fn    = fn;
+		w->tasks.back().group = &group;
+	}
+
+	queued_++;
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex_);
+	}
+	wake_.notify_one();
+}
+
+/**
+ * Take a task: the newest from our own deque, or else the oldest from another worker's
+ *
+ * @param self the index of the calling worker, or -1
+ * @param task receives the task
+ *
+ * @return false if every deque was empty
+ */
+bool ThreadPool::pop(int self, Task &task) {
+	int n = (int)workers_.size();
+	if (self >= 0) {
+		Worker* w = workers_[self];
+		std::lock_guard<std::mutex> lock(w->mutex);
+		if (!w->tasks.empty()) {
+			task = w->tasks.back();
+			w->tasks.pop_back();
+			queued_--;
+			return true;
+		}
+	}
+
+	int start = self >= 0 ? self + 1 : 0;
+	for (int k = 0; k < n; k++) {
+		Worker* w = workers_[(start + k) % n];
+		std::lock_guard<std::mutex> lock(w->mutex);
+		if (!w->tasks.empty()) {
+			task = w->tasks.front();
+			w->tasks.pop_front();
+			queued_--;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Run tasks on the calling thread until every task of a group has finished
+ *
+ * @param group the group to wait on
+ */
+void ThreadPool::wait(TaskGroup &group) {
+	int index = self();
+	Task task;
+	while (group.pending_ > 0) {
+		if (pop(index, task)) {
+			task.fn();
+			task.group->pending_--;
+		} else {
+			std::this_thread::yield();
+		}
+	}
+}
+
+/**
+ * The body of a worker thread
+ *
+ * @param index the index of the worker
+ * @param pin   whether to pin the worker to a core
+ */
+void ThreadPool::run(int index, bool pin) {
+	currentPool  = this;
+	currentIndex = index;
+
+#ifdef __linux__
+	if (pin) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(index % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+#else
+	(void)pin;
+#endif
+
+	Task task;
+	while (true) {
+		if (pop(index, task)) {
+			task.fn();
+			task.group->pending_--;
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex_);
+		wake_.wait(lock, [this] { return stop_ || queued_ > 0; });
+		if (stop_ && queued_ == 0) return;
+	}
+}
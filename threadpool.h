@@ -0,0 +1,90 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+/**
+ * A set of tasks that can be waited on together
+ */
+class TaskGroup {
+private:
+	friend class ThreadPool;
+	std::atomic<int> pending_;
+
+	TaskGroup(const TaskGroup &);
+	TaskGroup & operator =(const TaskGroup &);
+
+public:
+	TaskGroup() : pending_(0) {
+	}
+};
+
+/**
+ * A work-stealing task scheduler. Each worker has its own deque: it pushes and pops tasks at the
+ * back, and idle workers steal from the front of the others. A thread waiting on a task group runs
+ * queued tasks until the group is done, so tasks may submit and wait on tasks of their own.
+ *
+ * Every parallel stage (OBJ parsing, tile rasterization, TGA encoding) submits to the shared pool
+ * rather than starting threads of its own.
+ */
+class ThreadPool {
+private:
+	struct Task {
+		std::function<void()> fn;
+		TaskGroup* group;
+	};
+
+	struct Worker {
+		std::deque<Task> tasks;
+		std::mutex       mutex;
+		std::thread      thread;
+	};
+
+	std::vector<Worker*>    workers_;
+	std::atomic<bool>       stop_;
+	std::atomic<int>        queued_;
+	std::atomic<unsigned>   next_;
+	std::mutex              sleepMutex_;
+	std::condition_variable wake_;
+
+	int  self();
+	bool pop(int self, Task &task);
+	void run(int index, bool pin);
+
+	ThreadPool(const ThreadPool &);
+	ThreadPool & operator =(const ThreadPool &);
+
+public:
+	ThreadPool(int threads = 0, bool pin = false);
+	~ThreadPool();
+	int size();
+	void submit(TaskGroup &group, const std::function<void()> &fn);
+	void wait(TaskGroup &group);
+	static ThreadPool &shared();
+
+	/**
+	 * Run a function over a range of indices in chunks, returning when every chunk is done
+	 *
+	 * @param begin the first index
+	 * @param end   one past the last index
+	 * @param grain the number of indices per task
+	 * @param f     called as f(lo, hi) for each chunk [lo, hi)
+	 */
+	template <class F> void parallelFor(int begin, int end, int grain, const F &f) {
+		if (grain < 1) grain = 1;
+		TaskGroup group;
+		for (int lo = begin; lo < end; lo += grain) {
+			int hi = lo + grain < end ? lo + grain : end;
+			submit(group, [&f, lo, hi] { f(lo, hi); });
+		}
+		wait(group);
+	}
+};
+
+#endif //__THREADPOOL_H__
@@ -0,0 +1,378 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+#include "verify.h"
+#include "shader.h"
+#include "instance.h"
+#include "scene.h"
+#include "incremental.h"
+#include "banded.h"
+#include "order.h"
+#include "threadpool.h"
+
+// The threaded paths are checked on a pool of their own, so they split the work even on one core
+static const int THREADS = 4;
+
+/**
+ * Prepare to verify the paths for one model
+ *
+ * @param objectFile the path of the model's OBJ file, whose base name prefixes the reports and diff images
+ */
+Verifier::Verifier(const char* objectFile) : name_(), override_(), overridden_(false), checks_(0), failures_(0) {
+	std::string path(objectFile);
+	size_t slash = path.find_last_of("/\\");
+	name_ = slash == std::string::npos ? path : path.substr(slash + 1);
+	size_t dot = name_.find_last_of('.');
+	if (dot != std::string::npos) name_ = name_.substr(0, dot);
+}
+
+/**
+ * Use one tolerance for every check instead of the tolerance each check sets for itself
+ */
+void Verifier::setTolerance(const Tolerance &tolerance) {
+	override_ = tolerance;
+	overridden_ = true;
+}
+
+int Verifier::checks() {
+	return checks_;
+}
+
+int Verifier::failures() {
+	return failures_;
+}
+
+/**
+ * Compare an image with its reference pixel by pixel
+ *
+ * @param reference the image drawn by the reference path
+ * @param test      the image drawn by the path under test
+ * @param tolerance the differences to let through
+ * @param depth     true to compare the depth buffers as well as the colors
+ */
+ImageDiff Verifier::compare(TGAImage &reference, TGAImage &test, const Tolerance &tolerance, bool depth) {
+	ImageDiff diff;
+	int width = reference.get_width();
+	int height = reference.get_height();
+	diff.pixels = (long)width * height;
+	if (test.get_width() != width || test.get_height() != height || test.get_bytespp() != reference.get_bytespp()) {
+		diff.outside = diff.pixels + 1;
+		return diff;
+	}
+
+	ImageView a = reference.view();
+	ImageView b = test.view();
+	int bytespp = a.bytespp();
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			const unsigned char* pa = a.pixel(x, y);
+			const unsigned char* pb = b.pixel(x, y);
+			int delta = 0;
+			for (int c = 0; c < bytespp; c++) {
+				delta = std::max(delta, std::abs(pa[c] - pb[c]));
+			}
+			if (delta > 0) diff.colorDiffs++;
+			diff.maxColor = std::max(diff.maxColor, delta);
+			bool outside = delta > tolerance.color;
+
+			if (depth) {
+				// Both buffers hold -infinity where nothing was drawn
+				float za = reference.depth(x, y);
+				float zb = test.depth(x, y);
+				float dz = za == zb ? 0.f : std::isinf(za) || std::isinf(zb) ? INFINITY : std::fabs(za - zb);
+				if (dz > 0) diff.depthDiffs++;
+				diff.maxDepth = std::max(diff.maxDepth, dz);
+				outside = outside || dz > tolerance.depth;
+			}
+			if (outside) diff.outside++;
+		}
+	}
+	return diff;
+}
+
+/**
+ * Write an image of the differences between an image and its reference: the reference dimmed to
+ * gray where they match, red scaled by the difference where a color is out of tolerance, and blue
+ * where only the depth is
+ *
+ * @return false if the images differ in size or the file could not be written
+ */
+bool Verifier::writeDiff(TGAImage &reference, TGAImage &test, const Tolerance &tolerance, bool depth, const char* filename) {
+	int width = reference.get_width();
+	int height = reference.get_height();
+	if (test.get_width() != width || test.get_height() != height || test.get_bytespp() != reference.get_bytespp()) return false;
+
+	TGAImage diff(width, height, TGAImage::RGB);
+	ImageView a = reference.view();
+	ImageView b = test.view();
+	ImageView d = diff.view();
+	int bytespp = a.bytespp();
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			const unsigned char* pa = a.pixel(x, y);
+			const unsigned char* pb = b.pixel(x, y);
+			int delta = 0;
+			int sum = 0;
+			for (int c = 0; c < bytespp; c++) {
+				delta = std::max(delta, std::abs(pa[c] - pb[c]));
+				sum += pa[c];
+			}
+			bool depthOutside = false;
+			if (depth) {
+				float za = reference.depth(x, y);
+				float zb = test.depth(x, y);
+				depthOutside = za != zb && (std::isinf(za) || std::isinf(zb) || std::fabs(za - zb) > tolerance.depth);
+			}
+
+			unsigned char* out = d.pixel(x, y);
+			if (delta > tolerance.color) {
+				out[0] = 0;
+				out[1] = 0;
+				out[2] = (unsigned char)std::min(255, 128 + delta);
+			} else if (depthOutside) {
+				out[0] = 255;
+				out[1] = 0;
+				out[2] = 0;
+			} else {
+				out[0] = out[1] = out[2] = (unsigned char)(sum / bytespp / 3);
+			}
+		}
+	}
+	return d.flipVertically().write_tga_file(filename);
+}
+
+/**
+ * Compare the image of a path under test with its reference, report the result and write an image
+ * of the differences if it fails
+ *
+ * @param check     the name of the check
+ * @param reference the image drawn by the reference path
+ * @param test      the image drawn by the path under test
+ * @param tolerance the tolerance of the check, unless one was set for every check
+ * @param depth     true to compare the depth buffers as well as the colors
+ *
+ * @return true if the images match within the tolerance
+ */
+bool Verifier::check(const char* check, TGAImage &reference, TGAImage &test, const Tolerance &tolerance, bool depth) {
+	const Tolerance &t = overridden_ ? override_ : tolerance;
+	ImageDiff diff = compare(reference, test, t, depth);
+	bool passed = diff.within(t);
+	checks_++;
+
+	std::cerr << "# verify " << name_ << " " << check << ": " << diff.colorDiffs << "/" << diff.pixels
+		<< " pixels differ in color (max " << diff.maxColor << ")";
+	if (depth) {
+		std::cerr << ", " << diff.depthDiffs << " in depth (max " << diff.maxDepth << ")";
+	}
+	std::cerr << ", " << diff.outside << " out of tolerance " << (passed ? "ok" : "FAILED") << std::endl;
+
+	if (!passed) {
+		failures_++;
+		std::string filename = "verify_" + name_ + "_" + check + ".tga";
+		std::replace(filename.begin(), filename.end(), ' ', '_');
+		if (writeDiff(reference, test, t, depth, filename.c_str())) {
+			std::cerr << "# verify wrote " << filename << std::endl;
+		}
+	}
+	return passed;
+}
+
+/**
+ * Check the paths that draw a model with a shader against drawing it one face at a time
+ *
+ * @param name      the name of the shader
+ * @param shader    the shader, for images of the given size
+ * @param qshader   the same shader for the copy of the model
+ * @param model     the model
+ * @param copy      a copy of the model, quantized if it could be
+ * @param quantized true if the copy is quantized
+ * @param width     the width of the images to draw
+ * @param height    the height of the images to draw
+ */
+template <class Shader> void Verifier::checkShader(const char* name, Shader &shader, Shader &qshader, Model &model,
+	Model &copy, bool quantized, int width, int height) {
+	std::string prefix(name);
+	TGAImage reference(width, height, TGAImage::RGB);
+	renderModel(model, shader, reference);
+
+	ThreadPool pool(THREADS);
+	TGAImage threaded(width, height, TGAImage::RGB);
+	renderModel(model, shader, threaded, pool);
+	check((prefix + " threaded").c_str(), reference, threaded, Tolerance(), true);
+
+	// Fixed-point lighting rounds down where the float product lands just below a whole number
+	Packed<Shader> spans(shader);
+	TGAImage packed(width, height, TGAImage::RGB);
+	renderModel(model, spans, packed);
+	check((prefix + " packed").c_str(), reference, packed, Tolerance(1, 0, 0), true);
+
+	// Faces at exactly the same depth may swap which one shows
+	DepthOrder order;
+	const int* faces = order.sortFaces(model);
+	TGAImage ordered(width, height, TGAImage::RGB);
+	renderModel(model, shader, ordered, faces, model.nfaces());
+	check((prefix + " ordered").c_str(), reference, ordered, Tolerance(255, 0, .0001f), true);
+
+	// The banded renderer streams its bands to a file, so this also checks TGAStream
+	const char* bandFile = "verify_band";
+	BandedRenderer banded(bandFile, width, height, 64);
+	if (banded.render(model, shader)) {
+		TGAImage read;
+		read.read_tga_file("verify_band.tga", true);
+		check((prefix + " banded").c_str(), reference, read, Tolerance(), false);
+	} else {
+		std::cerr << "# verify " << name_ << " " << prefix << " banded: can't write verify_band.tga FAILED" << std::endl;
+		checks_++;
+		failures_++;
+	}
+	remove("verify_band.tga");
+
+	// Quantizing moves the vertices by up to half a step of 1/65535 of the bounding box, which
+	// moves edges across the odd pixel center
+	if (quantized) {
+		TGAImage image(width, height, TGAImage::RGB);
+		renderModel(copy, qshader, image);
+		check((prefix + " quantized").c_str(), reference, image, Tolerance(255, .001f, .0001f), true);
+	}
+}
+
+/**
+ * Check writing an image to a TGA file in every way and reading it back against the image in memory
+ *
+ * @param reference an image whose first row is its bottom row
+ */
+void Verifier::checkCodec(TGAImage &reference) {
+	const char* filename = "verify_codec.tga";
+	int width = reference.get_width();
+	int height = reference.get_height();
+	ThreadPool serial(1);
+	ThreadPool threaded(THREADS);
+
+	for (int mode = 0; mode < 5; mode++) {
+		const char* name = NULL;
+		bool written = false;
+		// Each way of writing, and whether its first row in memory reads back as the bottom row
+		bool bottomUp = true;
+		switch (mode) {
+		case 0:
+			name = "tga rle";
+			written = reference.view().flipVertically().write_tga_file(filename, true, serial);
+			break;
+		case 1:
+			name = "tga rle threaded";
+			written = reference.view().flipVertically().write_tga_file(filename, true, threaded);
+			break;
+		case 2:
+			name = "tga raw";
+			written = reference.view().flipVertically().write_tga_file(filename, false, threaded);
+			break;
+		case 3:
+			name = "tga top-down";
+			written = reference.view().write_tga_file(filename, true, threaded);
+			bottomUp = false;
+			break;
+		default: {
+			name = "tga stream";
+			TGAStream stream;
+			written = stream.open(filename, width, height, reference.get_bytespp());
+			for (int y = 0; written && y < height; y += 64) {
+				written = stream.write(reference, 0, y, std::min(64, height - y));
+			}
+			written = stream.close() && written;
+			break;
+		}
+		}
+
+		TGAImage read;
+		if (!written || !read.read_tga_file(filename, bottomUp)) {
+			std::cerr << "# verify " << name_ << " " << name << ": can't write or read " << filename << " FAILED" << std::endl;
+			checks_++;
+			failures_++;
+			continue;
+		}
+		check(name, reference, read, Tolerance(), false);
+	}
+	remove(filename);
+}
+
+/**
+ * Run every check for a model
+ *
+ * @param model      the model, with its texture
+ * @param objectFile the path the model was loaded from, to load the copy that is quantized
+ * @param width      the width of the images to draw
+ * @param height     the height of the images to draw
+ *
+ * @return true if every check passed
+ */
+bool Verifier::run(Model &model, const char* objectFile, int width, int height) {
+	// The reference for the fixed-function paths is Model::render, drawing with TGAImage::triFill
+	TGAImage reference(width, height, TGAImage::RGB);
+	model.render(reference);
+
+	// Drawing into an image whose tiles are all cleared materializes them as it goes
+	TGAImage cleared(width, height, TGAImage::RGB);
+	cleared.clear();
+	model.render(cleared);
+	check("trifill cleared", reference, cleared, Tolerance(), true);
+
+	InstanceSet instances(model);
+	instances.add(Instance());
+	RenderContext context;
+	context.beginFrame();
+	TGAImage instanced(width, height, TGAImage::RGB);
+	instances.render(instanced, context);
+	// Instances map to the screen in single precision, which moves the odd edge
+	check("trifill instanced", reference, instanced, Tolerance(255, .0001f, .0001f), true);
+
+	Model copy(objectFile);
+	if (!copy.packMaterials()) {
+		copy.setTexture(model.texture());
+	}
+	bool quantized = copy.quantize();
+	if (quantized) {
+		TGAImage image(width, height, TGAImage::RGB);
+		copy.render(image);
+		check("trifill quantized", reference, image, Tolerance(255, .001f, .005f), true);
+	}
+
+	// A scene redrawn tile by tile after one object moves, against drawing it again from scratch
+	Scene scene;
+	for (int i = 0; i < 9; i++) {
+		Vec3f position(-2.f / 3 + (i % 3) * 2.f / 3, -2.f / 3 + (i / 3) * 2.f / 3, 0);
+		scene.add(model, Instance(position, .3f, i * .7f, TGAColor(255, 255, 255, 255)));
+	}
+	IncrementalRenderer incremental(scene, width, height);
+	incremental.render();
+	Instance moved = scene.instance(4);
+	moved.yaw += .5f;
+	scene.move(4, moved);
+	incremental.render();
+	TGAImage full(width, height, TGAImage::RGB);
+	context.beginFrame();
+	scene.render(full, context);
+	check("scene incremental", full, incremental.image(), Tolerance(), true);
+
+	TGAImage frame(width, height, TGAImage::RGB);
+	Vec3f lightDir(1, -1, -1);
+	{
+		UnlitTexturedShader shader(model, frame);
+		UnlitTexturedShader qshader(copy, frame);
+		checkShader("unlit", shader, qshader, model, copy, quantized, width, height);
+	}
+	{
+		GouraudShader shader(model, frame, lightDir);
+		GouraudShader qshader(copy, frame, lightDir);
+		checkShader("gouraud", shader, qshader, model, copy, quantized, width, height);
+	}
+	{
+		PhongShader shader(model, frame, lightDir);
+		PhongShader qshader(copy, frame, lightDir);
+		checkShader("phong", shader, qshader, model, copy, quantized, width, height);
+	}
+
+	checkCodec(reference);
+	return failures_ == 0;
+}
@@ -0,0 +1,74 @@
+#ifndef __VERIFY_H__
+#define __VERIFY_H__
+
+#include <string>
+#include "tgaimage.h"
+#include "model.h"
+
+/**
+ * How far an image may stray from its reference and still match: the largest difference in any
+ * color channel and in depth, and the fraction of pixels allowed to exceed either
+ */
+struct Tolerance {
+	int color;
+	float depth;
+	float fraction;
+
+	Tolerance() : color(0), depth(0), fraction(0) {}
+	Tolerance(int c, float d, float f) : color(c), depth(d), fraction(f) {}
+};
+
+/**
+ * The differences between an image and its reference
+ */
+struct ImageDiff {
+	long pixels;
+	long colorDiffs;
+	int maxColor;
+	long depthDiffs;
+	float maxDepth;
+	long outside;
+
+	ImageDiff() : pixels(0), colorDiffs(0), maxColor(0), depthDiffs(0), maxDepth(0), outside(0) {}
+
+	bool within(const Tolerance &t) const {
+		return outside <= (long)(t.fraction * pixels);
+	}
+};
+
+/**
+ * Checks the optimized paths against the reference paths they replace. Each check renders the same
+ * model both ways and compares the color and depth buffers pixel by pixel; when they differ by more
+ * than the tolerance, an image of the differences is written to verify_<model>_<check>.tga.
+ *
+ * The references are Model::render, which draws with TGAImage::triFill, the shaders drawn one face
+ * at a time by renderModel, and the image in memory for the TGA codec.
+ */
+class Verifier {
+private:
+	std::string name_;
+	Tolerance override_;
+	bool overridden_;
+	int checks_;
+	int failures_;
+
+	bool check(const char* check, TGAImage &reference, TGAImage &test, const Tolerance &tolerance, bool depth);
+	template <class Shader> void checkShader(const char* name, Shader &shader, Shader &qshader, Model &model,
+		Model &copy, bool quantized, int width, int height);
+	void checkCodec(TGAImage &reference);
+
+	Verifier(const Verifier &);
+	Verifier & operator =(const Verifier &);
+
+public:
+	Verifier(const char* objectFile);
+	void setTolerance(const Tolerance &tolerance);
+	bool run(Model &model, const char* objectFile, int width, int height);
+	int checks();
+	int failures();
+
+	static ImageDiff compare(TGAImage &reference, TGAImage &test, const Tolerance &tolerance, bool depth);
+	static bool writeDiff(TGAImage &reference, TGAImage &test, const Tolerance &tolerance, bool depth, const char* filename);
+};
+
+#endif //__VERIFY_H__
@@ -0,0 +1,292 @@
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include "video.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static double elapsed(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Open the stream and start the writer thread
+ *
+ * @param path   the file or FIFO to write to, or - for standard output
+ * @param format the format of the stream
+ * @param width  the width of the frames
+ * @param height the height of the frames
+ * @param fps    the frame rate written in the Y4M header
+ * @param depth  the number of frames that may be in flight at once
+ */
+VideoWriter::VideoWriter(const char *path, Format format, int width, int height, int fps, int depth) :
+	images_(), free_(depth), pending_(depth), worker_(), out_(NULL), format_(format), width_(width), height_(height),
+	frame_(), rows_(), encode_(0), stalled_(0), frames_(0), failed_(false), finished_(false) {
+	out_ = strcmp(path, "-") ? fopen(path, "wb") : stdout;
+	if (!out_) {
+		std::cerr << "can't open " << path << "\n";
+		failed_ = true;
+	} else if (format_ == Y4M) {
+		failed_ = fprintf(out_, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n", width, height, fps) < 0;
+	}
+
+	// A frame is a luma plane and two chroma planes of half the width and height, or packed RGB
+	int cw = (width + 1) / 2;
+	int ch = (height + 1) / 2;
+	frame_.resize(format_ == Y4M ? (size_t)width * height + 2 * (size_t)cw * ch : (size_t)width * height * 3);
+	// Two rows of each color channel, two rows of luma and one of each chroma, padded to whole vectors
+	int padded = (width + 15) & ~15;
+	rows_.resize((size_t)padded * 9);
+
+	for (int i = 0; i < depth; i++) {
+		images_.push_back(new TGAImage(width, height, TGAImage::RGB));
+		free_.push(images_.back());
+	}
+	worker_ = std::thread(&VideoWriter::run, this);
+}
+
+VideoWriter::~VideoWriter() {
+	PipelineStats stats;
+	finish(stats);
+	for (int i = 0; i < (int)images_.size(); i++) {
+		delete images_[i];
+	}
+}
+
+/**
+ * Check that the stream is open and every write so far succeeded
+ */
+bool VideoWriter::good() {
+	return !failed_;
+}
+
+/**
+ * Get a cleared image to render the next frame into, waiting for the writer if every image is in flight
+ */
+TGAImage* VideoWriter::acquire() {
+	auto start = std::chrono::steady_clock::now();
+	TGAImage* image = NULL;
+	free_.pop(image);
+	stalled_ += elapsed(start);
+
+	image->clearRect(Rect(0, 0, image->get_width(), image->get_height()));
+	return image;
+}
+
+/**
+ * Queue a rendered frame to be converted and written
+ *
+ * @param image an image returned by acquire()
+ */
+void VideoWriter::submit(TGAImage* image) {
+	pending_.push(image);
+}
+
+/**
+ * Write every queued frame, stop the writer thread and close the stream
+ *
+ * @param stats receives the time spent converting and writing and the time the renderer spent waiting
+ *
+ * @return false if the stream could not be opened or a write failed
+ */
+bool VideoWriter::finish(PipelineStats &stats) {
+	if (!finished_) {
+		pending_.close();
+		worker_.join();
+		if (out_ == stdout) {
+			failed_ = fflush(out_) != 0 || failed_;
+		} else if (out_) {
+			failed_ = fclose(out_) != 0 || failed_;
+		}
+		out_ = NULL;
+		finished_ = true;
+	}
+	stats.encode  = encode_;
+	stats.stalled = stalled_;
+	return !failed_;
+}
+
+/**
+ * Get the number of frames written
+ */
+int VideoWriter::frames() {
+	return frames_;
+}
+
+/**
+ * Split a row of BGR pixels into one row per channel, repeating the last pixel up to the padded width
+ */
+static void splitRow(const ImageView &src, int y, unsigned char* r, unsigned char* g, unsigned char* b, int padded) {
+	int w = src.width();
+	for (int x = 0; x < w; x++) {
+		const unsigned char* p = src.pixel(x, y);
+		b[x] = p[0];
+		g[x] = p[1];
+		r[x] = p[2];
+	}
+	for (int x = w; x < padded; x++) {
+		r[x] = r[w - 1];
+		g[x] = g[w - 1];
+		b[x] = b[w - 1];
+	}
+}
+
+/**
+ * Convert a row of pixels to luma
+ *
+ * @param padded the width of the rows, a multiple of 16
+ */
+static void lumaRow(const unsigned char* r, const unsigned char* g, const unsigned char* b, unsigned char* luma, int padded) {
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i kr = _mm_set1_epi16(66);
+	const __m128i kg = _mm_set1_epi16(129);
+	const __m128i kb = _mm_set1_epi16(25);
+	const __m128i round = _mm_set1_epi16(128);
+	const __m128i offset = _mm_set1_epi16(16);
+	for (int x = 0; x < padded; x += 16) {
+		__m128i r8 = _mm_loadu_si128((const __m128i*)(r + x));
+		__m128i g8 = _mm_loadu_si128((const __m128i*)(g + x));
+		__m128i b8 = _mm_loadu_si128((const __m128i*)(b + x));
+		__m128i halves[2];
+		for (int h = 0; h < 2; h++) {
+			__m128i r16 = h ? _mm_unpackhi_epi8(r8, zero) : _mm_unpacklo_epi8(r8, zero);
+			__m128i g16 = h ? _mm_unpackhi_epi8(g8, zero) : _mm_unpacklo_epi8(g8, zero);
+			__m128i b16 = h ? _mm_unpackhi_epi8(b8, zero) : _mm_unpacklo_epi8(b8, zero);
+			// The weighted sum stays below 2^16, so unsigned 16-bit lanes hold it
+			__m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r16, kr), _mm_mullo_epi16(g16, kg)),
+				_mm_add_epi16(_mm_mullo_epi16(b16, kb), round));
+			halves[h] = _mm_add_epi16(_mm_srli_epi16(sum, 8), offset);
+		}
+		_mm_storeu_si128((__m128i*)(luma + x), _mm_packus_epi16(halves[0], halves[1]));
+	}
+#else
+	for (int x = 0; x < padded; x++) {
+		luma[x] = (unsigned char)(((66 * r[x] + 129 * g[x] + 25 * b[x] + 128) >> 8) + 16);
+	}
+#endif
+}
+
+/**
+ * Convert two rows of pixels to one row of each chroma plane, averaging each 2x2 block of pixels
+ *
+ * @param padded the width of the pixel rows, a multiple of 16
+ */
+static void chromaRow(const unsigned char* r0, const unsigned char* g0, const unsigned char* b0,
+	const unsigned char* r1, const unsigned char* g1, const unsigned char* b1, unsigned char* u, unsigned char* v, int padded) {
+#ifdef __SSE2__
+	const __m128i low = _mm_set1_epi16(0xff);
+	const __m128i two = _mm_set1_epi16(2);
+	const __m128i round = _mm_set1_epi16(128);
+	for (int x = 0; x < padded; x += 16) {
+		const unsigned char* rows[3][2] = {{r0, r1}, {g0, g1}, {b0, b1}};
+		__m128i mean[3];
+		for (int c = 0; c < 3; c++) {
+			// Add the even and odd pixels of both rows, pairing them up in 16-bit lanes
+			__m128i p0 = _mm_loadu_si128((const __m128i*)(rows[c][0] + x));
+			__m128i p1 = _mm_loadu_si128((const __m128i*)(rows[c][1] + x));
+			__m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(p0, low), _mm_srli_epi16(p0, 8)),
+				_mm_add_epi16(_mm_and_si128(p1, low), _mm_srli_epi16(p1, 8)));
+			mean[c] = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+		}
+		// The weighted sums lie within a signed 16-bit lane
+		__m128i cb = _mm_sub_epi16(_mm_add_epi16(_mm_mullo_epi16(mean[2], _mm_set1_epi16(112)), round),
+			_mm_add_epi16(_mm_mullo_epi16(mean[0], _mm_set1_epi16(38)), _mm_mullo_epi16(mean[1], _mm_set1_epi16(74))));
+		__m128i cr = _mm_sub_epi16(_mm_add_epi16(_mm_mullo_epi16(mean[0], _mm_set1_epi16(112)), round),
+			_mm_add_epi16(_mm_mullo_epi16(mean[1], _mm_set1_epi16(94)), _mm_mullo_epi16(mean[2], _mm_set1_epi16(18))));
+		cb = _mm_add_epi16(_mm_srai_epi16(cb, 8), round);
+		cr = _mm_add_epi16(_mm_srai_epi16(cr, 8), round);
+		__m128i packed = _mm_packus_epi16(cb, cr);
+		_mm_storel_epi64((__m128i*)(u + x / 2), packed);
+		_mm_storel_epi64((__m128i*)(v + x / 2), _mm_srli_si128(packed, 8));
+	}
+#else
+	for (int x = 0; x < padded; x += 2) {
+		int r = (r0[x] + r0[x + 1] + r1[x] + r1[x + 1] + 2) >> 2;
+		int g = (g0[x] + g0[x + 1] + g1[x] + g1[x + 1] + 2) >> 2;
+		int b = (b0[x] + b0[x + 1] + b1[x] + b1[x + 1] + 2) >> 2;
+		u[x / 2] = (unsigned char)(((112 * b - 38 * r - 74 * g + 128) >> 8) + 128);
+		v[x / 2] = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+	}
+#endif
+}
+
+/**
+ * Convert a frame to planar 4:2:0 YUV in the frame buffer, two rows at a time
+ *
+ * @param src the frame with its top row first
+ */
+void VideoWriter::convertYUV(const ImageView &src) {
+	int padded = (width_ + 15) & ~15;
+	int cw = (width_ + 1) / 2;
+	int ch = (height_ + 1) / 2;
+	unsigned char* rgb = &rows_[0];
+	unsigned char* luma = rgb + 6 * padded;
+	unsigned char* u = luma + 2 * padded;
+	unsigned char* v = u + padded / 2;
+	unsigned char* yPlane = &frame_[0];
+	unsigned char* uPlane = yPlane + (size_t)width_ * height_;
+	unsigned char* vPlane = uPlane + (size_t)cw * ch;
+
+	for (int cy = 0; cy < ch; cy++) {
+		// An odd last row pairs with itself
+		int y0 = 2 * cy;
+		int y1 = std::min(y0 + 1, height_ - 1);
+		splitRow(src, y0, rgb, rgb + padded, rgb + 2 * padded, padded);
+		splitRow(src, y1, rgb + 3 * padded, rgb + 4 * padded, rgb + 5 * padded, padded);
+		lumaRow(rgb, rgb + padded, rgb + 2 * padded, luma, padded);
+		lumaRow(rgb + 3 * padded, rgb + 4 * padded, rgb + 5 * padded, luma + padded, padded);
+		chromaRow(rgb, rgb + padded, rgb + 2 * padded, rgb + 3 * padded, rgb + 4 * padded, rgb + 5 * padded, u, v, padded);
+
+		memcpy(yPlane + (size_t)y0 * width_, luma, width_);
+		if (y1 != y0) memcpy(yPlane + (size_t)y1 * width_, luma + padded, width_);
+		memcpy(uPlane + (size_t)cy * cw, u, cw);
+		memcpy(vPlane + (size_t)cy * cw, v, cw);
+	}
+}
+
+/**
+ * Convert a frame to packed RGB in the frame buffer
+ *
+ * @param src the frame with its top row first
+ */
+void VideoWriter::convertRGB(const ImageView &src) {
+	for (int y = 0; y < height_; y++) {
+		unsigned char* out = &frame_[(size_t)y * width_ * 3];
+		for (int x = 0; x < width_; x++) {
+			const unsigned char* p = src.pixel(x, y);
+			out[3 * x]     = p[2];
+			out[3 * x + 1] = p[1];
+			out[3 * x + 2] = p[0];
+		}
+	}
+}
+
+/**
+ * The writer thread: convert and write frames until the queue is closed, handing each image back
+ * to the renderer once it is converted. After a failed write, frames are dropped.
+ */
+void VideoWriter::run() {
+	TGAImage* image = NULL;
+	while (pending_.pop(image)) {
+		auto start = std::chrono::steady_clock::now();
+		ImageView src = image->view().flipVertically();
+		if (format_ == Y4M) {
+			convertYUV(src);
+		} else {
+			convertRGB(src);
+		}
+		free_.push(image);
+
+		if (!failed_) {
+			if (format_ == Y4M) {
+				failed_ = fputs("FRAME\n", out_) < 0;
+			}
+			failed_ = failed_ || fwrite(&frame_[0], 1, frame_.size(), out_) != frame_.size();
+			if (!failed_) frames_++;
+		}
+		encode_ += elapsed(start);
+	}
+}
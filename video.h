@@ -0,0 +1,58 @@
+#ifndef __VIDEO_H__
+#define __VIDEO_H__
+
+#include <cstdio>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "tgaimage.h"
+#include "pipeline.h"
+
+/**
+ * Streams finished frames as uncompressed video to a file, a FIFO or standard output, so that a
+ * sequence can be piped straight into an encoder instead of going through a TGA file per frame.
+ * Frames are either Y4M, in 4:2:0 YUV with BT.601 limited-range coefficients, or bare RGB24 rows
+ * from the top down. Like FrameWriter, a fixed set of images circulates between the renderer and a
+ * background thread, which converts each frame and writes it while the next one is rendered.
+ */
+class VideoWriter {
+public:
+	enum Format {
+		Y4M, RGB
+	};
+
+private:
+	std::vector<TGAImage*>  images_;
+	BoundedQueue<TGAImage*> free_;
+	BoundedQueue<TGAImage*> pending_;
+	std::thread             worker_;
+	FILE*                   out_;
+	Format                  format_;
+	int                     width_;
+	int                     height_;
+	std::vector<unsigned char> frame_;
+	std::vector<unsigned char> rows_;
+	double                  encode_;
+	double                  stalled_;
+	int                     frames_;
+	std::atomic<bool>       failed_;
+	bool                    finished_;
+
+	void run();
+	void convertYUV(const ImageView &src);
+	void convertRGB(const ImageView &src);
+
+	VideoWriter(const VideoWriter &);
+	VideoWriter & operator =(const VideoWriter &);
+
+public:
+	VideoWriter(const char *path, Format format, int width, int height, int fps, int depth);
+	~VideoWriter();
+	bool good();
+	TGAImage* acquire();
+	void submit(TGAImage* image);
+	bool finish(PipelineStats &stats);
+	int frames();
+};
+
+#endif //__VIDEO_H__
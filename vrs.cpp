@@ -0,0 +1,122 @@
+#include "vrs.h"
+
+/**
+ * @param width  the width of the screen
+ * @param height the height of the screen
+ * @param rate   the rate of every tile
+ */
+RateImage::RateImage(int width, int height, int rate) :
+	tilesX((width + TILE - 1) / TILE), tilesY((height + TILE - 1) / TILE), rates(tilesX * tilesY, rate) {
+}
+
+void RateImage::fill(int rate) {
+	std::fill(rates.begin(), rates.end(), rate);
+}
+
+void RateImage::set(int tx, int ty, int rate) {
+	if (tx < 0 || ty < 0 || tx >= tilesX || ty >= tilesY) return;
+	rates[tx + ty * tilesX] = rate;
+}
+
+/**
+ * Get the finest rate of the tiles overlapping a rectangle of the screen
+ *
+ * @param r the rectangle, in pixels
+ */
+int RateImage::get(const Rect &r) const {
+	int rate = 4;
+	int tx0 = std::max(0, r.x0 / TILE), tx1 = std::min(tilesX - 1, (r.x1 - 1) / TILE);
+	int ty0 = std::max(0, r.y0 / TILE), ty1 = std::min(tilesY - 1, (r.y1 - 1) / TILE);
+	for (int ty = ty0; ty <= ty1; ty++) {
+		for (int tx = tx0; tx <= tx1; tx++) {
+			rate = std::min(rate, (int)rates[tx + ty * tilesX]);
+		}
+	}
+	return rate;
+}
+
+/**
+ * Measure the contrast of a texture: the range of the luminance of each block of texels
+ *
+ * @param texture the texture to measure
+ */
+TextureDetail::TextureDetail(TGAImage &texture) :
+	blocksX((texture.get_width() + BLOCK - 1) / BLOCK), blocksY((texture.get_height() + BLOCK - 1) / BLOCK), contrast(blocksX * blocksY) {
+	for (int by = 0; by < blocksY; by++) {
+		for (int bx = 0; bx < blocksX; bx++) {
+			int lo = 255, hi = 0;
+			for (int y = by * BLOCK; y < std::min((by + 1) * BLOCK, texture.get_height()); y++) {
+				for (int x = bx * BLOCK; x < std::min((bx + 1) * BLOCK, texture.get_width()); x++) {
+					TGAColor c = texture.get(x, y);
+					int luma = c.bytespp == TGAImage::GRAYSCALE ? c.b : (c.r * 77 + c.g * 150 + c.b * 29) >> 8;
+					lo = std::min(lo, luma);
+					hi = std::max(hi, luma);
+				}
+			}
+			contrast[bx + by * blocksX] = std::max(0, hi - lo);
+		}
+	}
+}
+
+/**
+ * Get the largest contrast over a rectangle of texels
+ */
+int TextureDetail::get(float u0, float v0, float u1, float v1) const {
+	int bx0 = std::max(0, (int)u0 / BLOCK), bx1 = std::min(blocksX - 1, (int)u1 / BLOCK);
+	int by0 = std::max(0, (int)v0 / BLOCK), by1 = std::min(blocksY - 1, (int)v1 / BLOCK);
+	int result = 0;
+	for (int by = by0; by <= by1; by++) {
+		for (int bx = bx0; bx <= bx1; bx++) {
+			result = std::max(result, (int)contrast[bx + by * blocksX]);
+		}
+	}
+	return result;
+}
+
+// The largest contrast of the texture, in levels of luminance, that may be lost to coarse shading
+static const float TEXTURE_TOLERANCE = 12;
+
+int shadingRate(const Vec3f* screen, const float* varying, int nvarying, int uv, float tolerance, const RateImage* rates, const TextureDetail* detail) {
+	const Vec3f &v0 = screen[0];
+	const Vec3f &v1 = screen[1];
+	const Vec3f &v2 = screen[2];
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+	if (std::fabs(area) < 1e-6f) return 1;
+
+	// The largest change of a varying from one pixel to the next, along x or y
+	float gradient = 0;
+	for (int k = 0; k < nvarying; k++) {
+		if (uv >= 0 && (k == uv || k == uv + 1)) continue;
+		float a0 = varying[k], a1 = varying[nvarying + k], a2 = varying[2 * nvarying + k];
+		float gx = ((a1 - a0) * (v2.y - v0.y) - (a2 - a0) * (v1.y - v0.y)) / area;
+		float gy = ((a2 - a0) * (v1.x - v0.x) - (a1 - a0) * (v2.x - v0.x)) / area;
+		gradient = std::max(gradient, std::max(std::fabs(gx), std::fabs(gy)));
+	}
+	int rate = 4;
+	while (rate > 1 && gradient * rate > tolerance) rate /= 2;
+
+	// Texture detail under the face limits the rate: a block of rate x rate pixels spans about
+	// rate * footprint texels, and the contrast over that span is taken as a fraction of the
+	// contrast measured over a whole block of the detail map
+	if (detail && uv >= 0 && rate > 1) {
+		const float* t0 = varying + uv;
+		const float* t1 = varying + nvarying + uv;
+		const float* t2 = varying + 2 * nvarying + uv;
+		float texels = std::fabs((t1[0] - t0[0]) * (t2[1] - t0[1]) - (t1[1] - t0[1]) * (t2[0] - t0[0]));
+		float footprint = std::sqrt(texels / std::fabs(area));
+		int contrast = detail->get(
+			std::min(std::min(t0[0], t1[0]), t2[0]), std::min(std::min(t0[1], t1[1]), t2[1]),
+			std::max(std::max(t0[0], t1[0]), t2[0]), std::max(std::max(t0[1], t1[1]), t2[1])
+		);
+		while (rate > 1 && contrast * std::min(1.f, rate * footprint / TextureDetail::BLOCK) > TEXTURE_TOLERANCE) rate /= 2;
+	}
+
+	if (rates && rate > 1) {
+		Rect r(
+			(int)std::floor(std::min(std::min(v0.x, v1.x), v2.x)), (int)std::floor(std::min(std::min(v0.y, v1.y), v2.y)),
+			(int)std::ceil (std::max(std::max(v0.x, v1.x), v2.x)) + 1, (int)std::ceil (std::max(std::max(v0.y, v1.y), v2.y)) + 1
+		);
+		rate = std::min(rate, rates->get(r));
+	}
+	return rate;
+}
@@ -0,0 +1,201 @@
+#ifndef __VRS_H__
+#define __VRS_H__
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "model.h"
+#include "shader.h"
+
+/**
+ * A shading rate for each tile of the screen: 1 shades every pixel, 2 one pixel in each 2x2 block
+ * and 4 one pixel in each 4x4 block
+ */
+class RateImage {
+private:
+	int tilesX;
+	int tilesY;
+	std::vector<unsigned char> rates;
+
+public:
+	static const int TILE = 16;
+
+	RateImage(int width, int height, int rate = 1);
+	void fill(int rate);
+	void set(int tx, int ty, int rate);
+	int get(const Rect &r) const;
+};
+
+/**
+ * The contrast of a texture over 8x8 blocks of texels, used to find the regions where shading
+ * one pixel for a block of pixels loses little
+ */
+class TextureDetail {
+private:
+	int blocksX;
+	int blocksY;
+	std::vector<unsigned char> contrast;
+
+public:
+	static const int BLOCK = 8;
+
+	TextureDetail(TGAImage &texture);
+	int get(float u0, float v0, float u1, float v1) const;
+};
+
+/**
+ * How a variable-rate render was shaded
+ */
+struct ShadingStats {
+	long pixels;
+	long shades;
+	int faces[5];
+
+	ShadingStats() : pixels(0), shades(0) {
+		std::fill(faces, faces + 5, 0);
+	}
+};
+
+/**
+ * Fill a triangle, running the fragment stage once for each rate x rate block of pixels and
+ * writing its color to every pixel of the block that is covered and passes the depth test. Blocks
+ * are aligned to the screen, so neighboring triangles shade matching blocks.
+ *
+ * @param shader  the shader to run
+ * @param screen  the screen coordinates and depth of the 3 vertices
+ * @param varying the varyings of the 3 vertices
+ * @param image   the image to draw to; writes are restricted to its clipping rectangle
+ * @param rate    the width and height of the blocks; 1, 2 or 4
+ * @param stats   counts the pixels written and the fragments shaded
+ */
+template <class Shader>
+void rasterize(Shader &shader, const Vec3f* screen, const float (*varying)[Shader::VARYINGS], TGAImage &image, int rate, ShadingStats &stats) {
+	const int N = Shader::VARYINGS;
+	const Vec3f &v0 = screen[0];
+	const Vec3f &v1 = screen[1];
+	const Vec3f &v2 = screen[2];
+
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+	if (area <= 0) return;
+
+	// Find the bounding box for the triangle, widened to whole blocks
+	Rect clip = image.getClip();
+	int x0 = std::max((int)std::floor(std::min(std::min(v0.x, v1.x), v2.x)), clip.x0);
+	int y0 = std::max((int)std::floor(std::min(std::min(v0.y, v1.y), v2.y)), clip.y0);
+	int x1 = std::min((int)std::ceil (std::max(std::max(v0.x, v1.x), v2.x)), clip.x1 - 1);
+	int y1 = std::min((int)std::ceil (std::max(std::max(v0.y, v1.y), v2.y)), clip.y1 - 1);
+	if (x0 > x1 || y0 > y1) return;
+	image.materialize(Rect(x0, y0, x1 + 1, y1 + 1));
+
+	float inv = 1.f / area;
+	const Vec3f* from[3] = {&v1, &v2, &v0};
+	const Vec3f* to[3]   = {&v2, &v0, &v1};
+	float dx[3], dy[3];
+	for (int k = 0; k < 3; k++) {
+		dx[k] = -(to[k]->y - from[k]->y) * inv;
+		dy[k] =  (to[k]->x - from[k]->x) * inv;
+	}
+
+	const int MAX = 16;
+	int visible[MAX];
+	float visibleZ[MAX];
+	for (int by = y0 - y0 % rate; by <= y1; by += rate) {
+		for (int bx = x0 - x0 % rate; bx <= x1; bx += rate) {
+			// Find the covered pixels of the block that pass the depth test
+			int n = 0;
+			float c[3] = {0, 0, 0};
+			for (int y = std::max(by, y0); y < std::min(by + rate, y1 + 1); y++) {
+				for (int x = std::max(bx, x0); x < std::min(bx + rate, x1 + 1); x++) {
+					float b[3];
+					for (int k = 0; k < 3; k++) {
+						b[k] = dy[k] * (y + .5f - from[k]->y) + dx[k] * (x + .5f - from[k]->x);
+					}
+					if (b[0] < 0 || b[1] < 0 || b[2] < 0) continue;
+
+					float z = b[0] * v0.z + b[1] * v1.z + b[2] * v2.z;
+					if (image.depth(x, y) >= z) continue;
+
+					visible[n] = (y - by) * rate + (x - bx);
+					visibleZ[n] = z;
+					for (int k = 0; k < 3; k++) c[k] += b[k];
+					n++;
+				}
+			}
+			if (!n) continue;
+
+			// Shade once, at the centroid of the visible pixels, which stays inside the triangle
+			for (int k = 0; k < 3; k++) c[k] /= n;
+			float interpolated[N];
+			for (int k = 0; k < N; k++) {
+				interpolated[k] = c[0] * varying[0][k] + c[1] * varying[1][k] + c[2] * varying[2][k];
+			}
+			Vec3f frag(
+				c[0] * v0.x + c[1] * v1.x + c[2] * v2.x,
+				c[0] * v0.y + c[1] * v1.y + c[2] * v2.y,
+				c[0] * v0.z + c[1] * v1.z + c[2] * v2.z
+			);
+			TGAColor color;
+			stats.shades++;
+			if (!shader.fragment(frag, interpolated, color)) continue;
+
+			for (int i = 0; i < n; i++) {
+				int x = bx + visible[i] % rate;
+				int y = by + visible[i] / rate;
+				image.depth(x, y) = visibleZ[i];
+				image.put(x, y, color);
+			}
+			stats.pixels += n;
+		}
+	}
+}
+
+/**
+ * Pick a shading rate for a face: the coarsest rate at which no varying other than the texture
+ * coordinates changes by more than a tolerance across a block, capped by the detail of the texture
+ * under the face and by the rate image
+ *
+ * @param screen    the screen coordinates of the 3 vertices
+ * @param varying   the varyings of the 3 vertices
+ * @param nvarying  the number of varyings
+ * @param uv        the index of the u texture coordinate among the varyings, followed by v, in texels;
+ *                  -1 if the shader has none
+ * @param tolerance the largest change of a varying across a block
+ * @param rates     the screen-space rate image, or NULL
+ * @param detail    the detail of the shader's texture, or NULL
+ */
+int shadingRate(const Vec3f* screen, const float* varying, int nvarying, int uv, float tolerance, const RateImage* rates, const TextureDetail* detail);
+
+/**
+ * Draw every face of a model with a shader, at a shading rate picked for each face
+ *
+ * @param model     the model to draw
+ * @param shader    the shader to run
+ * @param image     the image to draw to
+ * @param uv        the index of the u texture coordinate among the shader's varyings; -1 if none
+ * @param tolerance the largest change of another varying across a block of pixels; a negative
+ *                  tolerance shades every pixel
+ * @param rates     the screen-space rate image, or NULL for none
+ * @param detail    the detail of the shader's texture, or NULL for none
+ *
+ * @return the number of faces drawn at each rate, the pixels written and the fragments shaded
+ */
+template <class Shader>
+ShadingStats renderModel(Model &model, Shader &shader, TGAImage &image, int uv, float tolerance, const RateImage* rates, const TextureDetail* detail) {
+	Vec3f screen[3];
+	float varying[3][Shader::VARYINGS];
+	ShadingStats stats;
+
+	for (int i = 0; i < model.nfaces(); i++) {
+		for (int j = 0; j < 3; j++) {
+			screen[j] = shader.vertex(i, j, varying[j]);
+		}
+		int rate = shadingRate(screen, &varying[0][0], Shader::VARYINGS, uv, tolerance, rates, detail);
+		stats.faces[rate]++;
+		rasterize(shader, screen, varying, image, rate, stats);
+	}
+	return stats;
+}
+
+#endif //__VRS_H__
@@ -0,0 +1,234 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "wireframe.h"
+#include "model.h"
+
+/**
+ * Build the list of unique edges of a model
+ *
+ * @param model the model to draw
+ */
+Wireframe::Wireframe(Model &model) : edges_(), screen_(), lines_(), binStart_(), bins_() {
+	// Key every edge by its pair of vertices, smallest first, so that the two faces sharing an
+	// edge give the same key and sorting brings them together
+	std::vector<unsigned long long> keys;
+	keys.reserve(model.nfaces() * 3);
+	for (int i = 0; i < model.nfaces(); i++) {
+		const int* face = model.face(i);
+		for (int j = 0; j < 3; j++) {
+			unsigned int a = face[j];
+			unsigned int b = face[(j + 1) % 3];
+			if (a == b) continue;
+			if (a > b) std::swap(a, b);
+			keys.push_back((unsigned long long)a << 32 | b);
+		}
+	}
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+	edges_.reserve(keys.size());
+	for (size_t i = 0; i < keys.size(); i++) {
+		edges_.push_back(Vec2i(keys[i] >> 32, keys[i] & 0xffffffff));
+	}
+}
+
+/**
+ * @return the number of unique edges
+ */
+int Wireframe::nedges() {
+	return edges_.size();
+}
+
+/**
+ * Clip a line to a box with the Liang-Barsky algorithm
+ *
+ * @param p0 the 1st end of the line, moved onto the box if outside it
+ * @param p1 the 2nd end of the line, moved onto the box if outside it
+ * @param w  the width of the box
+ * @param h  the height of the box
+ *
+ * @return false if no part of the line is in the box
+ */
+static bool clipLine(Vec3f &p0, Vec3f &p1, float w, float h) {
+	Vec3f d = p1 - p0;
+	float p[4] = {-d.x, d.x, -d.y, d.y};
+	float q[4] = {p0.x, w - p0.x, p0.y, h - p0.y};
+	float t0 = 0;
+	float t1 = 1;
+	for (int k = 0; k < 4; k++) {
+		if (p[k] == 0) {
+			if (q[k] < 0) return false;
+		} else {
+			float t = q[k] / p[k];
+			if (p[k] < 0) t0 = std::max(t0, t);
+			else          t1 = std::min(t1, t);
+		}
+	}
+	if (t0 > t1) return false;
+
+	Vec3f a = p0;
+	p0 = a + d * t0;
+	p1 = a + d * t1;
+	return true;
+}
+
+/**
+ * Fill a run of pixels with a color, doubling the filled part with each copy so that long runs
+ * are written with wide copies
+ *
+ * @param p       the first pixel of the run
+ * @param n       the number of pixels in the run
+ * @param color   the color to fill with
+ * @param bytespp the number of bytes per pixel
+ */
+static void fillRun(unsigned char* p, int n, const TGAColor &color, int bytespp) {
+	memcpy(p, color.raw, bytespp);
+	for (int filled = 1; filled < n; ) {
+		int k = std::min(filled, n - filled);
+		memcpy(p + filled * bytespp, p, k * bytespp);
+		filled += k;
+	}
+}
+
+/**
+ * Draw the part of a clipped line that falls in a band of rows. A line steps one pixel at a time
+ * along its major axis and the pixel on the other axis is the one its center line crosses, so
+ * each band draws the same pixels it would have drawn as part of the whole line.
+ *
+ * @param line    the line, clipped to the image
+ * @param y0      the first row of the band
+ * @param y1      the row after the last row of the band
+ * @param data    the pixels of the image
+ * @param width   the width of the image
+ * @param height  the height of the image
+ * @param bytespp the number of bytes per pixel
+ * @param color   the color of the line
+ * @param depth   the depth of the faces, or NULL to draw every pixel
+ * @param bias    how far behind the faces a pixel of the line may be and still be drawn
+ */
+void Wireframe::drawBand(const Line &line, int y0, int y1, unsigned char* data, int width, int height, int bytespp, TGAColor color, const DepthMap* depth, float bias) {
+	const Vec3f &a = line.p0;
+	Vec3f d = line.p1 - line.p0;
+	bool xMajor = std::abs(d.x) >= std::abs(d.y);
+	float major0 = xMajor ? a.x : a.y;
+	float majorD = xMajor ? d.x : d.y;
+	float lo = std::min(major0, major0 + majorD);
+	float hi = std::max(major0, major0 + majorD);
+	float inv = majorD != 0 ? 1.f / majorD : 0.f;
+
+	// Step along the major axis, limited to the columns or rows that may fall in the band
+	int from = lo;
+	int to   = std::min((int)hi, (xMajor ? width : height) - 1);
+	if (!xMajor) {
+		from = std::max(from, y0);
+		to   = std::min(to, y1 - 1);
+	} else if (d.y != 0) {
+		float xa = a.x + (y0 - a.y) * d.x / d.y;
+		float xb = a.x + (y1 - a.y) * d.x / d.y;
+		from = std::max(from, (int)std::floor(std::min(xa, xb)) - 1);
+		to   = std::min(to, (int)std::max(xa, xb) + 1);
+	}
+
+	int runRow = -1;
+	int runX   = 0;
+	int runN   = 0;
+	for (int i = from; i <= to; i++) {
+		float t = std::min(std::max((i + .5f - major0) * inv, 0.f), 1.f);
+		int x, y;
+		if (xMajor) {
+			x = i;
+			y = std::min((int)(a.y + d.y * t), height - 1);
+			if (y < y0 || y >= y1) continue;
+		} else {
+			x = std::min((int)(a.x + d.x * t), width - 1);
+			y = i;
+		}
+		if (depth && a.z + d.z * t + bias < depth->get(x, y)) continue;
+
+		// Extend the current run, or draw it and start a new one
+		if (y == runRow && x == runX + runN) {
+			runN++;
+			continue;
+		}
+		if (runN > 0) fillRun(data + (runX + runRow * width) * bytespp, runN, color, bytespp);
+		runRow = y;
+		runX   = x;
+		runN   = 1;
+	}
+	if (runN > 0) fillRun(data + (runX + runRow * width) * bytespp, runN, color, bytespp);
+}
+
+/**
+ * Draw the edges of a model, with the same mapping to the screen as Model::render
+ *
+ * @param model  the model to draw, the one the edge list was built from
+ * @param image  the image to draw to
+ * @param color  the color of the lines
+ * @param pool   the threads to draw the bands on
+ * @param hidden true to leave out the parts of lines hidden behind the faces
+ * @param bias   how far behind the faces a line may be and still be drawn
+ *
+ * @return the number of lines drawn after clipping
+ */
+int Wireframe::render(Model &model, TGAImage &image, TGAColor color, ThreadPool &pool, bool hidden, float bias) {
+	int width  = image.get_width();
+	int height = image.get_height();
+	int bytespp = image.get_bytespp();
+
+	screen_.resize(model.nverts());
+	for (int i = 0; i < model.nverts(); i++) {
+		Vec3f v = model.vert(i);
+		screen_[i] = Vec3f((v.x + 1.) * width / 2., (v.y + 1.) * height / 2., v.z);
+	}
+
+	// Clip every line to the image once, so the bands never test a pixel against its bounds
+	lines_.clear();
+	for (size_t i = 0; i < edges_.size(); i++) {
+		Line line = {screen_[edges_[i].x], screen_[edges_[i].y]};
+		if (clipLine(line.p0, line.p1, width, height)) lines_.push_back(line);
+	}
+
+	// Bin the lines by the bands of rows they cross, counting first so the bins are one array
+	int nbands = (height + BAND - 1) / BAND;
+	binStart_.assign(nbands + 1, 0);
+	for (size_t i = 0; i < lines_.size(); i++) {
+		int b0 = std::min((int)std::min(lines_[i].p0.y, lines_[i].p1.y), height - 1) / BAND;
+		int b1 = std::min((int)std::max(lines_[i].p0.y, lines_[i].p1.y), height - 1) / BAND;
+		for (int b = b0; b <= b1; b++) binStart_[b + 1]++;
+	}
+	for (int b = 0; b < nbands; b++) {
+		binStart_[b + 1] += binStart_[b];
+	}
+	bins_.resize(binStart_[nbands]);
+	std::vector<int> next(binStart_.begin(), binStart_.end() - 1);
+	for (size_t i = 0; i < lines_.size(); i++) {
+		int b0 = std::min((int)std::min(lines_[i].p0.y, lines_[i].p1.y), height - 1) / BAND;
+		int b1 = std::min((int)std::max(lines_[i].p0.y, lines_[i].p1.y), height - 1) / BAND;
+		for (int b = b0; b <= b1; b++) bins_[next[b]++] = i;
+	}
+
+	DepthMap* depth = NULL;
+	if (hidden) {
+		depth = new DepthMap(width, height);
+		for (int i = 0; i < model.nfaces(); i++) {
+			const int* face = model.face(i);
+			depth->rasterize(screen_[face[0]], screen_[face[1]], screen_[face[2]]);
+		}
+	}
+
+	// Each band writes only its own rows
+	unsigned char* data = image.buffer();
+	pool.parallelFor(0, nbands, 1, [&](int lo, int hi) {
+		for (int b = lo; b < hi; b++) {
+			int y0 = b * BAND;
+			int y1 = std::min(y0 + BAND, height);
+			for (int k = binStart_[b]; k < binStart_[b + 1]; k++) {
+				drawBand(lines_[bins_[k]], y0, y1, data, width, height, bytespp, color, depth, bias);
+			}
+		}
+	});
+
+	delete depth;
+	return lines_.size();
+}
@@ -0,0 +1,41 @@
+#ifndef __WIREFRAME_H__
+#define __WIREFRAME_H__
+
+#include <vector>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "threadpool.h"
+#include "shadow.h"
+
+class Model;
+
+/**
+ * Draws the edges of a mesh. Each edge shared by two faces is drawn once. Lines are clipped to the
+ * image once, binned into bands of rows and drawn a band per task with unchecked writes to the row,
+ * filling each horizontal run of a line in one go. With hidden-line removal the faces are first
+ * drawn to a depth map and only the parts of lines in front of it are kept.
+ */
+class Wireframe {
+private:
+	struct Line {
+		Vec3f p0;
+		Vec3f p1;
+	};
+
+	std::vector<Vec2i> edges_;
+	std::vector<Vec3f> screen_;
+	std::vector<Line> lines_;
+	std::vector<int> binStart_;
+	std::vector<int> bins_;
+
+	void drawBand(const Line &line, int y0, int y1, unsigned char* data, int width, int height, int bytespp, TGAColor color, const DepthMap* depth, float bias);
+
+public:
+	static const int BAND = 32;
+
+	Wireframe(Model &model);
+	int nedges();
+	int render(Model &model, TGAImage &image, TGAColor color, ThreadPool &pool, bool hidden = false, float bias = .01f);
+};
+
+#endif //__WIREFRAME_H__